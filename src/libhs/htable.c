@@ -11,8 +11,19 @@
 #include "common_priv.h"
 #include "htable.h"
 
+static unsigned int round_up_size(unsigned int size)
+{
+    unsigned int rounded = 8;
+    while (rounded < size)
+        rounded *= 2;
+
+    return rounded;
+}
+
 int _hs_htable_init(_hs_htable *table, unsigned int size)
 {
+    size = round_up_size(size);
+
     table->heads = (void **)malloc(size * sizeof(*table->heads));
     if (!table->heads)
         return hs_error(HS_ERROR_MEMORY, NULL);
@@ -30,33 +41,87 @@ void _hs_htable_release(_hs_htable *table)
 
 _hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key)
 {
-    return (_hs_htable_head *)&table->heads[key % table->size];
+    return (_hs_htable_head *)&table->heads[key & (table->size - 1)];
+}
+
+static void grow(_hs_htable *table)
+{
+    unsigned int new_size = table->size * 2;
+    void **new_heads;
+    _hs_htable_head **tails;
+
+    /* Growing is an optimization, if we can't get the memory we just keep using
+       longer chains. */
+    new_heads = (void **)malloc(new_size * sizeof(*new_heads));
+    tails = (_hs_htable_head **)malloc(new_size * sizeof(*tails));
+    if (!new_heads || !tails) {
+        free(tails);
+        free(new_heads);
+        return;
+    }
+    for (unsigned int i = 0; i < new_size; i++)
+        tails[i] = (_hs_htable_head *)&new_heads[i];
+
+    // Move nodes in order, so that entries with the same key keep their relative order
+    for (unsigned int i = 0; i < table->size; i++) {
+        _hs_htable_head *head = (_hs_htable_head *)&table->heads[i];
+
+        for (_hs_htable_head *cur = head->next, *next; cur != head; cur = next) {
+            unsigned int idx = cur->key & (new_size - 1);
+
+            next = cur->next;
+            tails[idx]->next = cur;
+            tails[idx] = cur;
+        }
+    }
+    for (unsigned int i = 0; i < new_size; i++)
+        tails[i]->next = (_hs_htable_head *)&new_heads[i];
+
+    free(tails);
+    free(table->heads);
+    table->heads = new_heads;
+    table->size = new_size;
 }
 
 void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *n)
 {
+    if (table->count >= table->size)
+        grow(table);
+
     _hs_htable_head *head = _hs_htable_get_head(table, key);
 
     n->key = key;
 
     n->next = head->next;
     head->next = n;
+    table->count++;
 }
 
-void _hs_htable_insert(_hs_htable_head *prev, _hs_htable_head *n)
+void _hs_htable_append(_hs_htable *table, uint32_t key, _hs_htable_head *n)
 {
-    n->key = prev->key;
+    if (table->count >= table->size)
+        grow(table);
+
+    _hs_htable_head *head = _hs_htable_get_head(table, key);
+    _hs_htable_head *last = head;
+
+    while (last->next != head)
+        last = last->next;
+
+    n->key = key;
 
-    n->next = prev->next;
-    prev->next = n;
+    n->next = head;
+    last->next = n;
+    table->count++;
 }
 
-void _hs_htable_remove(_hs_htable_head *head)
+void _hs_htable_remove(_hs_htable *table, _hs_htable_head *head)
 {
     for (_hs_htable_head *prev = head->next; prev != head; prev = prev->next) {
         if (prev->next == head) {
             prev->next = head->next;
             head->next = NULL;
+            table->count--;
 
             break;
         }
@@ -67,4 +132,5 @@ void _hs_htable_clear(_hs_htable *table)
 {
     for (unsigned int i = 0; i < table->size; i++)
         table->heads[i] = (_hs_htable_head *)&table->heads[i];
+    table->count = 0;
 }
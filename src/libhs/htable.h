@@ -22,33 +22,73 @@ typedef struct _hs_htable_head {
 } _hs_htable_head;
 
 typedef struct _hs_htable {
+    // Always a power of two
     unsigned int size;
+    unsigned int count;
     void **heads;
 } _hs_htable;
 
+/* The table grows when it holds more entries than buckets. Adding entries can thus
+   move them to other buckets: don't add anything while iterating over the table. */
 int _hs_htable_init(_hs_htable *table, unsigned int size);
 void _hs_htable_release(_hs_htable *table);
 
 _hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key);
 
+// Add at the front of the bucket, use _hs_htable_append() to keep insertion order
 void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *head);
-void _hs_htable_insert(_hs_htable_head *prev, _hs_htable_head *head);
-void _hs_htable_remove(_hs_htable_head *head);
+void _hs_htable_append(_hs_htable *table, uint32_t key, _hs_htable_head *head);
+void _hs_htable_remove(_hs_htable *table, _hs_htable_head *head);
 
 void _hs_htable_clear(_hs_htable *table);
 
+static inline uint32_t _hs_htable_mix32(uint32_t hash)
+{
+    // Finalizer from MurmurHash3, buckets are picked from the low bits
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+// FxHash step, the same bytes give the same hash with both functions below
+static inline uint32_t _hs_htable_hash_step(uint32_t hash, unsigned char c)
+{
+    return (((hash << 5) | (hash >> 27)) ^ c) * 0x9E3779B9u;
+}
+
 static inline uint32_t _hs_htable_hash_str(const char *s)
 {
     uint32_t hash = 0;
     while (*s)
-        hash = hash * 101 + (unsigned char)*s++;
+        hash = _hs_htable_hash_step(hash, (unsigned char)*s++);
 
-    return hash;
+    return _hs_htable_mix32(hash);
+}
+
+static inline uint32_t _hs_htable_hash_mem(const void *mem, size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)mem;
+
+    uint32_t hash = 0;
+    for (size_t i = 0; i < len; i++)
+        hash = _hs_htable_hash_step(hash, bytes[i]);
+
+    return _hs_htable_mix32(hash);
 }
 
 static inline uint32_t _hs_htable_hash_ptr(const void *p)
 {
-    return (uint32_t)((uintptr_t)p >> 3);
+    uint64_t value = (uint64_t)(uintptr_t)p;
+
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+
+    return (uint32_t)value;
 }
 
 /* While a break will only end the inner loop, the outer loop will subsequently fail
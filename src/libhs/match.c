@@ -45,14 +45,27 @@ int hs_match_parse(const char *str, hs_match_spec *rspec)
     return 0;
 }
 
+static int compare_entries(const void *ptr1, const void *ptr2)
+{
+    const _hs_match_entry *entry1 = (const _hs_match_entry *)ptr1;
+    const _hs_match_entry *entry2 = (const _hs_match_entry *)ptr2;
+
+    if (entry1->vid != entry2->vid)
+        return entry1->vid < entry2->vid ? -1 : 1;
+    if (entry1->pid != entry2->pid)
+        return entry1->pid < entry2->pid ? -1 : 1;
+    if (entry1->spec != entry2->spec)
+        return entry1->spec < entry2->spec ? -1 : 1;
+    return 0;
+}
+
 int _hs_match_helper_init(_hs_match_helper *helper, const hs_match_spec *specs,
                           unsigned int specs_count)
 {
+    memset(helper, 0, sizeof(*helper));
+
     if (!specs) {
-        helper->specs = NULL;
-        helper->specs_count = 0;
         helper->types = UINT32_MAX;
-
         return 0;
     }
 
@@ -60,7 +73,6 @@ int _hs_match_helper_init(_hs_match_helper *helper, const hs_match_spec *specs,
     helper->specs = specs_count ? (hs_match_spec *)specs : NULL;
     helper->specs_count = specs_count;
 
-    helper->types = 0;
     for (unsigned int i = 0; i < specs_count; i++) {
         if (!specs[i].type) {
             helper->types = UINT32_MAX;
@@ -70,12 +82,41 @@ int _hs_match_helper_init(_hs_match_helper *helper, const hs_match_spec *specs,
         helper->types |= (uint32_t)(1 << specs[i].type);
     }
 
+    /* Callers can pass thousands of VID:PID pairs, and every device event goes through
+       _hs_match_helper_match(). Specs with a VID go to a sorted table so that we only
+       test the few that can match, the others are tested in order. */
+    if (specs_count) {
+        helper->entries = (_hs_match_entry *)malloc(specs_count * sizeof(*helper->entries));
+        helper->generic = (unsigned int *)malloc(specs_count * sizeof(*helper->generic));
+        if (!helper->entries || !helper->generic) {
+            _hs_match_helper_release(helper);
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        }
+
+        for (unsigned int i = 0; i < specs_count; i++) {
+            if (specs[i].vid) {
+                _hs_match_entry *entry = &helper->entries[helper->entries_count++];
+
+                entry->vid = specs[i].vid;
+                entry->pid = specs[i].pid;
+                entry->spec = i;
+            } else {
+                helper->generic[helper->generic_count++] = i;
+            }
+        }
+
+        qsort(helper->entries, helper->entries_count, sizeof(*helper->entries), compare_entries);
+    }
+
     return 0;
 }
 
 void _hs_match_helper_release(_hs_match_helper *helper)
 {
-    _HS_UNUSED(helper);
+    free(helper->generic);
+    helper->generic = NULL;
+    free(helper->entries);
+    helper->entries = NULL;
 }
 
 static bool test_spec(const hs_match_spec *spec, const hs_device *dev)
@@ -90,9 +131,42 @@ static bool test_spec(const hs_match_spec *spec, const hs_device *dev)
     return true;
 }
 
+// Returns the position of the first matching spec for this VID:PID pair, or best
+static unsigned int find_entry(const _hs_match_helper *helper, uint16_t vid, uint16_t pid,
+                               hs_device_type type, unsigned int best)
+{
+    unsigned int start = 0, end = helper->entries_count;
+
+    while (start < end) {
+        unsigned int mid = start + (end - start) / 2;
+        const _hs_match_entry *entry = &helper->entries[mid];
+
+        if (entry->vid < vid || (entry->vid == vid && entry->pid < pid)) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+
+    // Entries with the same pair are sorted by position, the first one with a valid type wins
+    for (unsigned int i = start; i < helper->entries_count; i++) {
+        const _hs_match_entry *entry = &helper->entries[i];
+        const hs_match_spec *spec = &helper->specs[entry->spec];
+
+        if (entry->vid != vid || entry->pid != pid || entry->spec >= best)
+            break;
+        if (!spec->type || (hs_device_type)spec->type == type)
+            return entry->spec;
+    }
+
+    return best;
+}
+
 bool _hs_match_helper_match(const _hs_match_helper *helper, const hs_device *dev,
                             void **rmatch_udata)
 {
+    unsigned int best = UINT_MAX;
+
     // Do the fast checks first
     if (!_hs_match_helper_has_type(helper, dev->type))
         return false;
@@ -102,15 +176,23 @@ bool _hs_match_helper_match(const _hs_match_helper *helper, const hs_device *dev
         return true;
     }
 
-    for (unsigned int i = 0; i < helper->specs_count; i++) {
-        if (test_spec(&helper->specs[i], dev)) {
-            if (rmatch_udata)
-                *rmatch_udata = helper->specs[i].udata;
-            return true;
+    if (dev->vid) {
+        best = find_entry(helper, dev->vid, dev->pid, dev->type, best);
+        if (dev->pid)
+            best = find_entry(helper, dev->vid, 0, dev->type, best);
+    }
+    for (unsigned int i = 0; i < helper->generic_count && helper->generic[i] < best; i++) {
+        if (test_spec(&helper->specs[helper->generic[i]], dev)) {
+            best = helper->generic[i];
+            break;
         }
     }
+    if (best == UINT_MAX)
+        return false;
 
-    return false;
+    if (rmatch_udata)
+        *rmatch_udata = helper->specs[best].udata;
+    return true;
 }
 
 bool _hs_match_helper_has_type(const _hs_match_helper *helper, hs_device_type type)
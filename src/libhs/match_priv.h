@@ -15,11 +15,24 @@
 #include "device.h"
 #include "match.h"
 
+typedef struct _hs_match_entry {
+    uint16_t vid;
+    uint16_t pid;
+    unsigned int spec;
+} _hs_match_entry;
+
 typedef struct _hs_match_helper {
     hs_match_spec *specs;
     unsigned int specs_count;
 
     uint32_t types;
+
+    // Specs with a VID, sorted by VID, PID and then by position
+    _hs_match_entry *entries;
+    unsigned int entries_count;
+    // Positions of the specs without a VID
+    unsigned int *generic;
+    unsigned int generic_count;
 } _hs_match_helper;
 
 int _hs_match_helper_init(_hs_match_helper *helper, const hs_match_spec *specs,
@@ -59,6 +59,9 @@ typedef int hs_enumerate_func(struct hs_device *dev, void *udata);
  *
  * If you need to support hotplugging you should probably use a monitor instead.
  *
+ * On Linux, device information is cached in `$XDG_RUNTIME_DIR/libhs-enumerate.cache` and
+ * only read again from udev and sysfs for devices whose device node has changed.
+ *
  * @param matches Array of device matches, or NULL to enumerate all supported devices.
  * @param count   Number of elements in @p matches.
  * @param f       Callback called for each enumerated device.
@@ -169,6 +172,10 @@ void hs_monitor_stop(hs_monitor *monitor);
  * Process all the pending device change events to refresh the device list and call the
  * callback for each event.
  *
+ * On Linux, pending events are processed as one batch: a device that is added and removed
+ * within the same batch is not reported at all, and a device that is removed and added back
+ * is reported once as a removal followed by an addition.
+ *
  * This function is non-blocking.
  *
  * @param monitor Device monitor.
@@ -79,7 +79,7 @@ void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func
             if (f)
                 (*f)(dev, udata);
 
-            _hs_htable_remove(&dev->hnode);
+            _hs_htable_remove(devices, &dev->hnode);
             hs_device_unref(dev);
         }
     }
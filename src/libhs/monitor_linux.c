@@ -15,18 +15,41 @@
 #include <pthread.h>
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include "array.h"
 #include "device_priv.h"
 #include "match_priv.h"
 #include "monitor_priv.h"
 #include "platform.h"
 
+enum refresh_action {
+    REFRESH_ADD,
+    REFRESH_REMOVE,
+    // Removed and added again, the device node and information may have changed
+    REFRESH_REPLACE
+};
+
+struct refresh_event {
+    struct udev_device *udev_dev;
+    enum refresh_action action;
+};
+
 struct hs_monitor {
     _hs_match_helper match_helper;
     _hs_htable devices;
 
     struct udev_monitor *udev_mon;
     int wait_fd;
+
+    _HS_ARRAY(struct refresh_event) refresh_events;
+};
+
+struct refresh_device {
+    _hs_htable_head hnode;
+    const char *key;
+    size_t last_idx;
+    bool removed;
 };
 
 struct device_subsystem {
@@ -34,6 +57,33 @@ struct device_subsystem {
     hs_device_type type;
 };
 
+/* Enumeration results are cached in the user runtime directory, so that short-lived
+   processes don't need to query udev and sysfs again for every device. Entries are
+   validated with the device node: udev recreates it (new ctime) when the device changes. */
+struct enumerate_cache_entry {
+    char *syspath;
+    char *devnode;
+    unsigned int subsystem;
+    uint64_t rdev;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+
+    // NULL for nodes that are not USB devices
+    hs_device *dev;
+};
+
+struct enumerate_cache {
+    _HS_ARRAY(struct enumerate_cache_entry) entries;
+    // Enumeration order is stable, so the next entry is usually the right one
+    size_t next_idx;
+};
+
+struct cache_reader {
+    const uint8_t *ptr;
+    const uint8_t *end;
+    bool error;
+};
+
 struct udev_aggregate {
     struct udev_device *dev;
     struct udev_device *usb;
@@ -52,6 +102,7 @@ static int common_eventfd = -1;
 
 #ifndef _GNU_SOURCE
 int dup3(int oldfd, int newfd, int flags);
+int mkostemp(char *template, int flags);
 #endif
 
 static int compute_device_location(struct udev_device *dev, char **rlocation)
@@ -392,9 +443,389 @@ cleanup:
     return r;
 }
 
+#define ENUMERATE_CACHE_MAGIC 0x4C485345u
+#define ENUMERATE_CACHE_VERSION 1
+#define ENUMERATE_CACHE_NO_STRING UINT32_MAX
+
+static char *get_enumerate_cache_filename(void)
+{
+    const char *runtime_dir;
+    char *filename;
+
+    // Only cache in the per-user runtime directory, it is private and cleared on reboot
+    runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir || runtime_dir[0] != '/')
+        return NULL;
+
+    if (_hs_asprintf(&filename, "%s/libhs-enumerate.cache", runtime_dir) < 0)
+        return NULL;
+    return filename;
+}
+
+static void release_enumerate_cache_entry(struct enumerate_cache_entry *entry)
+{
+    free(entry->syspath);
+    free(entry->devnode);
+    hs_device_unref(entry->dev);
+}
+
+static void release_enumerate_cache(struct enumerate_cache *cache)
+{
+    for (size_t i = 0; i < cache->entries.count; i++)
+        release_enumerate_cache_entry(&cache->entries.values[i]);
+    _hs_array_release(&cache->entries);
+}
+
+// Values are stored in little endian, with the given size in bytes
+static uint64_t read_cache_value(struct cache_reader *reader, unsigned int size)
+{
+    uint64_t value = 0;
+
+    if (reader->error || (size_t)(reader->end - reader->ptr) < size) {
+        reader->error = true;
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < size; i++)
+        value |= (uint64_t)reader->ptr[i] << (i * 8);
+    reader->ptr += size;
+
+    return value;
+}
+
+static char *read_cache_string(struct cache_reader *reader)
+{
+    uint32_t len;
+    char *str;
+
+    len = (uint32_t)read_cache_value(reader, 4);
+    if (reader->error || len == ENUMERATE_CACHE_NO_STRING)
+        return NULL;
+    if ((size_t)(reader->end - reader->ptr) < len) {
+        reader->error = true;
+        return NULL;
+    }
+
+    str = (char *)malloc(len + 1);
+    if (!str) {
+        reader->error = true;
+        return NULL;
+    }
+    memcpy(str, reader->ptr, len);
+    str[len] = 0;
+    reader->ptr += len;
+
+    return str;
+}
+
+static hs_device *read_cache_device(struct cache_reader *reader)
+{
+    hs_device *dev;
+
+    dev = (hs_device *)calloc(1, sizeof(*dev));
+    if (!dev) {
+        reader->error = true;
+        return NULL;
+    }
+    dev->refcount = 1;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+
+    dev->type = (hs_device_type)read_cache_value(reader, 1);
+    dev->key = read_cache_string(reader);
+    dev->location = read_cache_string(reader);
+    dev->path = read_cache_string(reader);
+    dev->vid = (uint16_t)read_cache_value(reader, 2);
+    dev->pid = (uint16_t)read_cache_value(reader, 2);
+    dev->bcd_device = (uint16_t)read_cache_value(reader, 2);
+    dev->manufacturer_string = read_cache_string(reader);
+    dev->product_string = read_cache_string(reader);
+    dev->serial_number_string = read_cache_string(reader);
+    dev->iface_number = (uint8_t)read_cache_value(reader, 1);
+    if (dev->type == HS_DEVICE_TYPE_HID) {
+        dev->u.hid.usage_page = (uint16_t)read_cache_value(reader, 2);
+        dev->u.hid.usage = (uint16_t)read_cache_value(reader, 2);
+        dev->u.hid.numbered_reports = read_cache_value(reader, 1);
+    }
+
+    if (reader->error || !dev->key || !dev->location || !dev->path ||
+            (dev->type != HS_DEVICE_TYPE_HID && dev->type != HS_DEVICE_TYPE_SERIAL)) {
+        reader->error = true;
+        hs_device_unref(dev);
+        return NULL;
+    }
+
+    return dev;
+}
+
+static void load_enumerate_cache(struct enumerate_cache *cache)
+{
+    char *filename;
+    FILE *fp = NULL;
+    _HS_ARRAY(uint8_t) buf = {0};
+    struct cache_reader reader = {0};
+    uint32_t count;
+
+    filename = get_enumerate_cache_filename();
+    if (!filename)
+        return;
+
+    fp = fopen(filename, "rbe");
+    if (!fp)
+        goto cleanup;
+    for (;;) {
+        if (_hs_array_grow(&buf, 65536) < 0)
+            goto cleanup;
+        size_t len = fread(buf.values + buf.count, 1, buf.allocated - buf.count, fp);
+        buf.count += len;
+        if (!len)
+            break;
+    }
+    if (ferror(fp))
+        goto cleanup;
+
+    reader.ptr = buf.values;
+    reader.end = buf.values + buf.count;
+
+    if (read_cache_value(&reader, 4) != ENUMERATE_CACHE_MAGIC ||
+            read_cache_value(&reader, 4) != ENUMERATE_CACHE_VERSION)
+        goto cleanup;
+    count = (uint32_t)read_cache_value(&reader, 4);
+
+    for (uint32_t i = 0; i < count && !reader.error; i++) {
+        struct enumerate_cache_entry entry = {0};
+
+        entry.syspath = read_cache_string(&reader);
+        entry.devnode = read_cache_string(&reader);
+        entry.subsystem = (unsigned int)read_cache_value(&reader, 1);
+        entry.rdev = read_cache_value(&reader, 8);
+        entry.ctime_sec = (int64_t)read_cache_value(&reader, 8);
+        entry.ctime_nsec = (int64_t)read_cache_value(&reader, 8);
+        if (read_cache_value(&reader, 1))
+            entry.dev = read_cache_device(&reader);
+
+        if (reader.error || !entry.syspath || !entry.devnode ||
+                entry.subsystem >= _HS_COUNTOF(device_subsystems) - 1 ||
+                _hs_array_push(&cache->entries, entry) < 0) {
+            release_enumerate_cache_entry(&entry);
+            reader.error = true;
+        }
+    }
+
+    // Don't trust any of it if the file is damaged
+    if (reader.error) {
+        hs_log(HS_LOG_DEBUG, "Ignoring damaged enumeration cache '%s'", filename);
+        release_enumerate_cache(cache);
+        memset(cache, 0, sizeof(*cache));
+    }
+
+cleanup:
+    if (fp)
+        fclose(fp);
+    _hs_array_release(&buf);
+    free(filename);
+}
+
+static int write_cache_value(FILE *fp, uint64_t value, unsigned int size)
+{
+    uint8_t buf[8];
+
+    for (unsigned int i = 0; i < size; i++)
+        buf[i] = (uint8_t)(value >> (i * 8));
+
+    return fwrite(buf, 1, size, fp) == size ? 0 : -1;
+}
+
+static int write_cache_string(FILE *fp, const char *str)
+{
+    if (!str)
+        return write_cache_value(fp, ENUMERATE_CACHE_NO_STRING, 4);
+
+    size_t len = strlen(str);
+    if (write_cache_value(fp, len, 4) < 0)
+        return -1;
+    return fwrite(str, 1, len, fp) == len ? 0 : -1;
+}
+
+static int write_cache_device(FILE *fp, const hs_device *dev)
+{
+    int r = 0;
+
+    r |= write_cache_value(fp, (uint64_t)dev->type, 1);
+    r |= write_cache_string(fp, dev->key);
+    r |= write_cache_string(fp, dev->location);
+    r |= write_cache_string(fp, dev->path);
+    r |= write_cache_value(fp, dev->vid, 2);
+    r |= write_cache_value(fp, dev->pid, 2);
+    r |= write_cache_value(fp, dev->bcd_device, 2);
+    r |= write_cache_string(fp, dev->manufacturer_string);
+    r |= write_cache_string(fp, dev->product_string);
+    r |= write_cache_string(fp, dev->serial_number_string);
+    r |= write_cache_value(fp, dev->iface_number, 1);
+    if (dev->type == HS_DEVICE_TYPE_HID) {
+        r |= write_cache_value(fp, dev->u.hid.usage_page, 2);
+        r |= write_cache_value(fp, dev->u.hid.usage, 2);
+        r |= write_cache_value(fp, dev->u.hid.numbered_reports, 1);
+    }
+
+    return r;
+}
+
+static void save_enumerate_cache(const struct enumerate_cache *cache)
+{
+    char *filename;
+    char *tmp_filename = NULL;
+    int fd = -1;
+    FILE *fp = NULL;
+    int r = 0;
+
+    filename = get_enumerate_cache_filename();
+    if (!filename)
+        return;
+    if (_hs_asprintf(&tmp_filename, "%s.XXXXXX", filename) < 0) {
+        tmp_filename = NULL;
+        goto cleanup;
+    }
+
+    // Write to a temporary file and rename it, concurrent readers see the old or new cache
+    fd = mkostemp(tmp_filename, O_CLOEXEC);
+    if (fd < 0)
+        goto cleanup;
+    fp = fdopen(fd, "wb");
+    if (!fp)
+        goto cleanup;
+    fd = -1;
+
+    r |= write_cache_value(fp, ENUMERATE_CACHE_MAGIC, 4);
+    r |= write_cache_value(fp, ENUMERATE_CACHE_VERSION, 4);
+    r |= write_cache_value(fp, cache->entries.count, 4);
+    for (size_t i = 0; i < cache->entries.count; i++) {
+        const struct enumerate_cache_entry *entry = &cache->entries.values[i];
+
+        r |= write_cache_string(fp, entry->syspath);
+        r |= write_cache_string(fp, entry->devnode);
+        r |= write_cache_value(fp, entry->subsystem, 1);
+        r |= write_cache_value(fp, entry->rdev, 8);
+        r |= write_cache_value(fp, (uint64_t)entry->ctime_sec, 8);
+        r |= write_cache_value(fp, (uint64_t)entry->ctime_nsec, 8);
+        r |= write_cache_value(fp, !!entry->dev, 1);
+        if (entry->dev)
+            r |= write_cache_device(fp, entry->dev);
+    }
+
+    r |= fclose(fp);
+    fp = NULL;
+    if (r || rename(tmp_filename, filename) < 0) {
+        hs_log(HS_LOG_DEBUG, "Failed to write enumeration cache '%s'", filename);
+        unlink(tmp_filename);
+    }
+
+cleanup:
+    if (fp) {
+        fclose(fp);
+        unlink(tmp_filename);
+    } else if (fd >= 0) {
+        close(fd);
+        unlink(tmp_filename);
+    }
+    free(tmp_filename);
+    free(filename);
+}
+
+static struct enumerate_cache_entry *find_enumerate_cache_entry(struct enumerate_cache *cache,
+                                                                const char *syspath)
+{
+    size_t idx = cache->next_idx;
+
+    for (size_t i = 0; i < cache->entries.count; i++, idx++) {
+        if (idx == cache->entries.count)
+            idx = 0;
+
+        struct enumerate_cache_entry *entry = &cache->entries.values[idx];
+
+        if (entry->syspath && strcmp(entry->syspath, syspath) == 0) {
+            cache->next_idx = idx + 1;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static bool stat_device_node(const char *devnode, struct enumerate_cache_entry *entry)
+{
+    struct stat sb;
+
+    if (stat(devnode, &sb) < 0)
+        return false;
+
+    entry->rdev = (uint64_t)sb.st_rdev;
+    entry->ctime_sec = (int64_t)sb.st_ctim.tv_sec;
+    entry->ctime_nsec = (int64_t)sb.st_ctim.tv_nsec;
+
+    return true;
+}
+
+static bool validate_enumerate_cache_entry(const struct enumerate_cache_entry *entry)
+{
+    struct enumerate_cache_entry current;
+
+    if (!stat_device_node(entry->devnode, &current))
+        return false;
+
+    return current.rdev == entry->rdev && current.ctime_sec == entry->ctime_sec &&
+           current.ctime_nsec == entry->ctime_nsec;
+}
+
+static unsigned int find_device_subsystem(struct udev_device *udev_dev)
+{
+    const char *subsystem = udev_device_get_subsystem(udev_dev);
+
+    unsigned int i;
+    for (i = 0; device_subsystems[i].subsystem; i++) {
+        if (subsystem && strcmp(device_subsystems[i].subsystem, subsystem) == 0)
+            break;
+    }
+
+    return i;
+}
+
+static int add_enumerate_cache_entry(struct enumerate_cache *cache, const char *syspath,
+                                     struct udev_device *udev_dev, hs_device *dev)
+{
+    struct enumerate_cache_entry entry = {0};
+    const char *devnode;
+
+    // Nodes without a device node cannot be validated later, just don't cache them
+    devnode = udev_device_get_devnode(udev_dev);
+    if (!devnode || !stat_device_node(devnode, &entry))
+        return 0;
+    entry.subsystem = find_device_subsystem(udev_dev);
+    if (!device_subsystems[entry.subsystem].subsystem)
+        return 0;
+
+    entry.syspath = strdup(syspath);
+    entry.devnode = strdup(devnode);
+    if (!entry.syspath || !entry.devnode)
+        goto error;
+    entry.dev = dev ? hs_device_ref(dev) : NULL;
+
+    if (_hs_array_push(&cache->entries, entry) < 0)
+        goto error;
+
+    return 0;
+
+error:
+    release_enumerate_cache_entry(&entry);
+    return hs_error(HS_ERROR_MEMORY, NULL);
+}
+
 static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void *udata)
 {
     struct udev_enumerate *enumerate;
+    struct enumerate_cache old_cache = {0};
+    struct enumerate_cache new_cache = {0};
+    bool scanned_subsystems[_HS_COUNTOF(device_subsystems)] = {0};
+    bool cache_changed = false;
     int r;
 
     enumerate = udev_enumerate_new(udev);
@@ -411,6 +842,7 @@ static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void
                 r = hs_error(HS_ERROR_MEMORY, NULL);
                 goto cleanup;
             }
+            scanned_subsystems[i] = true;
         }
     }
 
@@ -421,26 +853,51 @@ static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void
         goto cleanup;
     }
 
+    load_enumerate_cache(&old_cache);
+
     struct udev_list_entry *cur;
     udev_list_entry_foreach(cur, udev_enumerate_get_list_entry(enumerate)) {
-        struct udev_device *udev_dev;
-        hs_device *dev;
+        const char *syspath = udev_list_entry_get_name(cur);
+        struct enumerate_cache_entry *entry;
+        hs_device *dev = NULL;
+
+        entry = find_enumerate_cache_entry(&old_cache, syspath);
+        if (entry && validate_enumerate_cache_entry(entry)) {
+            // Move it to the new cache, the NULL syspath marks it as used
+            r = _hs_array_push(&new_cache.entries, *entry);
+            if (r < 0)
+                goto cleanup;
+            memset(entry, 0, sizeof(*entry));
 
-        udev_dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(cur));
-        if (!udev_dev) {
-            if (errno == ENOMEM) {
-                r = hs_error(HS_ERROR_MEMORY, NULL);
+            entry = &new_cache.entries.values[new_cache.entries.count - 1];
+            if (!entry->dev)
+                continue;
+            dev = hs_device_ref(entry->dev);
+        } else {
+            struct udev_device *udev_dev;
+
+            udev_dev = udev_device_new_from_syspath(udev, syspath);
+            if (!udev_dev) {
+                if (errno == ENOMEM) {
+                    r = hs_error(HS_ERROR_MEMORY, NULL);
+                    goto cleanup;
+                }
+                continue;
+            }
+
+            r = read_device_information(udev_dev, &dev);
+            if (r >= 0)
+                r = add_enumerate_cache_entry(&new_cache, syspath, udev_dev, r ? dev : NULL);
+            udev_device_unref(udev_dev);
+            if (r < 0) {
+                hs_device_unref(dev);
                 goto cleanup;
             }
-            continue;
-        }
+            cache_changed = true;
 
-        r = read_device_information(udev_dev, &dev);
-        udev_device_unref(udev_dev);
-        if (r < 0)
-            goto cleanup;
-        if (!r)
-            continue;
+            if (!dev)
+                continue;
+        }
 
         if (_hs_match_helper_match(match_helper, dev, &dev->match_udata)) {
             r = (*f)(dev, udata);
@@ -452,8 +909,30 @@ static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void
         }
     }
 
+    /* Keep entries from the subsystems we did not look at, the others correspond to
+       devices that have disappeared. */
+    for (size_t i = 0; i < old_cache.entries.count; i++) {
+        struct enumerate_cache_entry *entry = &old_cache.entries.values[i];
+
+        if (!entry->syspath)
+            continue;
+        if (scanned_subsystems[entry->subsystem]) {
+            cache_changed = true;
+            continue;
+        }
+
+        r = _hs_array_push(&new_cache.entries, *entry);
+        if (r < 0)
+            goto cleanup;
+        memset(entry, 0, sizeof(*entry));
+    }
+    if (cache_changed)
+        save_enumerate_cache(&new_cache);
+
     r = 0;
 cleanup:
+    release_enumerate_cache(&new_cache);
+    release_enumerate_cache(&old_cache);
     udev_enumerate_unref(enumerate);
     return r;
 }
@@ -537,12 +1016,20 @@ error:
     return r;
 }
 
+static void clear_refresh_events(hs_monitor *monitor)
+{
+    for (size_t i = 0; i < monitor->refresh_events.count; i++)
+        udev_device_unref(monitor->refresh_events.values[i].udev_dev);
+    _hs_array_release(&monitor->refresh_events);
+}
+
 void hs_monitor_free(hs_monitor *monitor)
 {
     if (monitor) {
         close(monitor->wait_fd);
         udev_monitor_unref(monitor->udev_mon);
 
+        clear_refresh_events(monitor);
         _hs_monitor_clear_devices(&monitor->devices);
         _hs_htable_release(&monitor->devices);
         _hs_match_helper_release(&monitor->match_helper);
@@ -611,6 +1098,7 @@ void hs_monitor_stop(hs_monitor *monitor)
         return;
 
     _hs_monitor_clear_devices(&monitor->devices);
+    clear_refresh_events(monitor);
 
     dup3(common_eventfd, monitor->wait_fd, O_CLOEXEC);
     udev_monitor_unref(monitor->udev_mon);
@@ -623,38 +1111,41 @@ hs_handle hs_monitor_get_poll_handle(const hs_monitor *monitor)
     return monitor->wait_fd;
 }
 
-int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+static bool has_device_key(_hs_htable *devices, const char *key)
 {
-    assert(monitor);
+    _hs_htable_foreach_hash(cur, devices, _hs_htable_hash_str(key)) {
+        hs_device *dev = _HS_CONTAINER_OF(cur, hs_device, hnode);
 
-    struct udev_device *udev_dev;
-    int r;
+        if (strcmp(dev->key, key) == 0)
+            return true;
+    }
 
-    if (!monitor->udev_mon)
-        return 0;
+    return false;
+}
+
+static int receive_refresh_events(hs_monitor *monitor)
+{
+    struct udev_device *udev_dev;
 
     errno = 0;
     while ((udev_dev = udev_monitor_receive_device(monitor->udev_mon))) {
         const char *action = udev_device_get_action(udev_dev);
+        struct refresh_event event = {udev_dev};
 
-        r = 0;
         if (strcmp(action, "add") == 0) {
-            hs_device *dev = NULL;
-
-            r = read_device_information(udev_dev, &dev);
-            if (r > 0) {
-                r = _hs_match_helper_match(&monitor->match_helper, dev, &dev->match_udata);
-                if (r)
-                    r = _hs_monitor_add(&monitor->devices, dev, f, udata);
-            }
-
-            hs_device_unref(dev);
+            event.action = REFRESH_ADD;
         } else if (strcmp(action, "remove") == 0) {
-            _hs_monitor_remove(&monitor->devices, udev_device_get_devpath(udev_dev), f, udata);
+            event.action = REFRESH_REMOVE;
+        } else {
+            udev_device_unref(udev_dev);
+            errno = 0;
+            continue;
+        }
+
+        if (_hs_array_push(&monitor->refresh_events, event) < 0) {
+            udev_device_unref(udev_dev);
+            return HS_ERROR_MEMORY;
         }
-        udev_device_unref(udev_dev);
-        if (r)
-            return r;
 
         errno = 0;
     }
@@ -664,6 +1155,154 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
     return 0;
 }
 
+/* Reduce the pending events to one per device: devices that appear and disappear within
+   the same batch (bootloader and run-mode flapping during resets) are skipped entirely,
+   and devices that disappear and come back are replaced once. */
+static int coalesce_refresh_events(hs_monitor *monitor)
+{
+    size_t count = monitor->refresh_events.count;
+    struct refresh_device *devices = NULL;
+    struct refresh_device **owners = NULL;
+    _hs_htable keys = {0};
+    size_t devices_count = 0;
+    size_t kept = 0;
+    int r;
+
+    if (!count)
+        return 0;
+
+    devices = (struct refresh_device *)calloc(count, sizeof(*devices));
+    owners = (struct refresh_device **)calloc(count, sizeof(*owners));
+    if (!devices || !owners) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    r = _hs_htable_init(&keys, (unsigned int)count);
+    if (r < 0)
+        goto cleanup;
+
+    for (size_t i = 0; i < count; i++) {
+        struct refresh_event *event = &monitor->refresh_events.values[i];
+        const char *key = udev_device_get_devpath(event->udev_dev);
+        uint32_t hash = _hs_htable_hash_str(key);
+        struct refresh_device *dev = NULL;
+
+        _hs_htable_foreach_hash(cur, &keys, hash) {
+            struct refresh_device *dev_it = _HS_CONTAINER_OF(cur, struct refresh_device, hnode);
+
+            if (strcmp(dev_it->key, key) == 0) {
+                dev = dev_it;
+                break;
+            }
+        }
+        if (!dev) {
+            dev = &devices[devices_count++];
+            _hs_htable_add(&keys, hash, &dev->hnode);
+        }
+
+        // Point to the last event, the earlier ones are released below
+        dev->key = key;
+        dev->last_idx = i;
+        if (event->action != REFRESH_ADD)
+            dev->removed = true;
+        owners[i] = dev;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct refresh_event *event = &monitor->refresh_events.values[i];
+        struct refresh_device *dev = owners[i];
+        bool known;
+
+        if (dev->last_idx != i) {
+            udev_device_unref(event->udev_dev);
+            continue;
+        }
+
+        known = has_device_key(&monitor->devices, dev->key);
+        if (event->action == REFRESH_REMOVE) {
+            if (!known) {
+                udev_device_unref(event->udev_dev);
+                continue;
+            }
+        } else if (known) {
+            if (!dev->removed) {
+                udev_device_unref(event->udev_dev);
+                continue;
+            }
+            event->action = REFRESH_REPLACE;
+        } else {
+            event->action = REFRESH_ADD;
+        }
+
+        monitor->refresh_events.values[kept++] = *event;
+    }
+    monitor->refresh_events.count = kept;
+
+    r = 0;
+cleanup:
+    _hs_htable_release(&keys);
+    free(owners);
+    free(devices);
+    return r;
+}
+
+int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+{
+    assert(monitor);
+
+    size_t event_idx = 0;
+    int r;
+
+    if (!monitor->udev_mon)
+        return 0;
+
+    // Drain everything first, so that bursts of events are delivered as one change set
+    r = receive_refresh_events(monitor);
+    if (r < 0)
+        return r;
+    r = coalesce_refresh_events(monitor);
+    if (r < 0)
+        return r;
+
+    for (; event_idx < monitor->refresh_events.count; event_idx++) {
+        struct refresh_event *event = &monitor->refresh_events.values[event_idx];
+
+        if (event->action != REFRESH_ADD) {
+            _hs_monitor_remove(&monitor->devices, udev_device_get_devpath(event->udev_dev),
+                               f, udata);
+            if (event->action == REFRESH_REMOVE)
+                continue;
+
+            // Don't remove it again if the callback fails below
+            event->action = REFRESH_ADD;
+        }
+
+        hs_device *dev = NULL;
+
+        r = read_device_information(event->udev_dev, &dev);
+        if (r > 0) {
+            r = _hs_match_helper_match(&monitor->match_helper, dev, &dev->match_udata);
+            if (r)
+                r = _hs_monitor_add(&monitor->devices, dev, f, udata);
+        }
+        hs_device_unref(dev);
+
+        if (r)
+            goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    /* If an error occurs, keep the unprocessed events in monitor->refresh_events
+       for the next time this function is called. */
+    if (event_idx) {
+        for (size_t i = 0; i < event_idx; i++)
+            udev_device_unref(monitor->refresh_events.values[i].udev_dev);
+        _hs_array_remove(&monitor->refresh_events, 0, event_idx);
+    }
+    return r;
+}
+
 int hs_monitor_list(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
 {
     return _hs_monitor_list(&monitor->devices, f, udata);
@@ -68,6 +68,9 @@ void ty_board_unref(ty_board *board)
 
         ty_mutex_release(&board->ifaces_lock);
 
+        _hs_array_release(&board->callbacks);
+        _hs_array_release(&board->waiters);
+
         for (size_t i = 0; i < board->ifaces.count; i++) {
             ty_board_interface *iface = board->ifaces.values[i];
             ty_board_interface_unref(iface);
@@ -78,12 +81,8 @@ void ty_board_unref(ty_board *board)
     free(board);
 }
 
-struct board_id_part {
-    const char *ptr;
-    size_t len;
-};
-
-static void parse_board_id(const char *id, const char *delimiters, struct board_id_part parts[])
+static void parse_board_id(const char *id, const char *delimiters,
+                           struct _ty_board_id_part parts[])
 {
     size_t part_offset = 0;
     size_t delim_offset = 0;
@@ -101,8 +100,8 @@ static void parse_board_id(const char *id, const char *delimiters, struct board_
     } while (id[i++]);
 }
 
-static bool compare_board_id_parts(const struct board_id_part *part1,
-                                   const struct board_id_part *part2)
+static bool compare_board_id_parts(const struct _ty_board_id_part *part1,
+                                   const struct _ty_board_id_part *part2)
 {
     if (!part1->ptr || !part2->ptr)
         return true;
@@ -114,34 +113,61 @@ static int match_board_interface(ty_board_interface *iface, void *udata)
     return ty_compare_paths(ty_board_interface_get_path(iface), udata);
 }
 
-bool ty_board_matches_tag(ty_board *board, const char *id)
+void _ty_board_parse_query(const char *id, struct _ty_board_query *rquery)
 {
-    assert(board);
+    struct _ty_board_id_part parts[3] = {{0}};
 
-    if (!id)
-        return true;
-    if (board->tag != board->id && strcmp(id, board->tag) == 0)
+    parse_board_id(id, "-@", parts);
+
+    rquery->id = id;
+    rquery->serial = parts[0];
+    rquery->model = parts[1];
+    /* The last part is necessarily NUL-terminated so we can just use regular
+       C string functions. */
+    rquery->location = parts[2].ptr;
+}
+
+struct _ty_board_id_part _ty_board_get_id_serial(const ty_board *board)
+{
+    struct _ty_board_id_part parts[2] = {{0}};
+
+    parse_board_id(board->id, "-", parts);
+    return parts[0];
+}
+
+bool _ty_board_matches_query(ty_board *board, const struct _ty_board_query *query)
+{
+    if (board->tag != board->id && strcmp(query->id, board->tag) == 0)
         return true;
 
-    struct board_id_part parts1[3] = {0};
-    struct board_id_part parts2[2] = {0};
+    struct _ty_board_id_part parts[2] = {{0}};
 
-    parse_board_id(id, "-@", parts1);
-    parse_board_id(board->id, "-", parts2);
+    parse_board_id(board->id, "-", parts);
 
-    if (!compare_board_id_parts(&parts1[0], &parts2[0]))
+    if (!compare_board_id_parts(&query->serial, &parts[0]))
         return false;
-    if (!compare_board_id_parts(&parts1[1], &parts2[1]))
+    if (!compare_board_id_parts(&query->model, &parts[1]))
         return false;
-    /* The last part is necessarily NUL-terminated so we can just use regular
-       C string functions. */
-    if (parts1[2].ptr && strcmp(parts1[2].ptr, board->location) != 0 &&
-            !ty_board_list_interfaces(board, match_board_interface, (void *)parts1[2].ptr))
+    if (query->location && strcmp(query->location, board->location) != 0 &&
+            !ty_board_list_interfaces(board, match_board_interface, (void *)query->location))
         return false;
 
     return true;
 }
 
+bool ty_board_matches_tag(ty_board *board, const char *id)
+{
+    assert(board);
+
+    struct _ty_board_query query;
+
+    if (!id)
+        return true;
+
+    _ty_board_parse_query(id, &query);
+    return _ty_board_matches_query(board, &query);
+}
+
 ty_monitor *ty_board_get_monitor(const ty_board *board)
 {
     assert(board);
@@ -178,6 +204,9 @@ int ty_board_set_tag(ty_board *board, const char *tag)
         free(board->tag);
     board->tag = new_tag;
 
+    if (board->monitor)
+        _ty_monitor_reindex_board(board);
+
     return 0;
 }
 
@@ -315,7 +344,8 @@ int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeo
     ctx.board = board;
     ctx.capability = capability;
 
-    return ty_monitor_wait(monitor, wait_for_callback, &ctx, timeout);
+    return _ty_monitor_wait_board(monitor, board, 1 << capability, wait_for_callback, &ctx,
+                                  timeout);
 }
 
 ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeout)
@@ -359,7 +389,8 @@ ssize_t ty_board_serial_write(ty_board *board, const char *buf, size_t size)
     return r;
 }
 
-int ty_board_upload(ty_board *board, ty_firmware *fw, ty_board_upload_progress_func *pf, void *udata)
+int ty_board_upload(ty_board *board, ty_firmware *fw, int flags,
+                    ty_board_upload_progress_func *pf, void *udata)
 {
     assert(board);
     assert(fw);
@@ -376,7 +407,7 @@ int ty_board_upload(ty_board *board, ty_firmware *fw, ty_board_upload_progress_f
     }
     assert(board->model);
 
-    r = (*iface->class_vtable->upload)(iface, fw, pf, udata);
+    r = (*iface->class_vtable->upload)(iface, fw, flags, pf, udata);
 
 cleanup:
     ty_board_interface_close(iface);
@@ -697,7 +728,7 @@ wait:
     }
 
     if (!(flags & TY_UPLOAD_DELEGATE)) {
-        r = ty_board_upload(board, fw, upload_progress_callback, NULL);
+        r = ty_board_upload(board, fw, flags, upload_progress_callback, NULL);
         if (r < 0)
             return r;
     }
@@ -769,6 +800,16 @@ int ty_upload(ty_board *board, ty_firmware **fws, unsigned int fws_count, int fl
     if (flags & TY_UPLOAD_NOCHECK)
         fws_count = 1;
 
+    /* Build tools may truncate or rewrite the firmware file while we upload it, which would
+       crash us (SIGBUS) or change bytes under our feet if segments still pointed into the
+       file mapping. This runs before any task gets the firmware, so nobody else can be
+       reading the segments while they move. */
+    for (unsigned int i = 0; i < fws_count; i++) {
+        r = _ty_firmware_detach_mapping(fws[i]);
+        if (r < 0)
+            goto error;
+    }
+
     task->u.upload.fws = malloc(fws_count * sizeof(ty_firmware *));
     if (!task->u.upload.fws) {
         r = ty_error(TY_ERROR_MEMORY, NULL);
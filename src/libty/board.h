@@ -51,7 +51,11 @@ enum {
     TY_UPLOAD_NOCHECK = 4,
     TY_UPLOAD_NORTC = 8,
     TY_UPLOAD_RTC_UTC = 16,
-    TY_UPLOAD_DELEGATE = 32
+    TY_UPLOAD_DELEGATE = 32,
+    // Learn HalfKay timings for each model instead of using fixed conservative delays
+    TY_UPLOAD_ADAPTIVE = 64,
+    // Skip the upload if the board already runs this firmware (according to the local cache)
+    TY_UPLOAD_DIFFERENTIAL = 128
 };
 
 #define TY_UPLOAD_MAX_FIRMWARES 256
@@ -97,7 +101,8 @@ int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeo
 ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeout);
 ssize_t ty_board_serial_write(ty_board *board, const char *buf, size_t size);
 
-int ty_board_upload(ty_board *board, struct ty_firmware *fw, ty_board_upload_progress_func *pf, void *udata);
+int ty_board_upload(ty_board *board, struct ty_firmware *fw, int flags,
+                    ty_board_upload_progress_func *pf, void *udata);
 int ty_board_reset(ty_board *board, int64_t rtc);
 int ty_board_reboot(ty_board *board);
 
@@ -14,6 +14,7 @@
 #include "common.h"
 #include "board.h"
 #include "class_priv.h"
+#include "monitor.h"
 #include "../libhs/array.h"
 #include "../libhs/device.h"
 #include "../libhs/htable.h"
@@ -39,14 +40,41 @@ struct ty_board_interface {
     hs_port *port;
 };
 
+struct _ty_monitor_callback {
+    int id;
+    ty_monitor_callback_func *f;
+    void *udata;
+
+    int events;
+    int capabilities;
+};
+
+typedef _HS_ARRAY(struct _ty_monitor_callback) _ty_monitor_callback_array;
+
+// Worker thread waiting for a board change, see _ty_monitor_wait_board()
+struct _ty_board_waiter {
+    ty_cond cond;
+    int capabilities;
+};
+
 struct ty_board {
     unsigned int refcount;
 
     struct ty_monitor *monitor;
+    // Monitor indexes, see ty_monitor_find_board()
+    _hs_htable_head location_hnode;
+    _hs_htable_head serial_hnode;
+    _hs_htable_head tag_hnode;
 
     ty_board_status status;
     uint64_t missing_since;
 
+    // Callbacks registered for this board only, and waiters (protected by the refresh mutex)
+    _ty_monitor_callback_array callbacks;
+    _HS_ARRAY(struct _ty_board_waiter *) waiters;
+    // Capabilities when callbacks were last notified, to filter on capability changes
+    int notified_capabilities;
+
     ty_model model;
     char *id;
     char *tag;
@@ -67,6 +95,31 @@ struct ty_board {
     ty_task *current_task;
 };
 
+struct _ty_board_id_part {
+    const char *ptr;
+    size_t len;
+};
+
+// Parsed form of a board identifier, "[serial][-model][@location]" or a custom tag
+struct _ty_board_query {
+    const char *id;
+    struct _ty_board_id_part serial;
+    struct _ty_board_id_part model;
+    // NUL-terminated, this can be a USB location or an interface path
+    const char *location;
+};
+
+void _ty_board_parse_query(const char *id, struct _ty_board_query *rquery);
+bool _ty_board_matches_query(ty_board *board, const struct _ty_board_query *query);
+// Serial number part of the board id, which is what queries compare
+struct _ty_board_id_part _ty_board_get_id_serial(const ty_board *board);
+
+void _ty_monitor_reindex_board(ty_board *board);
+/* Wait until f returns non-zero. Outside of the main thread, only changes of this board
+   that affect the given capabilities (or drop it) wake up the caller. */
+int _ty_monitor_wait_board(ty_monitor *monitor, ty_board *board, int capabilities,
+                           ty_monitor_wait_func *f, void *udata, int timeout);
+
 _HS_END_C
 
 #endif
@@ -9,6 +9,12 @@
    See the LICENSE file for more details. */
 
 #include "common.h"
+#ifdef _WIN32
+    #include <process.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 #include "../libhs/device.h"
 #include "../libhs/hid.h"
 #include "../libhs/serial.h"
@@ -16,11 +22,18 @@
 #include "board_priv.h"
 #include "class_priv.h"
 #include "firmware.h"
+#include "ini.h"
 #include "system.h"
+#include "thread.h"
 
 #define SEREMU_TX_SIZE 32
 #define SEREMU_RX_SIZE 64
 
+#define HALFKAY_RETRY_DELAY 20
+#define HALFKAY_ERASE_DELAY 200
+#define HALFKAY_MAX_ERASE_DELAY 2000
+#define HALFKAY_PROFILE_FILENAME "halfkay.ini"
+
 enum {
     TEENSY_USAGE_PAGE_BOOTLOADER = 0xFF9C,
     TEENSY_USAGE_PAGE_RAWHID = 0xFFAB,
@@ -112,6 +125,29 @@ static uint64_t parse_bootloader_serial_number(const char *s)
     return serial;
 }
 
+/* Parallel uploads share the HalfKay profile file, each load/learn/save sequence must run
+   alone or concurrent uploads would lose each other's updates. */
+static ty_mutex profiles_lock;
+
+static void release_profiles_lock(void)
+{
+    ty_mutex_release(&profiles_lock);
+}
+
+// Upload tasks run in parallel, so this happens on the main thread when a bootloader shows up
+static int init_profiles_lock(void)
+{
+    if (!profiles_lock.init) {
+        int r = ty_mutex_init(&profiles_lock);
+        if (r < 0)
+            return r;
+
+        atexit(release_profiles_lock);
+    }
+
+    return 0;
+}
+
 static int teensy_load_interface(ty_board_interface *iface)
 {
     hs_device *dev = iface->dev;
@@ -130,6 +166,10 @@ static int teensy_load_interface(ty_board_interface *iface)
                     iface->name = "HalfKay";
                     iface->model = identify_model_halfkay(dev->u.hid.usage);
                     if (iface->model) {
+                        int r = init_profiles_lock();
+                        if (r < 0)
+                            return r;
+
                         iface->capabilities |= 1 << TY_BOARD_CAPABILITY_UPLOAD;
                         iface->capabilities |= 1 << TY_BOARD_CAPABILITY_RESET;
                     }
@@ -356,6 +396,27 @@ static uint64_t read_uint64_le(const uint8_t *ptr)
            ((uint64_t)ptr[7] << 56);
 }
 
+static ty_model identify_model_avr(const uint8_t *data, size_t size)
+{
+    const uint8_t *end = data + size;
+
+    if (size < sizeof(uint64_t))
+        return 0;
+
+    /* All the magic values start with the same byte (the low byte of the jmp opcode), so
+       memchr() can skip over everything else much faster than we would. */
+    for (const uint8_t *ptr = data;
+            (ptr = memchr(ptr, 0x0C, (size_t)(end - ptr) + 1 - sizeof(uint64_t))); ptr++) {
+        switch (read_uint64_le(ptr)) {
+            case 0x94F8CFFF7E00940C: { return TY_MODEL_TEENSY_PP_10; } break;
+            case 0x94F8CFFF3F00940C: { return TY_MODEL_TEENSY_20; } break;
+            case 0x94F8CFFFFE00940C: { return TY_MODEL_TEENSY_PP_20; } break;
+        }
+    }
+
+    return 0;
+}
+
 static unsigned int teensy_identify_models(const ty_firmware *fw, ty_model *rmodels,
                                            unsigned int max_models)
 {
@@ -451,25 +512,11 @@ static unsigned int teensy_identify_models(const ty_firmware *fw, ty_model *rmod
     if (fw->max_address <= 130048) {
         for (unsigned int i = 0; i < fw->segments_count; i++) {
             const ty_firmware_segment *segment = &fw->segments[i];
-            if (segment->size < sizeof(uint64_t))
-                continue;
-
-            for (size_t j = 0; j < segment->size - sizeof(uint64_t); j++) {
-                uint64_t magic_value = read_uint64_le(segment->data + j);
-                switch (magic_value) {
-                    case 0x94F8CFFF7E00940C: {
-                        rmodels[0] = TY_MODEL_TEENSY_PP_10;
-                        return 1;
-                    } break;
-                    case 0x94F8CFFF3F00940C: {
-                        rmodels[0] = TY_MODEL_TEENSY_20;
-                        return 1;
-                    } break;
-                    case 0x94F8CFFFFE00940C: {
-                        rmodels[0] = TY_MODEL_TEENSY_PP_20;
-                        return 1;
-                    } break;
-                }
+            ty_model model = identify_model_avr(segment->data, segment->size);
+
+            if (model) {
+                rmodels[0] = model;
+                return 1;
             }
         }
     }
@@ -550,58 +597,75 @@ static ssize_t teensy_serial_write(ty_board_interface *iface, const char *buf, s
     return 0;
 }
 
-static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t block_size,
-                        size_t addr, const void *data, size_t size, unsigned int tries)
+static size_t get_halfkay_header_size(unsigned int halfkay_version)
 {
-    uint8_t buf[2048] = {0};
-
-    ssize_t r;
-
-    // Update if header gets bigger than 64 bytes
-    assert(size < sizeof(buf) - 65);
+    return halfkay_version == 3 ? 65 : 3;
+}
 
+static void write_halfkay_header(uint8_t *report, unsigned int halfkay_version, size_t addr)
+{
     switch (halfkay_version) {
         case 1: {
-            buf[1] = addr & 255;
-            buf[2] = (addr >> 8) & 255;
-
-            if (size)
-                memcpy(buf + 3, data, size);
-            size = block_size + 3;
+            report[1] = addr & 255;
+            report[2] = (addr >> 8) & 255;
         } break;
 
         case 2: {
-            buf[1] = (addr >> 8) & 255;
-            buf[2] = (addr >> 16) & 255;
-
-            if (size)
-                memcpy(buf + 3, data, size);
-            size = block_size + 3;
+            report[1] = (addr >> 8) & 255;
+            report[2] = (addr >> 16) & 255;
         } break;
 
         case 3: {
-            buf[1] = addr & 255;
-            buf[2] = (addr >> 8) & 255;
-            buf[3] = (addr >> 16) & 255;
-
-            if (size)
-                memcpy(buf + 65, data, size);
-            size = block_size + 65;
+            report[1] = addr & 255;
+            report[2] = (addr >> 8) & 255;
+            report[3] = (addr >> 16) & 255;
         } break;
 
         default: {
             assert(false);
         } break;
     }
+}
+
+struct halfkay_profile {
+    // Time given to the bootloader to erase the flash after the first block (ms)
+    unsigned int erase_delay;
+    // First wait after a stalled write, doubled until HALFKAY_RETRY_DELAY is reached (ms)
+    unsigned int retry_delay;
+};
+
+struct halfkay_pacing {
+    struct halfkay_profile profile;
+
+    unsigned int stalled_writes;
+    uint64_t stall_time;
+};
+
+/* Without pacing information, fixed delays are used. Otherwise, the wait between retries
+   starts short and grows exponentially, and the erase delay is left to the caller. */
+static int halfkay_write(hs_port *port, const uint8_t *report, size_t size, size_t addr,
+                         unsigned int tries, struct halfkay_pacing *pacing)
+{
+    unsigned int delay = pacing ? pacing->profile.retry_delay : HALFKAY_RETRY_DELAY;
+    int timeout = (int)(tries * HALFKAY_RETRY_DELAY);
+    uint64_t start = hs_millis();
+    bool stalled = false;
+    ssize_t r;
 
     /* We may get errors along the way (while the bootloader works) so try again
        until timeout expires. */
     hs_error_mask(HS_ERROR_IO);
 restart:
-    r = hs_hid_write(port, buf, size);
-    if (r == HS_ERROR_IO && --tries) {
-        hs_delay(20);
-        goto restart;
+    r = hs_hid_write(port, report, size);
+    if (r == HS_ERROR_IO) {
+        if (pacing ? hs_adjust_timeout(timeout, start) > 0 : --tries > 0) {
+            hs_delay(delay);
+            if (pacing)
+                delay = _HS_MIN(delay * 2, HALFKAY_RETRY_DELAY);
+            stalled = true;
+
+            goto restart;
+        }
     }
     hs_error_unmask();
     if (r < 0) {
@@ -610,14 +674,36 @@ restart:
         return ty_libhs_translate_error((int)r);
     }
 
-    /* HalfKay generates STALL if you go too fast (translates to EPIPE on Linux), and the
-       first write takes longer because it triggers a complete erase of all blocks. */
-    if (!addr)
-        hs_delay(200);
+    if (pacing) {
+        if (stalled) {
+            pacing->stalled_writes++;
+            pacing->stall_time += hs_millis() - start;
+        }
+    } else if (!addr) {
+        /* HalfKay generates STALL if you go too fast (translates to EPIPE on Linux), and the
+           first write takes longer because it triggers a complete erase of all blocks. */
+        hs_delay(HALFKAY_ERASE_DELAY);
+    }
 
     return 0;
 }
 
+static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t block_size,
+                        size_t addr, const void *data, size_t size, unsigned int tries)
+{
+    uint8_t buf[2048] = {0};
+    size_t header_size = get_halfkay_header_size(halfkay_version);
+
+    // Update if header gets bigger than 64 bytes
+    assert(size < sizeof(buf) - 65);
+
+    write_halfkay_header(buf, halfkay_version, addr);
+    if (size)
+        memcpy(buf + header_size, data, size);
+
+    return halfkay_write(port, buf, header_size + block_size, addr, tries, NULL);
+}
+
 static int get_halfkay_settings(ty_model model, unsigned int *rhalfkay_version,
                                 size_t *rmin_address, size_t *rmax_address, size_t *rblock_size)
 {
@@ -709,11 +795,384 @@ static int get_halfkay_settings(ty_model model, unsigned int *rhalfkay_version,
     return 0;
 }
 
-static int teensy_upload(ty_board_interface *iface, ty_firmware *fw,
+static unsigned int get_profile_filename(char (*rfilename)[TY_PATH_MAX_SIZE])
+{
+    // Lives next to the user tytools.ini file (see ty_models_load_patch)
+    if (!ty_standard_get_paths(TY_PATH_CONFIG_DIRECTORY, "TyTools", rfilename, 1))
+        return 0;
+
+    size_t len = strlen(*rfilename);
+    if (snprintf(*rfilename + len, sizeof(*rfilename) - len, "/%s",
+                 HALFKAY_PROFILE_FILENAME) >= (int)(sizeof(*rfilename) - len))
+        return 0;
+
+    return 1;
+}
+
+struct profile_ini_context {
+    struct halfkay_profile *profiles;
+    bool *known;
+};
+
+static int profile_ini_callback(const char *section, char *key, char *value, void *udata)
+{
+    struct profile_ini_context *ctx = udata;
+    ty_model model;
+    unsigned long delay;
+    char *end;
+
+    model = section ? ty_models_find(section) : 0;
+    if (!model)
+        return 0;
+
+    delay = strtoul(value, &end, 10);
+    if (end == value || *end || delay > HALFKAY_MAX_ERASE_DELAY)
+        return 0;
+
+    if (!strcmp(key, "EraseDelay")) {
+        ctx->profiles[model].erase_delay = (unsigned int)delay;
+    } else if (!strcmp(key, "RetryDelay")) {
+        ctx->profiles[model].retry_delay = _HS_MIN(_HS_MAX((unsigned int)delay, 1),
+                                                   HALFKAY_RETRY_DELAY);
+    } else {
+        return 0;
+    }
+    ctx->known[model] = true;
+
+    return 0;
+}
+
+// Profiles stay at their default values (same as the fixed timings) for unknown models
+static void load_halfkay_profiles(const char *filename, struct halfkay_profile *profiles,
+                                  bool *known)
+{
+    struct profile_ini_context ctx;
+    int r;
+
+    for (unsigned int i = 0; i < ty_models_count; i++) {
+        profiles[i].erase_delay = HALFKAY_ERASE_DELAY;
+        profiles[i].retry_delay = HALFKAY_RETRY_DELAY;
+        known[i] = false;
+    }
+
+    ctx.profiles = profiles;
+    ctx.known = known;
+
+    ty_error_mask(TY_ERROR_NOT_FOUND);
+    r = ty_ini_walk(filename, profile_ini_callback, &ctx);
+    ty_error_unmask();
+    if (r < 0 && r != TY_ERROR_NOT_FOUND)
+        ty_log(TY_LOG_WARNING, "Ignoring HalfKay timing profile '%s'", filename);
+}
+
+static int save_halfkay_profiles(const char *filename, const struct halfkay_profile *profiles,
+                                 const bool *known)
+{
+    char tmp_filename[TY_PATH_MAX_SIZE + 16];
+    char *dir_end;
+    FILE *fp;
+    int r;
+
+    // Make sure the TyTools configuration directory exists
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s", filename);
+    dir_end = strrchr(tmp_filename, '/');
+    if (dir_end) {
+        *dir_end = 0;
+        r = ty_create_directory(tmp_filename);
+        if (r < 0)
+            return r;
+    }
+
+    /* Write a temporary file and rename it, other processes may load or save the profile
+       at the same time so each writer needs its own temporary file. */
+#ifdef _WIN32
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.%d.tmp", filename, _getpid());
+    fp = fopen(tmp_filename, "wb");
+    if (!fp)
+        return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", tmp_filename, strerror(errno));
+#else
+    {
+        int fd;
+
+        snprintf(tmp_filename, sizeof(tmp_filename), "%s.XXXXXX", filename);
+        fd = mkstemp(tmp_filename);
+        if (fd < 0)
+            return ty_error(TY_ERROR_SYSTEM, "mkstemp('%s') failed: %s", tmp_filename,
+                            strerror(errno));
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        fp = fdopen(fd, "wb");
+        if (!fp) {
+            r = ty_error(TY_ERROR_SYSTEM, "fdopen('%s') failed: %s", tmp_filename,
+                         strerror(errno));
+            close(fd);
+            remove(tmp_filename);
+            return r;
+        }
+    }
+#endif
+
+    fprintf(fp, "# HalfKay timings learned by adaptive uploads, delete this file to reset them\n");
+    for (unsigned int i = 0; i < ty_models_count; i++) {
+        if (!known[i])
+            continue;
+
+        fprintf(fp, "\n[%s]\nEraseDelay = %u\nRetryDelay = %u\n", ty_models[i].name,
+                profiles[i].erase_delay, profiles[i].retry_delay);
+    }
+
+    if (fflush(fp) || ferror(fp)) {
+        r = ty_error(TY_ERROR_IO, "I/O error while writing to '%s'", tmp_filename);
+        fclose(fp);
+        remove(tmp_filename);
+        return r;
+    }
+    fclose(fp);
+
+#ifdef _WIN32
+    remove(filename);
+#endif
+    if (rename(tmp_filename, filename) < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "rename('%s') failed: %s", tmp_filename, strerror(errno));
+        remove(tmp_filename);
+        return r;
+    }
+
+    return 0;
+}
+
+/* The erase delay goes down a bit after each upload where the second block went through
+   immediately, and jumps to the measured erase time when it did not. The retry delay
+   follows the average duration of stalled writes. */
+static void learn_halfkay_profile(struct halfkay_profile *profile, uint64_t erase_time,
+                                  bool erase_stalled, unsigned int stalled_writes,
+                                  uint64_t stall_time)
+{
+    if (erase_stalled) {
+        profile->erase_delay = (unsigned int)_HS_MIN(erase_time, HALFKAY_MAX_ERASE_DELAY);
+    } else {
+        profile->erase_delay -= profile->erase_delay / 8;
+    }
+
+    if (stalled_writes) {
+        uint64_t average = stall_time / stalled_writes;
+
+        profile->retry_delay = (unsigned int)(profile->retry_delay + average) / 2;
+        profile->retry_delay = _HS_MAX(profile->retry_delay, 1);
+        profile->retry_delay = _HS_MIN(profile->retry_delay, HALFKAY_RETRY_DELAY);
+    }
+}
+
+struct halfkay_block {
+    size_t address;
+    // Number of firmware bytes in this block, used to report progress
+    size_t len;
+};
+
+/* Build the HID report of every non-empty block before the first write, so that the upload
+   loop does nothing but hs_hid_write() calls back to back. */
+static int prepare_halfkay_blocks(const ty_firmware *fw, unsigned int halfkay_version,
+                                  size_t min_address, size_t block_size,
+                                  struct halfkay_block **rblocks, uint8_t **rreports,
+                                  size_t *rcount)
+{
+    size_t header_size = get_halfkay_header_size(halfkay_version);
+    size_t report_size = header_size + block_size;
+    ty_firmware_block_iterator it;
+    size_t address, len;
+    struct halfkay_block *blocks = NULL;
+    uint8_t *reports = NULL;
+    size_t count = 0;
+    int r;
+
+    // Empty blocks are skipped by the iterator, the upload never sees them
+    ty_firmware_blocks_init(&it, fw, min_address, block_size);
+    while (ty_firmware_blocks_next(&it, &address, &len))
+        count++;
+
+    blocks = calloc(count + 1, sizeof(*blocks));
+    reports = calloc(count + 1, report_size);
+    if (!blocks || !reports) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    ty_firmware_blocks_init(&it, fw, min_address, block_size);
+    for (size_t i = 0; ty_firmware_blocks_next(&it, &address, &len); i++) {
+        uint8_t *report = reports + i * report_size;
+
+        blocks[i].address = address;
+        blocks[i].len = len;
+        write_halfkay_header(report, halfkay_version, address);
+        ty_firmware_extract(fw, (uint32_t)address, report + header_size, block_size);
+    }
+
+    *rblocks = blocks;
+    blocks = NULL;
+    *rreports = reports;
+    reports = NULL;
+    *rcount = count;
+
+    r = 0;
+cleanup:
+    free(reports);
+    free(blocks);
+    return r;
+}
+
+static uint64_t hash_block(const uint8_t *data, size_t size)
+{
+    // FNV-1a, good enough to detect modified blocks
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+static unsigned int get_flash_cache_filename(const ty_board *board,
+                                             char (*rfilename)[TY_PATH_MAX_SIZE])
+{
+    const char *serial_number = board->serial_number;
+
+    // Boards without a real serial number cannot be told apart
+    if (!serial_number || !serial_number[strspn(serial_number, "0_ ")] ||
+            strpbrk(serial_number, "/\\:. "))
+        return 0;
+
+    if (!ty_standard_get_paths(TY_PATH_CACHE_DIRECTORY, "TyTools/flash", rfilename, 1))
+        return 0;
+
+    size_t len = strlen(*rfilename);
+    if (snprintf(*rfilename + len, sizeof(*rfilename) - len, "/%s.txt",
+                 serial_number) >= (int)(sizeof(*rfilename) - len))
+        return 0;
+
+    return 1;
+}
+
+/* Returns the number of blocks that differ from the cached image (including blocks that
+   are gone), or SIZE_MAX if there is no usable cache for this board and model. */
+static size_t count_changed_blocks(const char *filename, ty_model model, size_t block_size,
+                                   const struct halfkay_block *blocks, const uint64_t *hashes,
+                                   size_t count)
+{
+    FILE *fp;
+    char line[256];
+    size_t matched = 0, removed = 0, i = 0;
+    bool valid = false;
+
+#ifdef _WIN32
+    fp = fopen(filename, "rb");
+#else
+    fp = fopen(filename, "rbe");
+#endif
+    if (!fp)
+        return SIZE_MAX;
+
+    if (fgets(line, sizeof(line), fp) && !strcmp(line, "TyTools flash cache 1\n") &&
+            fgets(line, sizeof(line), fp)) {
+        char name[128];
+        unsigned long cache_block_size;
+
+        valid = sscanf(line, "%127[^\t]\t%lu", name, &cache_block_size) == 2 &&
+                ty_models_find(name) == model && cache_block_size == block_size;
+    }
+
+    while (valid && fgets(line, sizeof(line), fp)) {
+        unsigned long long address, hash;
+
+        if (sscanf(line, "%llx %llx", &address, &hash) != 2) {
+            valid = false;
+            break;
+        }
+
+        // Both lists are sorted by address
+        while (i < count && blocks[i].address < address)
+            i++;
+        if (i < count && blocks[i].address == address) {
+            matched += (hashes[i] == hash);
+        } else {
+            removed++;
+        }
+    }
+    fclose(fp);
+
+    if (!valid)
+        return SIZE_MAX;
+    return (count - matched) + removed;
+}
+
+static int save_flash_cache(const char *filename, ty_model model, size_t block_size,
+                            const struct halfkay_block *blocks, const uint64_t *hashes,
+                            size_t count)
+{
+    char tmp_filename[TY_PATH_MAX_SIZE + 4];
+    char *dir_end;
+    FILE *fp;
+    int r;
+
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s", filename);
+    dir_end = strrchr(tmp_filename, '/');
+    if (dir_end) {
+        *dir_end = 0;
+        r = ty_create_directory(tmp_filename);
+        if (r < 0)
+            return r;
+    }
+
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename);
+#ifdef _WIN32
+    fp = fopen(tmp_filename, "wb");
+#else
+    fp = fopen(tmp_filename, "wbe");
+#endif
+    if (!fp)
+        return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", tmp_filename, strerror(errno));
+
+    fprintf(fp, "TyTools flash cache 1\n%s\t%zu\n", ty_models[model].name, block_size);
+    for (size_t i = 0; i < count; i++)
+        fprintf(fp, "%zx %016" PRIx64 "\n", blocks[i].address, hashes[i]);
+
+    if (fflush(fp) || ferror(fp)) {
+        r = ty_error(TY_ERROR_IO, "I/O error while writing to '%s'", tmp_filename);
+        fclose(fp);
+        remove(tmp_filename);
+        return r;
+    }
+    fclose(fp);
+
+#ifdef _WIN32
+    remove(filename);
+#endif
+    if (rename(tmp_filename, filename) < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "rename('%s') failed: %s", tmp_filename, strerror(errno));
+        remove(tmp_filename);
+        return r;
+    }
+
+    return 0;
+}
+
+static int teensy_upload(ty_board_interface *iface, ty_firmware *fw, int flags,
                          ty_board_upload_progress_func *pf, void *udata)
 {
     unsigned int halfkay_version;
     size_t min_address, max_address, block_size;
+    struct halfkay_block *blocks = NULL;
+    uint8_t *reports = NULL;
+    size_t blocks_count = 0, report_size;
+    char profile_filename[1][TY_PATH_MAX_SIZE];
+    char cache_filename[1][TY_PATH_MAX_SIZE];
+    bool use_cache;
+    uint64_t *hashes = NULL;
+    struct halfkay_profile *profiles = NULL;
+    bool *known_profiles = NULL;
+    struct halfkay_pacing pacing_buf = {0}, *pacing = NULL;
+    uint64_t erase_start = 0, erase_time = 0;
+    bool erase_stalled = false;
     int r;
 
     r = get_halfkay_settings(iface->model, &halfkay_version, &min_address, &max_address, &block_size);
@@ -724,35 +1183,136 @@ static int teensy_upload(ty_board_interface *iface, ty_firmware *fw,
         return ty_error(TY_ERROR_RANGE, "Firmware is too big for %s",
                         ty_models[iface->model].name);
 
+    r = prepare_halfkay_blocks(fw, halfkay_version, min_address, block_size, &blocks, &reports,
+                               &blocks_count);
+    if (r < 0)
+        return r;
+    report_size = get_halfkay_header_size(halfkay_version) + block_size;
+
+    use_cache = get_flash_cache_filename(iface->board, cache_filename);
+    if (use_cache && (flags & TY_UPLOAD_DIFFERENTIAL)) {
+        size_t changed, total_len = 0;
+
+        hashes = malloc((blocks_count + 1) * sizeof(*hashes));
+        if (!hashes) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+        for (size_t i = 0; i < blocks_count; i++) {
+            hashes[i] = hash_block(reports + i * report_size + report_size - block_size,
+                                   block_size);
+            total_len += blocks[i].len;
+        }
+
+        changed = count_changed_blocks(cache_filename[0], iface->model, block_size, blocks,
+                                       hashes, blocks_count);
+        if (!changed) {
+            ty_log(TY_LOG_INFO, "Firmware is already on the board, skipping upload");
+            if (pf)
+                r = (*pf)(iface->board, fw, total_len, max_address - min_address, udata);
+            goto cleanup;
+        } else if (changed != SIZE_MAX) {
+            /* Every HalfKay version erases the whole flash on the first write, so we cannot
+               send only the modified blocks. */
+            ty_log(TY_LOG_DEBUG, "%zu of %zu blocks changed, uploading the whole firmware",
+                   changed, blocks_count);
+        }
+    }
+    /* Whatever happens next, the cached image is not reliable anymore. It is only written
+       again after a successful differential upload. */
+    if (use_cache)
+        remove(cache_filename[0]);
+
+    if ((flags & TY_UPLOAD_ADAPTIVE) && get_profile_filename(profile_filename)) {
+        profiles = calloc(ty_models_count, sizeof(*profiles));
+        known_profiles = calloc(ty_models_count, sizeof(*known_profiles));
+        if (!profiles || !known_profiles) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+        ty_mutex_lock(&profiles_lock);
+        load_halfkay_profiles(profile_filename[0], profiles, known_profiles);
+        ty_mutex_unlock(&profiles_lock);
+
+        pacing = &pacing_buf;
+        pacing->profile = profiles[iface->model];
+        ty_log(TY_LOG_DEBUG, "Using HalfKay timings: erase delay %u ms, retry delay %u ms",
+               pacing->profile.erase_delay, pacing->profile.retry_delay);
+    }
+
     if (pf) {
         r = (*pf)(iface->board, fw, 0, max_address - min_address, udata);
         if (r)
-            return r;
+            goto cleanup;
     }
 
     size_t uploaded_len = 0;
-    for (size_t address = min_address; address < fw->max_address; address += block_size) {
-        uint8_t buf[8192];
-        size_t buf_len;
+    for (size_t i = 0; i < blocks_count; i++) {
+        unsigned int stalled_writes = pacing ? pacing->stalled_writes : 0;
+        uint64_t stall_time = pacing ? pacing->stall_time : 0;
+
+        r = halfkay_write(iface->port, reports + i * report_size, report_size,
+                          blocks[i].address, 150, pacing);
+        if (r < 0)
+            goto cleanup;
+        uploaded_len += blocks[i].len;
+
+        /* The first write triggers a complete erase, the time it takes is measured with
+           the second write (and kept out of the stall statistics). */
+        if (pacing && !i) {
+            erase_start = hs_millis();
+            hs_delay(pacing->profile.erase_delay);
+        } else if (pacing && i == 1) {
+            erase_time = hs_millis() - erase_start;
+            erase_stalled = (pacing->stalled_writes != stalled_writes);
+
+            pacing->stalled_writes = stalled_writes;
+            pacing->stall_time = stall_time;
+        }
 
-        memset(buf, 0, sizeof(buf));
-        buf_len = ty_firmware_extract(fw, (uint32_t)address, buf, block_size);
+        if (pf) {
+            r = (*pf)(iface->board, fw, uploaded_len, max_address - min_address, udata);
+            if (r)
+                goto cleanup;
+        }
+    }
 
-        if (buf_len) {
-            r = halfkay_send(iface->port, halfkay_version, block_size, address, buf, buf_len, 150);
-            if (r < 0)
-                return r;
-            uploaded_len += buf_len;
+    if (pacing && blocks_count >= 2) {
+        struct halfkay_profile *profile = &profiles[iface->model];
+
+        /* Other uploads may have saved their own timings since we loaded the profiles,
+           reload them and learn on top of the fresh values. */
+        ty_mutex_lock(&profiles_lock);
+        load_halfkay_profiles(profile_filename[0], profiles, known_profiles);
+        learn_halfkay_profile(profile, erase_time, erase_stalled, pacing->stalled_writes,
+                              pacing->stall_time);
+        known_profiles[iface->model] = true;
+        ty_log(TY_LOG_DEBUG, "Learned HalfKay timings: erase delay %u ms, retry delay %u ms",
+               profile->erase_delay, profile->retry_delay);
+
+        // The upload itself went fine, don't fail because of this
+        r = save_halfkay_profiles(profile_filename[0], profiles, known_profiles);
+        ty_mutex_unlock(&profiles_lock);
+        if (r < 0)
+            ty_log(TY_LOG_WARNING, "Failed to save HalfKay timing profile");
+    }
 
-            if (pf) {
-                r = (*pf)(iface->board, fw, uploaded_len, max_address - min_address, udata);
-                if (r)
-                    return r;
-            }
-        }
+    if (hashes) {
+        r = save_flash_cache(cache_filename[0], iface->model, block_size, blocks, hashes,
+                             blocks_count);
+        if (r < 0)
+            ty_log(TY_LOG_WARNING, "Failed to save flash cache for board '%s'",
+                   iface->board->tag);
     }
 
-    return 0;
+    r = 0;
+cleanup:
+    free(hashes);
+    free(known_profiles);
+    free(profiles);
+    free(reports);
+    free(blocks);
+    return r;
 }
 
 static int teensy_reset(ty_board_interface *iface, int64_t rtc)
@@ -115,6 +115,15 @@ void ty_message_redirect(ty_message_func *f, void *udata)
     message_handler_udata = udata;
 }
 
+void ty_message_get_handler(ty_message_func **rf, void **rudata)
+{
+    assert(rf);
+    assert(rudata);
+
+    *rf = message_handler;
+    *rudata = message_handler_udata;
+}
+
 void ty_log(ty_log_level level, const char *fmt, ...)
 {
     assert(fmt);
@@ -153,6 +162,7 @@ static const char *generic_error(int err)
         case TY_ERROR_RANGE: { return "Out of range error"; } break;
         case TY_ERROR_SYSTEM: { return "System error"; } break;
         case TY_ERROR_PARSE: { return "Parse error"; } break;
+        case TY_ERROR_INTERRUPTED: { return "Interrupted"; } break;
 
         case TY_ERROR_OTHER: {} break;
     }
@@ -49,7 +49,8 @@ typedef enum ty_err {
     TY_ERROR_RANGE         = -11,
     TY_ERROR_SYSTEM        = -12,
     TY_ERROR_PARSE         = -13,
-    TY_ERROR_OTHER         = -14
+    TY_ERROR_INTERRUPTED   = -14,
+    TY_ERROR_OTHER         = -15
 } ty_err;
 
 typedef enum ty_message_type {
@@ -102,6 +103,7 @@ const char *ty_version_string(void);
 
 void ty_message_default_handler(const ty_message_data *msg, void *udata);
 void ty_message_redirect(ty_message_func *f, void *udata);
+void ty_message_get_handler(ty_message_func **rf, void **rudata);
 
 void ty_error_mask(ty_err err);
 void ty_error_unmask(void);
@@ -0,0 +1,414 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common.h"
+#include "compress.h"
+
+#define HASH_BITS 13
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+// The format requires the last 5 bytes to be literals, and no match in the last 12 bytes
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+
+static inline uint32_t read32(const uint8_t *ptr)
+{
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline unsigned int hash32(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t *write_length(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+
+    return op;
+}
+
+static uint8_t *write_sequence(uint8_t *op, const uint8_t *literals, size_t literals_len,
+                               size_t offset, size_t match_len)
+{
+    uint8_t *token = op++;
+
+    *token = (uint8_t)((literals_len >= 15 ? 15 : literals_len) << 4);
+    if (literals_len >= 15)
+        op = write_length(op, literals_len - 15);
+    memcpy(op, literals, literals_len);
+    op += literals_len;
+
+    // The last sequence has no match
+    if (offset) {
+        *op++ = (uint8_t)(offset & 0xFF);
+        *op++ = (uint8_t)(offset >> 8);
+
+        match_len -= MIN_MATCH;
+        *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+        if (match_len >= 15)
+            op = write_length(op, match_len - 15);
+    }
+
+    return op;
+}
+
+size_t ty_lz4_compress(const void *src, size_t src_len, void *dest)
+{
+    assert(src || !src_len);
+    assert(dest);
+
+    const uint8_t *start = src;
+    const uint8_t *end = start + src_len;
+    const uint8_t *ip = start;
+    const uint8_t *anchor = start;
+    uint8_t *op = dest;
+
+    if (src_len > MF_LIMIT) {
+        const uint8_t *match_limit = end - MF_LIMIT;
+        const uint8_t *extend_limit = end - LAST_LITERALS;
+        // Positions relative to start, 0 may be bogus but the match check takes care of it
+        uint32_t table[1 << HASH_BITS] = {0};
+
+        while (ip < match_limit) {
+            uint32_t value = read32(ip);
+            unsigned int hash = hash32(value);
+            const uint8_t *ref = start + table[hash];
+
+            table[hash] = (uint32_t)(ip - start);
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != value) {
+                ip++;
+                continue;
+            }
+
+            // Extend the match backwards over pending literals, then forward
+            while (ip > anchor && ref > start && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *match_end = ip + MIN_MATCH;
+            const uint8_t *ref_end = ref + MIN_MATCH;
+            while (match_end < extend_limit && *match_end == *ref_end) {
+                match_end++;
+                ref_end++;
+            }
+
+            op = write_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref),
+                                (size_t)(match_end - ip));
+
+            ip = match_end;
+            anchor = ip;
+            if (ip - 2 > start)
+                table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - start);
+        }
+    }
+
+    op = write_sequence(op, anchor, (size_t)(end - anchor), 0, 0);
+
+    return (size_t)(op - (uint8_t *)dest);
+}
+
+static bool read_length(const uint8_t **rip, const uint8_t *end, size_t *rlen)
+{
+    const uint8_t *ip = *rip;
+    uint8_t byte;
+
+    do {
+        if (ip >= end)
+            return false;
+        byte = *ip++;
+        *rlen += byte;
+    } while (byte == 255);
+
+    *rip = ip;
+    return true;
+}
+
+bool ty_lz4_decompress(const void *src, size_t src_len, void *dest, size_t dest_len)
+{
+    assert(src || !src_len);
+    assert(dest || !dest_len);
+
+    const uint8_t *ip = src;
+    const uint8_t *end = ip + src_len;
+    uint8_t *op = dest;
+    uint8_t *op_end = op + dest_len;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t literals_len = token >> 4;
+        size_t offset, match_len;
+        const uint8_t *match;
+
+        if (literals_len == 15 && !read_length(&ip, end, &literals_len))
+            return false;
+        if (literals_len > (size_t)(end - ip) || literals_len > (size_t)(op_end - op))
+            return false;
+        memcpy(op, ip, literals_len);
+        ip += literals_len;
+        op += literals_len;
+
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - (uint8_t *)dest))
+            return false;
+
+        match_len = token & 0xF;
+        if (match_len == 15 && !read_length(&ip, end, &match_len))
+            return false;
+        match_len += MIN_MATCH;
+        if (match_len > (size_t)(op_end - op))
+            return false;
+
+        // Matches can overlap the output, one byte at a time is the simple way to get it right
+        match = op - offset;
+        while (match_len--)
+            *op++ = *match++;
+    }
+
+    return op == op_end;
+}
+
+#define HUFFMAN_MAX_BITS 11
+#define HUFFMAN_HEADER_SIZE (4 + 128)
+
+static void build_huffman_lengths(const uint32_t freqs[256], uint8_t lengths[256])
+{
+    uint32_t weights[256];
+    unsigned int symbols_count = 0;
+
+    for (unsigned int i = 0; i < 256; i++) {
+        weights[i] = freqs[i];
+        symbols_count += !!freqs[i];
+    }
+    memset(lengths, 0, 256);
+    if (symbols_count == 1) {
+        for (unsigned int i = 0; i < 256; i++)
+            lengths[i] = (uint8_t)(freqs[i] ? 1 : 0);
+        return;
+    }
+
+    // Flatten the weights until the longest code fits, it costs little in practice
+    for (;;) {
+        uint64_t node_weights[511];
+        int parents[511];
+        bool used[511] = {false};
+        unsigned int nodes_count = 256, max_len = 0;
+
+        for (unsigned int i = 0; i < 256; i++)
+            node_weights[i] = weights[i];
+
+        for (unsigned int merges = 1; merges < symbols_count; merges++) {
+            int min1 = -1, min2 = -1;
+
+            for (unsigned int i = 0; i < nodes_count; i++) {
+                if (used[i] || !node_weights[i])
+                    continue;
+                if (min1 < 0 || node_weights[i] < node_weights[min1]) {
+                    min2 = min1;
+                    min1 = (int)i;
+                } else if (min2 < 0 || node_weights[i] < node_weights[min2]) {
+                    min2 = (int)i;
+                }
+            }
+
+            used[min1] = true;
+            used[min2] = true;
+            parents[min1] = (int)nodes_count;
+            parents[min2] = (int)nodes_count;
+            node_weights[nodes_count++] = node_weights[min1] + node_weights[min2];
+        }
+
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int len = 0;
+
+            if (!weights[i]) {
+                lengths[i] = 0;
+                continue;
+            }
+            for (int node = (int)i; node != (int)nodes_count - 1; node = parents[node])
+                len++;
+            lengths[i] = (uint8_t)len;
+            if (len > max_len)
+                max_len = len;
+        }
+        if (max_len <= HUFFMAN_MAX_BITS)
+            break;
+
+        for (unsigned int i = 0; i < 256; i++) {
+            if (weights[i])
+                weights[i] = weights[i] / 2 + 1;
+        }
+    }
+}
+
+// Canonical codes, bit-reversed because the stream is read from the least significant bit
+static bool build_huffman_codes(const uint8_t lengths[256], uint16_t codes[256])
+{
+    unsigned int counts[HUFFMAN_MAX_BITS + 1] = {0};
+    unsigned int next[HUFFMAN_MAX_BITS + 1];
+    unsigned int code = 0;
+
+    for (unsigned int i = 0; i < 256; i++) {
+        if (lengths[i] > HUFFMAN_MAX_BITS)
+            return false;
+        counts[lengths[i]]++;
+    }
+    counts[0] = 0;
+    for (unsigned int len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+        code = (code + counts[len - 1]) << 1;
+        next[len] = code;
+    }
+    // Oversubscribed lengths cannot come from the encoder
+    if (next[HUFFMAN_MAX_BITS] + counts[HUFFMAN_MAX_BITS] > (1u << HUFFMAN_MAX_BITS))
+        return false;
+
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned int len = lengths[i], value, reversed = 0;
+
+        if (!len)
+            continue;
+        value = next[len]++;
+        for (unsigned int j = 0; j < len; j++)
+            reversed |= ((value >> j) & 1) << (len - 1 - j);
+        codes[i] = (uint16_t)reversed;
+    }
+
+    return true;
+}
+
+size_t ty_huffman_compress(const void *src, size_t src_len, void *dest)
+{
+    assert(src || !src_len);
+    assert(dest);
+
+    const uint8_t *ip = src;
+    uint8_t *op = dest;
+    uint32_t freqs[256] = {0};
+    uint8_t lengths[256];
+    uint16_t codes[256];
+    uint64_t bits = 0;
+    uint64_t acc = 0;
+    unsigned int acc_len = 0;
+
+    if (!src_len || src_len > UINT32_MAX)
+        return 0;
+
+    for (size_t i = 0; i < src_len; i++)
+        freqs[ip[i]]++;
+    build_huffman_lengths(freqs, lengths);
+    build_huffman_codes(lengths, codes);
+
+    for (unsigned int i = 0; i < 256; i++)
+        bits += (uint64_t)freqs[i] * lengths[i];
+    if (HUFFMAN_HEADER_SIZE + (bits + 7) / 8 >= src_len)
+        return 0;
+
+    for (unsigned int i = 0; i < 4; i++)
+        *op++ = (uint8_t)(src_len >> (i * 8));
+    for (unsigned int i = 0; i < 256; i += 2)
+        *op++ = (uint8_t)(lengths[i] | (lengths[i + 1] << 4));
+
+    for (size_t i = 0; i < src_len; i++) {
+        acc |= (uint64_t)codes[ip[i]] << acc_len;
+        acc_len += lengths[ip[i]];
+        while (acc_len >= 8) {
+            *op++ = (uint8_t)acc;
+            acc >>= 8;
+            acc_len -= 8;
+        }
+    }
+    if (acc_len)
+        *op++ = (uint8_t)acc;
+
+    return (size_t)(op - (uint8_t *)dest);
+}
+
+size_t ty_huffman_decompressed_size(const void *src, size_t src_len)
+{
+    const uint8_t *ip = src;
+    size_t len = 0;
+
+    if (src_len < HUFFMAN_HEADER_SIZE)
+        return 0;
+    for (unsigned int i = 0; i < 4; i++)
+        len |= (size_t)ip[i] << (i * 8);
+
+    return len;
+}
+
+bool ty_huffman_decompress(const void *src, size_t src_len, void *dest, size_t dest_len)
+{
+    assert(src || !src_len);
+    assert(dest || !dest_len);
+
+    const uint8_t *ip = src;
+    size_t pos = HUFFMAN_HEADER_SIZE;
+    uint8_t *op = dest;
+    uint8_t lengths[256];
+    uint16_t codes[256];
+    // Symbol in the low byte, code length above
+    uint16_t table[1 << HUFFMAN_MAX_BITS] = {0};
+    uint64_t acc = 0;
+    unsigned int acc_len = 0;
+
+    if (src_len < HUFFMAN_HEADER_SIZE || ty_huffman_decompressed_size(src, src_len) != dest_len)
+        return false;
+    for (unsigned int i = 0; i < 256; i += 2) {
+        lengths[i] = ip[4 + i / 2] & 0xF;
+        lengths[i + 1] = ip[4 + i / 2] >> 4;
+    }
+
+    if (!build_huffman_codes(lengths, codes))
+        return false;
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned int len = lengths[i];
+
+        if (!len)
+            continue;
+        for (unsigned int j = codes[i]; j < _HS_COUNTOF(table); j += 1u << len)
+            table[j] = (uint16_t)(i | (len << 8));
+    }
+
+    for (size_t i = 0; i < dest_len; i++) {
+        uint16_t entry;
+        unsigned int len;
+
+        while (acc_len <= 56) {
+            // Past the end the stream is padded with zeros, checked below
+            if (pos < src_len)
+                acc |= (uint64_t)ip[pos] << acc_len;
+            pos++;
+            acc_len += 8;
+        }
+
+        entry = table[acc & ((1u << HUFFMAN_MAX_BITS) - 1)];
+        len = entry >> 8;
+        if (!len)
+            return false;
+        *op++ = (uint8_t)entry;
+        acc >>= len;
+        acc_len -= len;
+    }
+
+    // Fail if we read padding bits past the end of the stream
+    return pos * 8 - acc_len <= src_len * 8;
+}
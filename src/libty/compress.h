@@ -0,0 +1,43 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_COMPRESS_H
+#define TY_COMPRESS_H
+
+#include "common.h"
+
+_HS_BEGIN_C
+
+/* Raw LZ4 blocks (no frame), so that any LZ4 implementation can decode what we write.
+   The compressor is a simple greedy one, which is enough for repetitive text such as
+   serial output. */
+
+static inline size_t ty_lz4_compress_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+// The destination buffer must be at least ty_lz4_compress_bound(src_len) bytes long
+size_t ty_lz4_compress(const void *src, size_t src_len, void *dest);
+// Fails unless the block decodes to exactly dest_len bytes
+bool ty_lz4_decompress(const void *src, size_t src_len, void *dest, size_t dest_len);
+
+/* Order-0 Huffman coding, with a code table in front of each buffer. LZ4 leaves literals
+   such as digits as they are, this stage packs them (and the rest) in fewer bits. */
+
+// Returns 0 unless the result is smaller than src_len, dest must be at least that long
+size_t ty_huffman_compress(const void *src, size_t src_len, void *dest);
+// Read from the header, 0 for truncated buffers
+size_t ty_huffman_decompressed_size(const void *src, size_t src_len);
+bool ty_huffman_decompress(const void *src, size_t src_len, void *dest, size_t dest_len);
+
+_HS_END_C
+
+#endif
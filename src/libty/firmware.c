@@ -9,17 +9,34 @@
    See the LICENSE file for more details. */
 
 #include "common.h"
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
 #include "../libhs/array.h"
 #include "class_priv.h"
 #include "firmware.h"
 #include "system.h"
 
 const ty_firmware_format ty_firmware_formats[] = {
-    {"elf",  ".elf", ty_firmware_load_elf},
-    {"ihex", ".hex", ty_firmware_load_ihex}
+    {"elf",  ".elf", ty_firmware_load_elf,  NULL, NULL},
+    {"ihex", ".hex", ty_firmware_load_ihex, ty_firmware_feed_ihex, ty_firmware_finish_ihex}
 };
 const unsigned int ty_firmware_formats_count = _HS_COUNTOF(ty_firmware_formats);
 
+#define MAX_FILE_SIZE (8 * 1024 * 1024)
+#define READ_CHUNK_SIZE (64 * 1024)
+
+struct ty_firmware_parser {
+    const ty_firmware_format *format;
+    ty_firmware *fw;
+
+    // Formats without streaming support get parsed from this buffer in finish()
+    void *stream;
+    _HS_ARRAY(uint8_t) buf;
+    size_t total_len;
+};
+
 static const char *get_basename(const char *filename)
 {
     const char *basename;
@@ -35,6 +52,65 @@ static const char *get_basename(const char *filename)
     return basename;
 }
 
+static unsigned int identify_models(const ty_firmware *fw, ty_model *rmodels,
+                                    unsigned int max_models)
+{
+    unsigned int guesses_count = 0;
+
+    for (unsigned int i = 0; i < _ty_classes_count; i++) {
+        ty_model partial_guesses[16];
+        unsigned int partial_count;
+
+        if (!_ty_classes[i].vtable->identify_models)
+            continue;
+
+        partial_count = (*_ty_classes[i].vtable->identify_models)(fw, partial_guesses,
+                                                                  _HS_COUNTOF(partial_guesses));
+
+        for (unsigned int j = 0; j < partial_count; j++) {
+            if (rmodels && guesses_count < max_models)
+                rmodels[guesses_count++] = partial_guesses[j];
+        }
+    }
+
+    return guesses_count;
+}
+
+static void build_index(const ty_firmware *fw, ty_firmware_index *rindex)
+{
+    size_t max_end = 0;
+
+    rindex->count = fw->segments_count;
+    rindex->overlapping = false;
+
+    // Insertion sort, stable so that overlapping segments keep their load order
+    for (unsigned int i = 0; i < fw->segments_count; i++) {
+        unsigned int j = i;
+
+        while (j && fw->segments[rindex->order[j - 1]].address > fw->segments[i].address) {
+            rindex->order[j] = rindex->order[j - 1];
+            j--;
+        }
+        rindex->order[j] = i;
+    }
+
+    for (unsigned int i = 0; i < rindex->count; i++) {
+        const ty_firmware_segment *segment = &fw->segments[rindex->order[i]];
+
+        if (segment->size && segment->address < max_end)
+            rindex->overlapping = true;
+        max_end = _HS_MAX(max_end, segment->address + segment->size);
+        rindex->max_ends[i] = max_end;
+    }
+}
+
+static void finalize_firmware(ty_firmware *fw)
+{
+    fw->models_count = identify_models(fw, fw->models, _HS_COUNTOF(fw->models));
+    build_index(fw, &fw->index);
+    fw->finalized = true;
+}
+
 int ty_firmware_new(const char *filename, ty_firmware **rfw)
 {
     assert(filename);
@@ -106,6 +182,155 @@ static int find_format(const char *filename, const char *format_name,
     return 0;
 }
 
+#ifndef _WIN32
+
+static int map_file(const char *filename, FILE *fp, void **raddr, size_t *rsize)
+{
+    struct stat sb;
+    void *addr;
+    int r;
+
+    r = fstat(fileno(fp), &sb);
+    if (r < 0)
+        return ty_error(TY_ERROR_SYSTEM, "fstat('%s') failed: %s", filename, strerror(errno));
+
+    // Leave pipes, devices and empty files to the read loop
+    if (!S_ISREG(sb.st_mode) || !sb.st_size)
+        return 0;
+    if (sb.st_size > MAX_FILE_SIZE)
+        return ty_error(TY_ERROR_RANGE, "Firmware '%s' is too big to load", filename);
+
+    /* Segments may point directly into this mapping, it stays read-only and clean (shared
+       with the page cache) until ty_firmware_expand_segment() copies them out. */
+    addr = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (addr == MAP_FAILED)
+        return 0;
+#ifdef MADV_WILLNEED
+    madvise(addr, (size_t)sb.st_size, MADV_WILLNEED);
+#endif
+
+    *raddr = addr;
+    *rsize = (size_t)sb.st_size;
+    return 1;
+}
+
+static void release_unused_mapping(ty_firmware *fw)
+{
+    if (!fw->map_addr)
+        return;
+
+    for (unsigned int i = 0; i < fw->segments_count; i++) {
+        if (!fw->segments[i].alloc_size && fw->segments[i].data)
+            return;
+    }
+
+    munmap(fw->map_addr, fw->map_size);
+    fw->map_addr = NULL;
+    fw->map_size = 0;
+}
+
+#endif
+
+static int create_parser(const char *filename, const ty_firmware_format *format,
+                         ty_firmware_parser **rparser)
+{
+    ty_firmware_parser *parser;
+    int r;
+
+    parser = calloc(1, sizeof(*parser));
+    if (!parser)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    parser->format = format;
+
+    r = ty_firmware_new(filename, &parser->fw);
+    if (r < 0) {
+        free(parser);
+        return r;
+    }
+
+    *rparser = parser;
+    return 0;
+}
+
+int ty_firmware_parser_new(const char *filename, const char *format_name,
+                           ty_firmware_parser **rparser)
+{
+    assert(filename);
+    assert(rparser);
+
+    const ty_firmware_format *format = NULL;
+    int r;
+
+    r = find_format(filename, format_name, &format);
+    if (r < 0)
+        return r;
+
+    return create_parser(filename, format, rparser);
+}
+
+void ty_firmware_parser_free(ty_firmware_parser *parser)
+{
+    if (parser) {
+        ty_firmware_unref(parser->fw);
+        free(parser->stream);
+        _hs_array_release(&parser->buf);
+    }
+
+    free(parser);
+}
+
+int ty_firmware_parser_feed(ty_firmware_parser *parser, const uint8_t *mem, size_t len)
+{
+    assert(parser);
+    assert(parser->fw);
+    assert(mem || !len);
+
+    int r;
+
+    if (len > MAX_FILE_SIZE - parser->total_len)
+        return ty_error(TY_ERROR_RANGE, "Firmware '%s' is too big to load", parser->fw->filename);
+    parser->total_len += len;
+
+    if (parser->format->feed)
+        return (*parser->format->feed)(parser->fw, &parser->stream, mem, len);
+
+    r = _hs_array_grow(&parser->buf, len);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    memcpy(parser->buf.values + parser->buf.count, mem, len);
+    parser->buf.count += len;
+
+    return 0;
+}
+
+int ty_firmware_parser_finish(ty_firmware_parser *parser, ty_firmware **rfw)
+{
+    assert(parser);
+    assert(parser->fw);
+    assert(rfw);
+
+    int r;
+
+    if (parser->format->feed) {
+        if (!parser->stream) {
+            r = (*parser->format->feed)(parser->fw, &parser->stream, NULL, 0);
+            if (r < 0)
+                return r;
+        }
+        r = (*parser->format->finish)(parser->fw, parser->stream);
+    } else {
+        r = (*parser->format->load)(parser->fw, parser->buf.values, parser->buf.count);
+    }
+    if (r < 0)
+        return r;
+    finalize_firmware(parser->fw);
+
+    *rfw = parser->fw;
+    parser->fw = NULL;
+
+    return 0;
+}
+
 int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_name,
                           ty_firmware **rfw)
 {
@@ -114,7 +339,10 @@ int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_nam
 
     const ty_firmware_format *format;
     bool close_fp = false;
-    _HS_ARRAY(uint8_t) buf = {0};
+    void *map_addr = NULL;
+    size_t map_size = 0;
+    ty_firmware_parser *parser = NULL;
+    uint8_t *chunk = NULL;
     ty_firmware *fw = NULL;
     int r;
 
@@ -156,47 +384,105 @@ restart:
         close_fp = true;
     }
 
-    // Load file to memory
-    while (!feof(fp)) {
-        r = _hs_array_grow(&buf, 128 * 1024);
+#ifndef _WIN32
+    // We don't know where the caller has moved the file pointer, only map our own files
+    if (close_fp) {
+        r = map_file(filename, fp, &map_addr, &map_size);
         if (r < 0)
             goto cleanup;
+    }
+#endif
 
-        buf.count += fread(buf.values + buf.count, 1, 131072, fp);
-        if (ferror(fp)) {
-            if (errno == EIO) {
-                r = ty_error(TY_ERROR_IO, "I/O error while reading from '%s'", filename);
-            } else {
-                r = ty_error(TY_ERROR_SYSTEM, "fread('%s') failed: %s", filename, strerror(errno));
-            }
+    if (map_addr) {
+        r = ty_firmware_new(filename, &fw);
+        if (r < 0)
             goto cleanup;
-        }
-        if (buf.count > 8 * 1024 * 1024) {
-            r = ty_error(TY_ERROR_RANGE, "Firmware '%s' is too big to load", filename);
+
+        // The firmware owns the mapping from now on
+        fw->map_addr = map_addr;
+        fw->map_size = map_size;
+        map_addr = NULL;
+
+        r = (*format->load)(fw, fw->map_addr, fw->map_size);
+        if (r < 0)
+            goto cleanup;
+#ifndef _WIN32
+        release_unused_mapping(fw);
+#endif
+        finalize_firmware(fw);
+    } else {
+        /* Feed the parser as the data comes in, so that parsing overlaps with whatever
+           produces the data when we read from a pipe. */
+        r = create_parser(filename, format, &parser);
+        if (r < 0)
+            goto cleanup;
+
+        chunk = malloc(READ_CHUNK_SIZE);
+        if (!chunk) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
             goto cleanup;
         }
-    }
-    _hs_array_shrink(&buf);
 
-    r = ty_firmware_new(filename, &fw);
-    if (r < 0)
-        goto cleanup;
+        while (!feof(fp)) {
+            size_t len = fread(chunk, 1, READ_CHUNK_SIZE, fp);
+            if (ferror(fp)) {
+                if (errno == EIO) {
+                    r = ty_error(TY_ERROR_IO, "I/O error while reading from '%s'", filename);
+                } else {
+                    r = ty_error(TY_ERROR_SYSTEM, "fread('%s') failed: %s", filename, strerror(errno));
+                }
+                goto cleanup;
+            }
 
-    r = (*format->load)(fw, buf.values, buf.count);
-    if (r < 0)
-        goto cleanup;
+            r = ty_firmware_parser_feed(parser, chunk, len);
+            if (r < 0)
+                goto cleanup;
+        }
+
+        r = ty_firmware_parser_finish(parser, &fw);
+        if (r < 0)
+            goto cleanup;
+    }
 
     *rfw = fw;
     fw = NULL;
 
 cleanup:
     ty_firmware_unref(fw);
+#ifndef _WIN32
+    if (map_addr)
+        munmap(map_addr, map_size);
+#endif
     if (close_fp)
         fclose(fp);
-    _hs_array_release(&buf);
+    free(chunk);
+    ty_firmware_parser_free(parser);
     return r;
 }
 
+int _ty_firmware_detach_mapping(ty_firmware *fw)
+{
+    assert(fw);
+
+    if (!fw->map_addr)
+        return 0;
+
+    for (unsigned int i = 0; i < fw->segments_count; i++) {
+        ty_firmware_segment *segment = &fw->segments[i];
+
+        if (!segment->alloc_size && segment->data) {
+            int r = ty_firmware_expand_segment(fw, segment, segment->size);
+            if (r < 0)
+                return r;
+        }
+    }
+#ifndef _WIN32
+    release_unused_mapping(fw);
+#endif
+
+    return 0;
+}
+
 int ty_firmware_load_mem(const char *filename, const uint8_t *mem, size_t len,
                          const char *format_name, ty_firmware **rfw)
 {
@@ -219,6 +505,7 @@ int ty_firmware_load_mem(const char *filename, const uint8_t *mem, size_t len,
     r = (*format->load)(fw, mem, len);
     if (r < 0)
         goto cleanup;
+    finalize_firmware(fw);
 
     *rfw = fw;
     fw = NULL;
@@ -242,8 +529,14 @@ void ty_firmware_unref(ty_firmware *fw)
         if (_ty_refcount_decrease(&fw->refcount))
             return;
 
-        for (unsigned int i = 0; i < fw->segments_count; i++)
-            free(fw->segments[i].data);
+        for (unsigned int i = 0; i < fw->segments_count; i++) {
+            if (fw->segments[i].alloc_size)
+                free(fw->segments[i].data);
+        }
+#ifndef _WIN32
+        if (fw->map_addr)
+            munmap(fw->map_addr, fw->map_size);
+#endif
         free(fw->name);
         free(fw->filename);
     }
@@ -251,35 +544,111 @@ void ty_firmware_unref(ty_firmware *fw)
     free(fw);
 }
 
+static const ty_firmware_index *get_index(const ty_firmware *fw, ty_firmware_index *tmp_index)
+{
+    if (fw->finalized)
+        return &fw->index;
+
+    build_index(fw, tmp_index);
+    return tmp_index;
+}
+
+// Position of the first segment (in address order) that may end after address
+static unsigned int find_index_position(const ty_firmware_index *index, size_t address)
+{
+    unsigned int start = 0, end = index->count;
+
+    while (start < end) {
+        unsigned int mid = start + (end - start) / 2;
+
+        if (index->max_ends[mid] > address) {
+            end = mid;
+        } else {
+            start = mid + 1;
+        }
+    }
+
+    return start;
+}
+
+// Segments that overlap [address, end), in address order
+static unsigned int find_overlapping_segments(const ty_firmware *fw,
+                                              const ty_firmware_index *index,
+                                              size_t address, size_t end,
+                                              unsigned int *rsegments)
+{
+    unsigned int count = 0;
+
+    for (unsigned int i = find_index_position(index, address); i < index->count; i++) {
+        const ty_firmware_segment *segment = &fw->segments[index->order[i]];
+
+        if (segment->address >= end)
+            break;
+        if (segment->address + segment->size > address)
+            rsegments[count++] = index->order[i];
+    }
+
+    return count;
+}
+
 const ty_firmware_segment *ty_firmware_find_segment(const ty_firmware *fw, uint32_t address)
 {
     assert(fw);
 
-    for (unsigned int i = fw->segments_count; i-- > 0;) {
-        const ty_firmware_segment *segment = &fw->segments[i];
+    ty_firmware_index tmp_index;
+    const ty_firmware_index *index;
+    unsigned int segments[TY_FIRMWARE_MAX_SEGMENTS];
+    unsigned int count;
+    unsigned int last;
 
-        if (address >= segment->address && address < segment->address + segment->size)
-            return segment;
-    }
+    index = get_index(fw, &tmp_index);
+    count = find_overlapping_segments(fw, index, address, (size_t)address + 1, segments);
+    if (!count)
+        return NULL;
 
-    return NULL;
+    // The last segment wins when they overlap
+    last = segments[0];
+    for (unsigned int i = 1; i < count; i++)
+        last = _HS_MAX(last, segments[i]);
+
+    return &fw->segments[last];
 }
 
 size_t ty_firmware_extract(const ty_firmware *fw, uint32_t address, uint8_t *buf, size_t size)
 {
     assert(fw);
 
+    ty_firmware_index tmp_index;
+    const ty_firmware_index *index;
+    unsigned int segments[TY_FIRMWARE_MAX_SEGMENTS];
+    unsigned int count;
     size_t total_len = 0;
-    for (unsigned int i = 0; i < fw->segments_count; i++) {
-        const ty_firmware_segment *segment = &fw->segments[i];
 
-        if (address >= segment->address && address < segment->address + segment->size) {
+    index = get_index(fw, &tmp_index);
+    count = find_overlapping_segments(fw, index, address, (size_t)address + size, segments);
+
+    // Copy overlapping segments in load order, so that the last one wins
+    if (index->overlapping) {
+        for (unsigned int i = 1; i < count; i++) {
+            unsigned int value = segments[i];
+            unsigned int j = i;
+
+            for (; j && segments[j - 1] > value; j--)
+                segments[j] = segments[j - 1];
+            segments[j] = value;
+        }
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        const ty_firmware_segment *segment = &fw->segments[segments[i]];
+
+        if (address >= segment->address) {
             size_t delta = address - segment->address;
             size_t len = _HS_MIN(segment->size - delta, size);
 
             memcpy(buf, segment->data + delta, len);
             total_len += len;
-        } else if (address < segment->address && address + size > segment->address) {
+        } else {
             size_t delta = segment->address - address;
             size_t len = _HS_MIN(segment->size, size - delta);
 
@@ -291,6 +660,70 @@ size_t ty_firmware_extract(const ty_firmware *fw, uint32_t address, uint8_t *buf
     return total_len;
 }
 
+void ty_firmware_blocks_init(ty_firmware_block_iterator *it, const ty_firmware *fw,
+                             size_t min_address, size_t block_size)
+{
+    assert(it);
+    assert(fw);
+    assert(block_size);
+
+    it->fw = fw;
+    it->index = get_index(fw, &it->tmp_index);
+
+    it->block_size = block_size;
+    it->min_address = min_address;
+    it->address = min_address;
+}
+
+bool ty_firmware_blocks_next(ty_firmware_block_iterator *it, size_t *raddress, size_t *rlen)
+{
+    assert(it);
+    assert(raddress);
+    assert(rlen);
+
+    const ty_firmware *fw = it->fw;
+    const ty_firmware_index *index = it->index;
+    unsigned int segments[TY_FIRMWARE_MAX_SEGMENTS];
+    unsigned int count;
+    size_t start = SIZE_MAX;
+    size_t block_address, block_end, covered;
+    size_t len = 0;
+
+    // Jump straight to the first segment that ends after the current address
+    for (unsigned int i = find_index_position(index, it->address); i < index->count; i++) {
+        const ty_firmware_segment *segment = &fw->segments[index->order[i]];
+
+        if (segment->size && segment->address + segment->size > it->address) {
+            start = _HS_MAX(segment->address, it->address);
+            break;
+        }
+    }
+    if (start == SIZE_MAX)
+        return false;
+
+    block_address = it->min_address + (start - it->min_address) / it->block_size * it->block_size;
+    block_end = block_address + it->block_size;
+
+    // Segments come in address order, so merging them is enough to ignore overlaps
+    count = find_overlapping_segments(fw, index, start, block_end, segments);
+    covered = start;
+    for (unsigned int i = 0; i < count; i++) {
+        const ty_firmware_segment *segment = &fw->segments[segments[i]];
+        size_t segment_start = _HS_MAX(segment->address, covered);
+        size_t segment_end = _HS_MIN(segment->address + segment->size, block_end);
+
+        if (segment_end > segment_start) {
+            len += segment_end - segment_start;
+            covered = segment_end;
+        }
+    }
+    it->address = block_end;
+
+    *raddress = block_address;
+    *rlen = len;
+    return true;
+}
+
 int ty_firmware_add_segment(ty_firmware *fw, uint32_t address, size_t size,
                             ty_firmware_segment **rsegment)
 {
@@ -304,6 +737,7 @@ int ty_firmware_add_segment(ty_firmware *fw, uint32_t address, size_t size,
 
     segment = &fw->segments[fw->segments_count];
     segment->address = address;
+    fw->finalized = false;
 
     r = ty_firmware_expand_segment(fw, segment, size);
     if (r < 0)
@@ -316,26 +750,69 @@ int ty_firmware_add_segment(ty_firmware *fw, uint32_t address, size_t size,
     return 0;
 }
 
+int ty_firmware_add_mapped_segment(ty_firmware *fw, uint32_t address, const uint8_t *data,
+                                   size_t size, ty_firmware_segment **rsegment)
+{
+    assert(fw);
+    assert(fw->map_addr);
+    assert(data >= (const uint8_t *)fw->map_addr &&
+           data + size <= (const uint8_t *)fw->map_addr + fw->map_size);
+
+    ty_firmware_segment *segment;
+
+    if (fw->segments_count >= TY_FIRMWARE_MAX_SEGMENTS)
+        return ty_error(TY_ERROR_RANGE, "Firmware '%s' has too many segments", fw->filename);
+    if (size > TY_FIRMWARE_MAX_SEGMENT_SIZE)
+        return ty_error(TY_ERROR_RANGE, "Firmware '%s' has excessive segment size (max %u bytes)",
+                        fw->filename, TY_FIRMWARE_MAX_SEGMENT_SIZE);
+
+    segment = &fw->segments[fw->segments_count++];
+    segment->address = address;
+    fw->finalized = false;
+    // Read-only, ty_firmware_expand_segment() copies the data before anything can change it
+    segment->data = (uint8_t *)data;
+    segment->size = size;
+    segment->alloc_size = 0;
+
+    if (rsegment)
+        *rsegment = segment;
+    return 0;
+}
+
 int ty_firmware_expand_segment(ty_firmware *fw, ty_firmware_segment *segment, size_t size)
 {
     const size_t step_size = 65536;
 
     if (size > segment->alloc_size) {
         uint8_t *tmp;
-        size_t alloc_size;
+        size_t valid_size, alloc_size;
 
         if (size > TY_FIRMWARE_MAX_SEGMENT_SIZE)
             return ty_error(TY_ERROR_RANGE, "Firmware '%s' has excessive segment size (max %u bytes)",
                             fw->filename, TY_FIRMWARE_MAX_SEGMENT_SIZE);
 
         alloc_size = (size + (step_size - 1)) / step_size * step_size;
-        tmp = realloc(segment->data, alloc_size);
+        if (segment->alloc_size || !segment->data) {
+            valid_size = segment->alloc_size;
+            tmp = realloc(segment->data, alloc_size);
+        } else {
+            // Mapped segment, copy it out of the file mapping before we grow it
+            valid_size = segment->size;
+            tmp = malloc(alloc_size);
+            if (tmp)
+                memcpy(tmp, segment->data, segment->size);
+        }
         if (!tmp)
             return ty_error(TY_ERROR_MEMORY, NULL);
 
+        // Gaps between IHEX records must not end up with random heap garbage
+        memset(tmp + valid_size, 0, alloc_size - valid_size);
+
         segment->data = tmp;
         segment->alloc_size = alloc_size;
     }
+    if (size != segment->size)
+        fw->finalized = false;
     segment->size = size;
 
     return 0;
@@ -348,23 +825,12 @@ unsigned int ty_firmware_identify(const ty_firmware *fw, ty_model *rmodels,
     assert(rmodels);
     assert(max_models);
 
-    unsigned int guesses_count = 0;
+    // Firmwares assembled by hand segment by segment don't get the memoized models
+    if (!fw->finalized)
+        return identify_models(fw, rmodels, max_models);
 
-    for (unsigned int i = 0; i < _ty_classes_count; i++) {
-        ty_model partial_guesses[16];
-        unsigned int partial_count;
-
-        if (!_ty_classes[i].vtable->identify_models)
-            continue;
-
-        partial_count = (*_ty_classes[i].vtable->identify_models)(fw, partial_guesses,
-                                                                  _HS_COUNTOF(partial_guesses));
+    unsigned int count = _HS_MIN(fw->models_count, max_models);
+    memcpy(rmodels, fw->models, count * sizeof(*rmodels));
 
-        for (unsigned int j = 0; j < partial_count; j++) {
-            if (rmodels && guesses_count < max_models)
-                rmodels[guesses_count++] = partial_guesses[j];
-        }
-    }
-
-    return guesses_count;
+    return count;
 }
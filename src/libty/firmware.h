@@ -18,14 +18,24 @@ _HS_BEGIN_C
 
 #define TY_FIRMWARE_MAX_SEGMENTS 16
 #define TY_FIRMWARE_MAX_SEGMENT_SIZE (2 * 1024 * 1024)
+#define TY_FIRMWARE_MAX_MODELS 16
 
 typedef struct ty_firmware_segment {
     uint8_t *data;
     size_t size;
+    // Zero when data points inside the read-only file mapping, expand before writing
     size_t alloc_size;
     uint32_t address;
 } ty_firmware_segment;
 
+typedef struct ty_firmware_index {
+    unsigned int count;
+    // Segment indexes sorted by address, and the highest segment end up to each of them
+    unsigned int order[TY_FIRMWARE_MAX_SEGMENTS];
+    size_t max_ends[TY_FIRMWARE_MAX_SEGMENTS];
+    bool overlapping;
+} ty_firmware_index;
+
 typedef struct ty_firmware {
     unsigned int refcount;
 
@@ -37,6 +47,17 @@ typedef struct ty_firmware {
 
     size_t max_address;
     size_t total_size;
+
+    /* Filled once loading is over, so that ty_firmware_identify() and the segment lookups
+       don't redo the same work for every board and block. Changing the segments
+       invalidates both. */
+    bool finalized;
+    ty_model models[TY_FIRMWARE_MAX_MODELS];
+    unsigned int models_count;
+    ty_firmware_index index;
+
+    void *map_addr;
+    size_t map_size;
 } ty_firmware;
 
 typedef struct ty_firmware_format {
@@ -44,8 +65,32 @@ typedef struct ty_firmware_format {
     const char *ext;
 
     int (*load)(ty_firmware *fw, const uint8_t *mem, size_t len);
+
+    /* Optional, for formats that can be parsed while the data is still coming in. The stream
+       state is allocated by the first call to feed() and must be released with free(). */
+    int (*feed)(ty_firmware *fw, void **rstream, const uint8_t *mem, size_t len);
+    int (*finish)(ty_firmware *fw, void *stream);
 } ty_firmware_format;
 
+typedef struct ty_firmware_block_iterator {
+    const ty_firmware *fw;
+    const ty_firmware_index *index;
+    // Used for firmwares that are not finalized
+    ty_firmware_index tmp_index;
+
+    size_t block_size;
+    size_t min_address;
+    size_t address;
+} ty_firmware_block_iterator;
+
+typedef struct ty_firmware_parser ty_firmware_parser;
+typedef struct ty_firmware_cache ty_firmware_cache;
+
+enum {
+    // Hash the file content to detect changes that keep the same size and mtime
+    TY_FIRMWARE_CACHE_CHECK_CONTENT = 1
+};
+
 extern const ty_firmware_format ty_firmware_formats[];
 extern const unsigned int ty_firmware_formats_count;
 
@@ -55,8 +100,33 @@ int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_nam
 int ty_firmware_load_mem(const char *filename, const uint8_t *mem, size_t len,
                          const char *format_name, ty_firmware **rfw);
 
+int ty_firmware_parser_new(const char *filename, const char *format_name,
+                           ty_firmware_parser **rparser);
+void ty_firmware_parser_free(ty_firmware_parser *parser);
+// Once feed() has failed, the only thing left to do is to free the parser
+int ty_firmware_parser_feed(ty_firmware_parser *parser, const uint8_t *mem, size_t len);
+int ty_firmware_parser_finish(ty_firmware_parser *parser, ty_firmware **rfw);
+
 int ty_firmware_load_elf(ty_firmware *fw, const uint8_t *mem, size_t len);
 int ty_firmware_load_ihex(ty_firmware *fw, const uint8_t *mem, size_t len);
+int ty_firmware_feed_ihex(ty_firmware *fw, void **rstream, const uint8_t *mem, size_t len);
+int ty_firmware_finish_ihex(ty_firmware *fw, void *stream);
+// Copy segments out of the file mapping, ty_upload() does it before the firmware reaches a task
+int _ty_firmware_detach_mapping(ty_firmware *fw);
+// Simpler (and much slower) IHEX parser, kept around to test the real one
+int _ty_firmware_load_ihex_reference(ty_firmware *fw, const uint8_t *mem, size_t len);
+
+int ty_firmware_cache_new(size_t max_size, int flags, ty_firmware_cache **rcache);
+void ty_firmware_cache_free(ty_firmware_cache *cache);
+int ty_firmware_cache_get_default(ty_firmware_cache **rcache);
+
+void ty_firmware_cache_set_max_size(ty_firmware_cache *cache, size_t max_size);
+void ty_firmware_cache_set_flags(ty_firmware_cache *cache, int flags);
+void ty_firmware_cache_clear(ty_firmware_cache *cache);
+
+// Cached firmwares are shared, don't modify them
+int ty_firmware_cache_load(ty_firmware_cache *cache, const char *filename,
+                           const char *format_name, ty_firmware **rfw);
 
 ty_firmware *ty_firmware_ref(ty_firmware *fw);
 void ty_firmware_unref(ty_firmware *fw);
@@ -64,8 +134,17 @@ void ty_firmware_unref(ty_firmware *fw);
 const ty_firmware_segment *ty_firmware_find_segment(const ty_firmware *fw, uint32_t address);
 size_t ty_firmware_extract(const ty_firmware *fw, uint32_t address, uint8_t *buf, size_t size);
 
+/* Blocks are aligned on block_size (relative to min_address), blocks that contain no
+   firmware byte are skipped. next() gives the block address and the number of firmware
+   bytes in it. */
+void ty_firmware_blocks_init(ty_firmware_block_iterator *it, const ty_firmware *fw,
+                             size_t min_address, size_t block_size);
+bool ty_firmware_blocks_next(ty_firmware_block_iterator *it, size_t *raddress, size_t *rlen);
+
 int ty_firmware_add_segment(ty_firmware *fw, uint32_t address, size_t size,
                             ty_firmware_segment **rsegment);
+int ty_firmware_add_mapped_segment(ty_firmware *fw, uint32_t address, const uint8_t *data,
+                                   size_t size, ty_firmware_segment **rsegment);
 int ty_firmware_expand_segment(ty_firmware *fw, ty_firmware_segment *segment, size_t size);
 
 
@@ -0,0 +1,313 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common.h"
+#include "../libhs/array.h"
+#include "firmware.h"
+#include "system.h"
+#include "thread.h"
+
+struct cache_entry {
+    char *filename;
+    char *format_name;
+
+    ty_file_info info;
+    uint64_t hash;
+
+    ty_firmware *fw;
+    size_t mem_size;
+    uint64_t last_use;
+};
+
+struct ty_firmware_cache {
+    ty_mutex mutex;
+
+    size_t max_size;
+    int flags;
+
+    _HS_ARRAY(struct cache_entry) entries;
+    size_t total_size;
+    uint64_t clock;
+};
+
+#define DEFAULT_MAX_SIZE (64 * 1024 * 1024)
+
+static ty_firmware_cache *default_cache;
+
+int ty_firmware_cache_new(size_t max_size, int flags, ty_firmware_cache **rcache)
+{
+    assert(rcache);
+
+    ty_firmware_cache *cache;
+    int r;
+
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    cache->max_size = max_size;
+    cache->flags = flags;
+
+    r = ty_mutex_init(&cache->mutex);
+    if (r < 0) {
+        free(cache);
+        return r;
+    }
+
+    *rcache = cache;
+    return 0;
+}
+
+void ty_firmware_cache_free(ty_firmware_cache *cache)
+{
+    if (cache) {
+        ty_firmware_cache_clear(cache);
+        _hs_array_release(&cache->entries);
+        ty_mutex_release(&cache->mutex);
+    }
+
+    free(cache);
+}
+
+static void cleanup_default_cache(void)
+{
+    ty_firmware_cache_free(default_cache);
+}
+
+int ty_firmware_cache_get_default(ty_firmware_cache **rcache)
+{
+    assert(rcache);
+
+    if (!default_cache) {
+        int r = ty_firmware_cache_new(DEFAULT_MAX_SIZE, 0, &default_cache);
+        if (r < 0)
+            return r;
+
+        atexit(cleanup_default_cache);
+    }
+
+    *rcache = default_cache;
+    return 0;
+}
+
+static void drop_entry(ty_firmware_cache *cache, size_t idx)
+{
+    struct cache_entry *entry = &cache->entries.values[idx];
+
+    cache->total_size -= entry->mem_size;
+    ty_firmware_unref(entry->fw);
+    free(entry->format_name);
+    free(entry->filename);
+
+    _hs_array_remove(&cache->entries, idx, 1);
+}
+
+void ty_firmware_cache_set_max_size(ty_firmware_cache *cache, size_t max_size)
+{
+    assert(cache);
+
+    ty_mutex_lock(&cache->mutex);
+    cache->max_size = max_size;
+    ty_mutex_unlock(&cache->mutex);
+}
+
+void ty_firmware_cache_set_flags(ty_firmware_cache *cache, int flags)
+{
+    assert(cache);
+
+    ty_mutex_lock(&cache->mutex);
+    cache->flags = flags;
+    ty_mutex_unlock(&cache->mutex);
+}
+
+void ty_firmware_cache_clear(ty_firmware_cache *cache)
+{
+    assert(cache);
+
+    ty_mutex_lock(&cache->mutex);
+    while (cache->entries.count)
+        drop_entry(cache, cache->entries.count - 1);
+    ty_mutex_unlock(&cache->mutex);
+}
+
+static int hash_file(const char *filename, uint64_t *rhash)
+{
+    FILE *fp;
+    uint8_t buf[65536];
+    uint64_t hash = 0;
+    size_t len;
+    int r;
+
+#ifdef _WIN32
+    fp = fopen(filename, "rb");
+#else
+    fp = fopen(filename, "rbe");
+#endif
+    if (!fp)
+        return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename, strerror(errno));
+
+    // Word by word, hashing every byte on its own would cost about as much as parsing
+    do {
+        len = fread(buf, 1, sizeof(buf), fp);
+        if (ferror(fp)) {
+            r = ty_error(TY_ERROR_IO, "I/O error while reading from '%s'", filename);
+            goto cleanup;
+        }
+
+        size_t i;
+        for (i = 0; i + 8 <= len; i += 8) {
+            uint64_t word;
+
+            memcpy(&word, buf + i, 8);
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+            hash ^= hash >> 29;
+        }
+        if (i < len) {
+            uint64_t word = len - i;
+
+            memcpy(&word, buf + i, len - i);
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+            hash ^= hash >> 29;
+        }
+    } while (len == sizeof(buf));
+
+    *rhash = hash;
+    r = 0;
+cleanup:
+    fclose(fp);
+    return r;
+}
+
+static size_t get_firmware_mem_size(const ty_firmware *fw)
+{
+    size_t size = fw->map_size;
+    for (unsigned int i = 0; i < fw->segments_count; i++)
+        size += fw->segments[i].alloc_size;
+
+    return size;
+}
+
+static bool compare_format_names(const char *name1, const char *name2)
+{
+    if (!name1 || !name2)
+        return name1 == name2;
+    return strcasecmp(name1, name2) == 0;
+}
+
+int ty_firmware_cache_load(ty_firmware_cache *cache, const char *filename,
+                           const char *format_name, ty_firmware **rfw)
+{
+    assert(cache);
+    assert(filename);
+    assert(rfw);
+
+    ty_file_info info;
+    uint64_t hash = 0;
+    struct cache_entry *entry = NULL;
+    ty_firmware *fw = NULL;
+    int r;
+
+    r = ty_stat_file(filename, &info);
+    if (r < 0)
+        return r;
+
+    /* The lock is held while loading, so that concurrent loads of the same file
+       wait for the first one instead of parsing it again. */
+    ty_mutex_lock(&cache->mutex);
+
+    if (cache->flags & TY_FIRMWARE_CACHE_CHECK_CONTENT) {
+        r = hash_file(filename, &hash);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    for (size_t i = 0; i < cache->entries.count; i++) {
+        struct cache_entry *entry_it = &cache->entries.values[i];
+
+        if (strcmp(entry_it->filename, filename) ||
+                !compare_format_names(entry_it->format_name, format_name))
+            continue;
+
+        if (entry_it->info.size == info.size && entry_it->info.mtime == info.mtime &&
+                entry_it->hash == hash) {
+            entry = entry_it;
+        } else {
+            drop_entry(cache, i);
+        }
+        break;
+    }
+
+    if (!entry) {
+        struct cache_entry new_entry = {0};
+
+        r = ty_firmware_load_file(filename, NULL, format_name, &fw);
+        if (r < 0)
+            goto cleanup;
+
+        // The file may be rewritten in place while we hold on to the firmware
+        r = _ty_firmware_detach_mapping(fw);
+        if (r < 0)
+            goto cleanup;
+
+        new_entry.mem_size = get_firmware_mem_size(fw);
+        if (new_entry.mem_size > cache->max_size) {
+            *rfw = fw;
+            fw = NULL;
+            goto cleanup;
+        }
+
+        new_entry.filename = strdup(filename);
+        if (!new_entry.filename) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+        if (format_name) {
+            new_entry.format_name = strdup(format_name);
+            if (!new_entry.format_name) {
+                free(new_entry.filename);
+                r = ty_error(TY_ERROR_MEMORY, NULL);
+                goto cleanup;
+            }
+        }
+        new_entry.info = info;
+        new_entry.hash = hash;
+        new_entry.fw = fw;
+
+        r = _hs_array_push(&cache->entries, new_entry);
+        if (r < 0) {
+            free(new_entry.format_name);
+            free(new_entry.filename);
+            r = ty_libhs_translate_error(r);
+            goto cleanup;
+        }
+        fw = NULL;
+
+        entry = &cache->entries.values[cache->entries.count - 1];
+        cache->total_size += entry->mem_size;
+    }
+    entry->last_use = ++cache->clock;
+
+    *rfw = ty_firmware_ref(entry->fw);
+
+    // Evict the least recently used firmwares, users keep their own references
+    while (cache->total_size > cache->max_size) {
+        size_t lru = 0;
+        for (size_t i = 1; i < cache->entries.count; i++) {
+            if (cache->entries.values[i].last_use < cache->entries.values[lru].last_use)
+                lru = i;
+        }
+        drop_entry(cache, lru);
+    }
+
+    r = 0;
+cleanup:
+    ty_mutex_unlock(&cache->mutex);
+    ty_firmware_unref(fw);
+    return r;
+}
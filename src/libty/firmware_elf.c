@@ -86,12 +86,23 @@ static inline void reverse_uint32(uint32_t *u)
             | ((*u & 0xFF0000) >> 8) | ((*u & 0xFF000000) >> 24);
 }
 
-static int read_chunk(struct loader_context *ctx, off_t offset, size_t size, void *buf)
+static int check_chunk(struct loader_context *ctx, off_t offset, size_t size)
 {
-    if (offset < 0 || (size_t)offset > ctx->len - size)
+    if (offset < 0 || size > ctx->len || (size_t)offset > ctx->len - size)
         return ty_error(TY_ERROR_PARSE, "ELF file '%s' is malformed or truncated",
                         ctx->fw->filename);
 
+    return 0;
+}
+
+static int read_chunk(struct loader_context *ctx, off_t offset, size_t size, void *buf)
+{
+    int r;
+
+    r = check_chunk(ctx, offset, size);
+    if (r < 0)
+        return r;
+
     memcpy(buf, ctx->mem + offset, size);
     return 0;
 }
@@ -131,12 +142,23 @@ static int load_segment(struct loader_context *ctx, unsigned int i)
     if (phdr.p_type != PT_LOAD || !phdr.p_filesz)
         return 0;
 
-    r = ty_firmware_add_segment(ctx->fw, phdr.p_paddr, phdr.p_filesz, &segment);
-    if (r < 0)
-        return r;
-    r = read_chunk(ctx, phdr.p_offset, phdr.p_filesz, segment->data);
-    if (r < 0)
-        return r;
+    // Reference the file mapping directly when we have one, no need to copy anything
+    if (ctx->fw->map_addr && ctx->mem == ctx->fw->map_addr) {
+        r = check_chunk(ctx, phdr.p_offset, phdr.p_filesz);
+        if (r < 0)
+            return r;
+        r = ty_firmware_add_mapped_segment(ctx->fw, phdr.p_paddr, ctx->mem + phdr.p_offset,
+                                           phdr.p_filesz, NULL);
+        if (r < 0)
+            return r;
+    } else {
+        r = ty_firmware_add_segment(ctx->fw, phdr.p_paddr, phdr.p_filesz, &segment);
+        if (r < 0)
+            return r;
+        r = read_chunk(ctx, phdr.p_offset, phdr.p_filesz, segment->data);
+        if (r < 0)
+            return r;
+    }
 
     return 1;
 }
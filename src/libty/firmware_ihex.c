@@ -9,6 +9,10 @@
    See the LICENSE file for more details. */
 
 #include "common.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define HAVE_SSE2
+#endif
 #include "firmware.h"
 
 struct parser_context {
@@ -63,7 +67,16 @@ static int ihex_parse_error(struct parser_context *ctx)
                     ctx->fw->filename);
 }
 
-static int parse_line(struct parser_context *ctx, const char *line, size_t line_len)
+static void update_firmware_sizes(ty_firmware *fw)
+{
+    for (unsigned int i = 0; i < fw->segments_count; i++) {
+        const ty_firmware_segment *segment = &fw->segments[i];
+        fw->total_size += segment->size;
+        fw->max_address = _HS_MAX(fw->max_address, segment->address + segment->size);
+    }
+}
+
+static int parse_line_reference(struct parser_context *ctx, const char *line, size_t line_len)
 {
     unsigned int data_len, type;
     uint32_t address;
@@ -150,7 +163,7 @@ static int parse_line(struct parser_context *ctx, const char *line, size_t line_
     return (type == 1);
 }
 
-int ty_firmware_load_ihex(ty_firmware *fw, const uint8_t *mem, size_t len)
+int _ty_firmware_load_ihex_reference(ty_firmware *fw, const uint8_t *mem, size_t len)
 {
     assert(fw);
     assert(!fw->segments_count && !fw->total_size);
@@ -177,16 +190,340 @@ int ty_firmware_load_ihex(ty_firmware *fw, const uint8_t *mem, size_t len)
         ctx.line++;
 
         // Returns 1 when EOF record is detected
-        r = parse_line(&ctx, (const char *)mem + start, end - start);
+        r = parse_line_reference(&ctx, (const char *)mem + start, end - start);
         if (r < 0)
             return r;
     } while (!r);
 
-    for (unsigned int i = 0; i < fw->segments_count; i++) {
-        const ty_firmware_segment *segment = &fw->segments[i];
-        fw->total_size += segment->size;
-        fw->max_address = _HS_MAX(fw->max_address, segment->address + segment->size);
+    update_firmware_sizes(fw);
+    return 0;
+}
+
+/* Valid hexadecimal digits have bit 4 set, so that a zero (the default value)
+   means invalid character. */
+static const uint8_t hex_digits[256] = {
+    ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+    ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+    ['A'] = 0x1A, ['B'] = 0x1B, ['C'] = 0x1C, ['D'] = 0x1D, ['E'] = 0x1E, ['F'] = 0x1F,
+    ['a'] = 0x1A, ['b'] = 0x1B, ['c'] = 0x1C, ['d'] = 0x1D, ['e'] = 0x1E, ['f'] = 0x1F
+};
+
+#ifdef HAVE_SSE2
+
+// Decode 32 hexadecimal characters to 16 bytes, and add them to the checksum
+static inline bool decode_hex_block(const char *src, uint8_t *dest, __m128i *sum)
+{
+    const __m128i zero_char = _mm_set1_epi8('0');
+    const __m128i a_char = _mm_set1_epi8('a');
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i five = _mm_set1_epi8(5);
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i low_byte = _mm_set1_epi16(0xFF);
+
+    __m128i values[2];
+    int valid = 0xFFFF;
+
+    for (unsigned int i = 0; i < 2; i++) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i * 16));
+        __m128i digits, alphas, digits_mask, alphas_mask, nibbles;
+
+        /* There is no unsigned comparison in SSE2, but x <= max (unsigned) if and
+           only if min(x, max) == x. Out-of-range characters wrap around to big values. */
+        digits = _mm_sub_epi8(c, zero_char);
+        digits_mask = _mm_cmpeq_epi8(_mm_min_epu8(digits, nine), digits);
+        alphas = _mm_sub_epi8(_mm_or_si128(c, lower), a_char);
+        alphas_mask = _mm_cmpeq_epi8(_mm_min_epu8(alphas, five), alphas);
+        valid &= _mm_movemask_epi8(_mm_or_si128(digits_mask, alphas_mask));
+
+        nibbles = _mm_or_si128(_mm_and_si128(digits, digits_mask),
+                               _mm_and_si128(_mm_add_epi8(alphas, ten), alphas_mask));
+
+        // Each 16-bit lane contains two nibbles, high nibble first (in the low byte)
+        values[i] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, low_byte), 4),
+                                 _mm_srli_epi16(nibbles, 8));
     }
+    if (valid != 0xFFFF)
+        return false;
+
+    __m128i bytes = _mm_packus_epi16(values[0], values[1]);
+    _mm_storeu_si128((__m128i *)dest, bytes);
+    *sum = _mm_add_epi64(*sum, _mm_sad_epu8(bytes, _mm_setzero_si128()));
+
+    return true;
+}
 
+#endif
+
+static bool decode_hex(const char *src, size_t size, uint8_t *dest, uint8_t *rsum)
+{
+    unsigned int sum = *rsum;
+    size_t i = 0;
+
+#ifdef HAVE_SSE2
+    if (size >= 16) {
+        __m128i block_sum = _mm_setzero_si128();
+
+        for (; i + 16 <= size; i += 16) {
+            if (!decode_hex_block(src + i * 2, dest + i, &block_sum))
+                return false;
+        }
+
+        sum += (unsigned int)_mm_cvtsi128_si32(block_sum) +
+               (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(block_sum, 8));
+    }
+#endif
+
+    for (; i < size; i++) {
+        uint8_t high = hex_digits[(uint8_t)src[i * 2]];
+        uint8_t low = hex_digits[(uint8_t)src[i * 2 + 1]];
+
+        if (!(high & low & 0x10))
+            return false;
+
+        dest[i] = (uint8_t)(((high & 0xF) << 4) | (low & 0xF));
+        sum += dest[i];
+    }
+
+    *rsum = (uint8_t)sum;
+    return true;
+}
+
+static int parse_record(struct parser_context *ctx, const char *line, size_t line_len)
+{
+    uint8_t header[4];
+    unsigned int data_len, type;
+    uint32_t address;
+    uint8_t sum = 0;
+    uint8_t buf[4];
+    uint8_t checksum;
+    int r;
+
+    if (line_len < 11 || line[0] != ':')
+        return ihex_parse_error(ctx);
+    if (!decode_hex(line + 1, sizeof(header), header, &sum))
+        return ihex_parse_error(ctx);
+    data_len = header[0];
+    if (11 + 2 * data_len != line_len)
+        return ihex_parse_error(ctx);
+    address = ((uint32_t)header[1] << 8) | header[2];
+    type = header[3];
+
+    line += 9;
+    switch (type) {
+        case 0: { // data record
+            address += ctx->offset1 + ctx->offset2;
+
+            r = ty_firmware_expand_segment(ctx->fw, ctx->segment, address + data_len);
+            if (r < 0)
+                return r;
+
+            // Decode directly into the segment, the checksum is tested below
+            if (!decode_hex(line, data_len, ctx->segment->data + address, &sum))
+                return ihex_parse_error(ctx);
+        } break;
+
+        case 1: { // EOF record
+            if (data_len)
+                return ihex_parse_error(ctx);
+        } break;
+
+        case 2: { // extended segment address record
+            if (data_len != 2)
+                return ihex_parse_error(ctx);
+            if (!decode_hex(line, 2, buf, &sum))
+                return ihex_parse_error(ctx);
+
+            ctx->offset2 = (((uint32_t)buf[0] << 8) | buf[1]) << 4;
+        } break;
+
+        case 4: { // extended linear address record
+            if (data_len != 2)
+                return ihex_parse_error(ctx);
+            if (!decode_hex(line, 2, buf, &sum))
+                return ihex_parse_error(ctx);
+
+            address = (((uint32_t)buf[0] << 8) | buf[1]) << 16;
+
+            if (address + 65536 > ctx->segment->address + TY_FIRMWARE_MAX_SEGMENT_SIZE) {
+                r = ty_firmware_add_segment(ctx->fw, address, 0, &ctx->segment);
+                if (r < 0)
+                    return r;
+
+                ctx->offset1 = 0;
+            } else {
+                ctx->offset1 = address - ctx->segment->address;
+            }
+        } break;
+
+        case 3:   // start segment address record
+        case 5: { // start linear address record
+            if (data_len != 4)
+                return ihex_parse_error(ctx);
+            if (!decode_hex(line, 4, buf, &sum))
+                return ihex_parse_error(ctx);
+        } break;
+
+        default: {
+            return ihex_parse_error(ctx);
+        } break;
+    }
+
+    line += 2 * data_len;
+    if (!decode_hex(line, 1, &checksum, &sum))
+        return ihex_parse_error(ctx);
+    if (sum)
+        return ihex_parse_error(ctx);
+
+    // Return 1 for EOF records, to end the parsing
+    return (type == 1);
+}
+
+// Longest valid record: colon, 255 data bytes and 5 header/checksum bytes
+#define MAX_RECORD_LEN (11 + 2 * 255)
+
+struct ihex_stream {
+    struct parser_context ctx;
+    bool started;
+    bool done;
+
+    // Incomplete line left over by the previous chunk
+    char line[MAX_RECORD_LEN];
+    size_t line_len;
+};
+
+static int feed_stream(struct ihex_stream *stream, ty_firmware *fw, const uint8_t *mem,
+                       size_t len)
+{
+    int r;
+
+    if (!stream->started) {
+        assert(!fw->segments_count && !fw->total_size);
+
+        stream->ctx.fw = fw;
+        r = ty_firmware_add_segment(fw, 0, 0, &stream->ctx.segment);
+        if (r < 0)
+            return r;
+        stream->started = true;
+    }
+    // Ignore everything after the EOF record, like ty_firmware_load_ihex() does
+    if (stream->done)
+        return 0;
+
+    size_t start, end = 0;
+    while (end < len) {
+        start = end;
+        if (!stream->line_len) {
+            while (start < len && (mem[start] == '\r' || mem[start] == '\n'))
+                start++;
+            if (start >= len)
+                break;
+        }
+
+        /* The record length gives us the end of line, so we don't need to search for it.
+           If there is junk after the record, the line length test in parse_record() will
+           catch it because we scan for the actual end in this case. */
+        end = start;
+        if (!stream->line_len && len - start >= 3 && hex_digits[mem[start + 1]] &&
+                hex_digits[mem[start + 2]]) {
+            size_t record_len = 11 + 2 * (size_t)(((hex_digits[mem[start + 1]] & 0xF) << 4) |
+                                                  (hex_digits[mem[start + 2]] & 0xF));
+            if (record_len <= len - start)
+                end = start + record_len;
+        }
+        while (end < len && mem[end] != '\r' && mem[end] != '\n')
+            end++;
+
+        // Anything longer than a valid record cannot be one, no need to keep it around
+        if (end - start > sizeof(stream->line) - stream->line_len) {
+            stream->ctx.line++;
+            return ihex_parse_error(&stream->ctx);
+        }
+        if (end == len) {
+            memcpy(stream->line + stream->line_len, mem + start, end - start);
+            stream->line_len += end - start;
+            break;
+        }
+        stream->ctx.line++;
+
+        // Returns 1 when EOF record is detected
+        if (stream->line_len) {
+            memcpy(stream->line + stream->line_len, mem + start, end - start);
+            r = parse_record(&stream->ctx, stream->line, stream->line_len + end - start);
+            stream->line_len = 0;
+        } else {
+            r = parse_record(&stream->ctx, (const char *)mem + start, end - start);
+        }
+        if (r < 0)
+            return r;
+        if (r) {
+            stream->done = true;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int finish_stream(struct ihex_stream *stream, ty_firmware *fw)
+{
+    int r;
+
+    if (!stream->started) {
+        r = feed_stream(stream, fw, NULL, 0);
+        if (r < 0)
+            return r;
+    }
+
+    // The last record does not need a line ending
+    if (!stream->done && stream->line_len) {
+        stream->ctx.line++;
+        r = parse_record(&stream->ctx, stream->line, stream->line_len);
+        if (r < 0)
+            return r;
+        stream->done = r;
+    }
+    if (!stream->done)
+        return ty_error(TY_ERROR_PARSE, "Missing EOF record in '%s' (IHEX)", fw->filename);
+
+    update_firmware_sizes(fw);
     return 0;
 }
+
+int ty_firmware_load_ihex(ty_firmware *fw, const uint8_t *mem, size_t len)
+{
+    assert(fw);
+    assert(mem || !len);
+
+    struct ihex_stream stream = {0};
+    int r;
+
+    r = feed_stream(&stream, fw, mem, len);
+    if (r < 0)
+        return r;
+
+    return finish_stream(&stream, fw);
+}
+
+int ty_firmware_feed_ihex(ty_firmware *fw, void **rstream, const uint8_t *mem, size_t len)
+{
+    assert(fw);
+    assert(rstream);
+    assert(mem || !len);
+
+    if (!*rstream) {
+        *rstream = calloc(1, sizeof(struct ihex_stream));
+        if (!*rstream)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+
+    return feed_stream(*rstream, fw, mem, len);
+}
+
+int ty_firmware_finish_ihex(ty_firmware *fw, void *stream)
+{
+    assert(fw);
+    assert(stream);
+
+    return finish_stream(stream, fw);
+}
@@ -18,10 +18,17 @@
 #include "system.h"
 #include "timer.h"
 
-struct callback {
-    int id;
-    ty_monitor_callback_func *f;
-    void *udata;
+struct snapshot_board {
+    ty_board *board;
+    int capabilities;
+};
+
+struct ty_monitor_snapshot {
+    unsigned int refcount;
+    uint64_t version;
+
+    size_t boards_count;
+    struct snapshot_board boards[];
 };
 
 struct ty_monitor {
@@ -32,7 +39,7 @@ struct ty_monitor {
     ty_timer *timer;
     bool timer_running;
 
-    _HS_ARRAY(struct callback) callbacks;
+    _ty_monitor_callback_array callbacks;
     int current_callback_id;
 
     ty_mutex refresh_mutex;
@@ -42,11 +49,174 @@ struct ty_monitor {
     _HS_ARRAY(ty_board *) boards;
     _hs_htable ifaces;
 
+    /* Immutable copy of the online boards for other threads, replaced after each refresh
+       that changed something. The mutex only protects the pointer swap. */
+    ty_mutex snapshot_mutex;
+    ty_monitor_snapshot *snapshot;
+    bool snapshot_dirty;
+    // Boards by USB location, by serial number (from the id) and by custom tag
+    _hs_htable boards_by_location;
+    _hs_htable boards_by_serial;
+    _hs_htable boards_by_tag;
+
     ty_thread_id main_thread_id;
+    // Created by the first ty_monitor_wait() call in the main thread
+    ty_event_set *wait_set;
+    // See ty_monitor_set_interrupt_descriptor(), the flag is protected by the refresh mutex
+    bool has_interrupt_desc;
+    bool interrupted;
 };
 
 #define DROP_BOARD_DELAY 15000
 
+typedef _HS_ARRAY(ty_board *) board_array;
+
+static uint32_t hash_id_part(const struct _ty_board_id_part *part)
+{
+    return _hs_htable_hash_mem(part->ptr, part->len);
+}
+
+static void index_board_keys(ty_monitor *monitor, ty_board *board)
+{
+    struct _ty_board_id_part serial = _ty_board_get_id_serial(board);
+
+    _hs_htable_append(&monitor->boards_by_serial, hash_id_part(&serial), &board->serial_hnode);
+    if (board->tag != board->id)
+        _hs_htable_append(&monitor->boards_by_tag, _hs_htable_hash_str(board->tag),
+                          &board->tag_hnode);
+}
+
+static void unindex_board_keys(ty_board *board)
+{
+    if (board->serial_hnode.next)
+        _hs_htable_remove(&board->monitor->boards_by_serial, &board->serial_hnode);
+    if (board->tag_hnode.next)
+        _hs_htable_remove(&board->monitor->boards_by_tag, &board->tag_hnode);
+}
+
+static void index_board(ty_monitor *monitor, ty_board *board)
+{
+    _hs_htable_append(&monitor->boards_by_location, _hs_htable_hash_str(board->location),
+                      &board->location_hnode);
+    index_board_keys(monitor, board);
+}
+
+static void unindex_board(ty_board *board)
+{
+    if (board->location_hnode.next)
+        _hs_htable_remove(&board->monitor->boards_by_location, &board->location_hnode);
+    unindex_board_keys(board);
+}
+
+void _ty_monitor_reindex_board(ty_board *board)
+{
+    assert(board->monitor);
+
+    unindex_board_keys(board);
+    index_board_keys(board->monitor, board);
+}
+
+static int find_boards_at_location(ty_monitor *monitor, const char *location,
+                                   board_array *rboards)
+{
+    uint32_t key = _hs_htable_hash_str(location);
+
+    _hs_htable_foreach_hash(cur, &monitor->boards_by_location, key) {
+        ty_board *board = _HS_CONTAINER_OF(cur, ty_board, location_hnode);
+
+        if (strcmp(board->location, location) == 0) {
+            int r = _hs_array_push(rboards, board);
+            if (r < 0)
+                return ty_libhs_translate_error(r);
+        }
+    }
+
+    return 0;
+}
+
+static bool match_callback_filter(const struct _ty_monitor_callback *callback,
+                                  ty_monitor_event event, int changed_capabilities)
+{
+    if (callback->events && !(callback->events & (1 << event)))
+        return false;
+    if (callback->capabilities && event != TY_MONITOR_EVENT_DROPPED &&
+            !(callback->capabilities & changed_capabilities))
+        return false;
+
+    return true;
+}
+
+static int notify_callbacks(_ty_monitor_callback_array *callbacks, ty_board *board,
+                            ty_monitor_event event, int changed_capabilities)
+{
+    int r = 0;
+
+    /* Notify callbacks and do some additional stuff as we go:
+       - Drop callback that return r > 0
+       - Stop calling them is one returns r < 0 */
+    size_t remove_count = 0;
+    for (size_t i = 0; i < callbacks->count; i++) {
+        struct _ty_monitor_callback *callback_it = &callbacks->values[i - remove_count];
+        if (remove_count)
+            *callback_it = callbacks->values[i];
+
+        if (!r && match_callback_filter(callback_it, event, changed_capabilities)) {
+            r = (*callback_it->f)(board, event, callback_it->udata);
+            if (r > 0) {
+                remove_count++;
+                r = 0;
+            }
+        }
+    }
+    callbacks->count -= remove_count;
+
+    return r;
+}
+
+static void free_snapshot(ty_monitor_snapshot *snapshot)
+{
+    for (size_t i = 0; i < snapshot->boards_count; i++)
+        ty_board_unref(snapshot->boards[i].board);
+    free(snapshot);
+}
+
+static int publish_snapshot(ty_monitor *monitor)
+{
+    ty_monitor_snapshot *snapshot;
+    ty_monitor_snapshot *old_snapshot;
+
+    if (!monitor->snapshot_dirty)
+        return 0;
+
+    snapshot = calloc(1, sizeof(*snapshot) + monitor->boards.count * sizeof(*snapshot->boards));
+    if (!snapshot)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    snapshot->refcount = 1;
+    snapshot->version = monitor->snapshot ? monitor->snapshot->version + 1 : 1;
+
+    for (size_t i = 0; i < monitor->boards.count; i++) {
+        ty_board *board = monitor->boards.values[i];
+
+        if (board->status == TY_BOARD_STATUS_ONLINE) {
+            struct snapshot_board *entry = &snapshot->boards[snapshot->boards_count++];
+
+            entry->board = ty_board_ref(board);
+            entry->capabilities = board->capabilities;
+        }
+    }
+
+    ty_mutex_lock(&monitor->snapshot_mutex);
+    old_snapshot = monitor->snapshot;
+    monitor->snapshot = snapshot;
+    ty_mutex_unlock(&monitor->snapshot_mutex);
+
+    // Readers keep their own references, the last one frees it
+    ty_monitor_snapshot_unref(old_snapshot);
+    monitor->snapshot_dirty = false;
+
+    return 0;
+}
+
 static int change_board_status(ty_board *board, ty_board_status status, ty_monitor_event event)
 {
     ty_monitor *monitor = board->monitor;
@@ -68,24 +238,27 @@ static int change_board_status(ty_board *board, ty_board_status status, ty_monit
         board->status = status;
     }
 
-    /* Notify callbacks and do some additional stuff as we go:
-       - Drop callback that return r > 0
-       - Stop calling them is one returns r < 0 */
-    size_t remove_count = 0;
-    for (size_t i = 0; i < monitor->callbacks.count; i++) {
-        struct callback *callback_it = &monitor->callbacks.values[i - remove_count];
-        if (remove_count)
-            *callback_it = monitor->callbacks.values[i];
+    int changed_capabilities = board->capabilities ^ board->notified_capabilities;
+    board->notified_capabilities = board->capabilities;
+    monitor->snapshot_dirty = true;
 
-        if (!r) {
-            r = (*callback_it->f)(board, event, callback_it->udata);
-            if (r > 0) {
-                remove_count++;
-                r = 0;
-            }
-        }
+    r = notify_callbacks(&monitor->callbacks, board, event, changed_capabilities);
+    if (!r)
+        r = notify_callbacks(&board->callbacks, board, event, changed_capabilities);
+
+    // Wake up the worker threads waiting on this board, if this change concerns them
+    ty_mutex_lock(&monitor->refresh_mutex);
+    for (size_t i = 0; i < board->waiters.count; i++) {
+        struct _ty_board_waiter *waiter = board->waiters.values[i];
+
+        if (event == TY_MONITOR_EVENT_DROPPED || (changed_capabilities & waiter->capabilities))
+            ty_cond_signal(&waiter->cond);
     }
-    monitor->callbacks.count -= remove_count;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    // Dropped boards won't come back, forget about their callbacks
+    if (event == TY_MONITOR_EVENT_DROPPED)
+        _hs_array_release(&board->callbacks);
 
     return r;
 }
@@ -127,6 +300,7 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
         r = ty_libhs_translate_error(r);
         goto error;
     }
+    index_board(monitor, board);
 
     *rboard = board;
     return 1;
@@ -156,7 +330,7 @@ static int close_board(ty_board *board)
         ty_board_interface *iface_it = ifaces.values[i];
 
         if (iface_it->monitor_hnode.next)
-            _hs_htable_remove(&iface_it->monitor_hnode);
+            _hs_htable_remove(&board->monitor->ifaces, &iface_it->monitor_hnode);
         ty_board_interface_unref(iface_it);
     }
     _hs_array_release(&ifaces);
@@ -172,6 +346,7 @@ static void drop_board(ty_board *board)
     change_board_status(board, TY_BOARD_STATUS_DROPPED, TY_MONITOR_EVENT_DROPPED);
 
     // Remove this board from the monitor list
+    unindex_board(board);
     board->monitor = NULL;
     for (size_t i = 0; i < monitor->boards.count; i++) {
         if (monitor->boards.values[i] == board)
@@ -248,14 +423,19 @@ cleanup:
 
 static int update_or_create_board(ty_monitor *monitor, ty_board_interface *iface)
 {
+    board_array boards = {0};
     bool found = false;
     int r;
 
-    for (size_t i = 0; i < monitor->boards.count; i++) {
-        ty_board *board = monitor->boards.values[i];
+    /* Work on a snapshot of the boards at this location: the loop may drop boards and
+       create new ones, which changes the index buckets. */
+    r = find_boards_at_location(monitor, iface->dev->location, &boards);
+    if (r < 0)
+        goto cleanup;
+
+    for (size_t i = 0; i < boards.count; i++) {
+        ty_board *board = boards.values[i];
 
-        if (strcmp(board->location, iface->dev->location) != 0)
-            continue;
         if (board->match_iface >= 0 && iface->dev->type == HS_DEVICE_TYPE_SERIAL &&
                                        iface->dev->iface_number != board->match_iface)
             continue;
@@ -266,9 +446,10 @@ static int update_or_create_board(ty_monitor *monitor, ty_board_interface *iface
             update_tag_pointer = true;
         r = (*iface->class_vtable->update_board)(iface, board, false);
         if (r < 0)
-            return r;
+            goto cleanup;
         if (update_tag_pointer)
             board->tag = board->id;
+        _ty_monitor_reindex_board(board);
 
         /* The class function update_board() returns 1 if the interface is compatible with
            this board, or 0 if not. In the latter case, the old board is dropped and a new
@@ -286,7 +467,7 @@ static int update_or_create_board(ty_monitor *monitor, ty_board_interface *iface
 
             r = register_board_interface(board, iface);
             if (r < 0)
-                return r;
+                goto cleanup;
 
             change_board_status(board, TY_BOARD_STATUS_ONLINE, TY_MONITOR_EVENT_CHANGED);
         } else {
@@ -297,10 +478,10 @@ static int update_or_create_board(ty_monitor *monitor, ty_board_interface *iface
 
             r = create_board(monitor, iface, &board);
             if (r <= 0)
-                return r;
+                goto cleanup;
             r = register_board_interface(board, iface);
             if (r < 0)
-                return r;
+                goto cleanup;
 
             change_board_status(board, TY_BOARD_STATUS_ONLINE, TY_MONITOR_EVENT_ADDED);
         }
@@ -316,17 +497,20 @@ static int update_or_create_board(ty_monitor *monitor, ty_board_interface *iface
 
         r = create_board(monitor, iface, &board);
         if (r <= 0)
-            return r;
+            goto cleanup;
         r = register_board_interface(board, iface);
         if (r < 0)
-            return r;
+            goto cleanup;
 
         iface->board = board;
 
         change_board_status(board, TY_BOARD_STATUS_ONLINE, TY_MONITOR_EVENT_ADDED);
     }
 
-    return 1;
+    r = 1;
+cleanup:
+    _hs_array_release(&boards);
+    return r;
 }
 
 static int add_interface_for_device(ty_monitor *monitor, hs_device *dev)
@@ -354,6 +538,7 @@ error:
 static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
 {
     ty_board_interface *iface = NULL;
+    board_array boards = {0};
     int r;
 
     // Find interface associated with this device
@@ -368,12 +553,17 @@ static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
     if (!iface)
         return 0;
 
+    // Only boards at the same location can use this interface
+    r = find_boards_at_location(monitor, dev->location, &boards);
+    if (r < 0)
+        return r;
+
     // Unregister from monitor
-    _hs_htable_remove(&iface->monitor_hnode);
+    _hs_htable_remove(&monitor->ifaces, &iface->monitor_hnode);
     ty_board_interface_unref(iface);
 
-    for (size_t i = 0; i < monitor->boards.count; i++) {
-        ty_board *board = monitor->boards.values[i];
+    for (size_t i = 0; i < boards.count; i++) {
+        ty_board *board = boards.values[i];
         bool changed = false;
 
         ty_mutex_lock(&board->ifaces_lock);
@@ -415,10 +605,13 @@ static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
         }
 
         if (r < 0)
-            return r;
+            goto cleanup;
     }
 
-    return 0;
+    r = 0;
+cleanup:
+    _hs_array_release(&boards);
+    return r;
 }
 
 static int device_callback(hs_device *dev, void *udata)
@@ -478,7 +671,24 @@ int ty_monitor_new(ty_monitor **rmonitor)
     if (r < 0)
         goto error;
 
+    r = ty_mutex_init(&monitor->snapshot_mutex);
+    if (r < 0)
+        goto error;
+    monitor->snapshot_dirty = true;
+    r = publish_snapshot(monitor);
+    if (r < 0)
+        goto error;
+
     r = _hs_htable_init(&monitor->ifaces, 64);
+    if (r < 0)
+        goto error;
+    r = _hs_htable_init(&monitor->boards_by_location, 64);
+    if (r < 0)
+        goto error;
+    r = _hs_htable_init(&monitor->boards_by_serial, 64);
+    if (r < 0)
+        goto error;
+    r = _hs_htable_init(&monitor->boards_by_tag, 64);
     if (r < 0)
         goto error;
 
@@ -497,9 +707,16 @@ void ty_monitor_free(ty_monitor *monitor)
     if (monitor) {
         ty_monitor_stop(monitor);
 
+        ty_monitor_snapshot_unref(monitor->snapshot);
+        ty_mutex_release(&monitor->snapshot_mutex);
+
         _hs_array_release(&monitor->callbacks);
         _hs_htable_release(&monitor->ifaces);
+        _hs_htable_release(&monitor->boards_by_location);
+        _hs_htable_release(&monitor->boards_by_serial);
+        _hs_htable_release(&monitor->boards_by_tag);
 
+        ty_event_set_free(monitor->wait_set);
         ty_cond_release(&monitor->refresh_cond);
         ty_mutex_release(&monitor->refresh_mutex);
         hs_monitor_free(monitor->device_monitor);
@@ -529,6 +746,10 @@ int ty_monitor_start(ty_monitor *monitor)
     if (r < 0)
         goto error;
 
+    r = publish_snapshot(monitor);
+    if (r < 0)
+        goto error;
+
     return 0;
 
 error:
@@ -552,6 +773,7 @@ void ty_monitor_stop(ty_monitor *monitor)
     for (size_t i = 0; i < monitor->boards.count; i++) {
         ty_board *board_it = monitor->boards.values[i];
 
+        unindex_board(board_it);
         board_it->monitor = NULL;
         ty_board_unref(board_it);
     }
@@ -562,11 +784,14 @@ void ty_monitor_stop(ty_monitor *monitor)
         ty_board_interface *iface_it = _HS_CONTAINER_OF(cur, ty_board_interface, monitor_hnode);
 
         if (iface_it->monitor_hnode.next)
-            _hs_htable_remove(&iface_it->monitor_hnode);
+            _hs_htable_remove(&monitor->ifaces, &iface_it->monitor_hnode);
         ty_board_interface_unref(iface_it);
     }
     _hs_htable_clear(&monitor->ifaces);
 
+    monitor->snapshot_dirty = true;
+    publish_snapshot(monitor);
+
     monitor->started = false;
 }
 
@@ -580,16 +805,52 @@ void ty_monitor_get_descriptors(const ty_monitor *monitor, ty_descriptor_set *se
 }
 
 int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata)
+{
+    return ty_monitor_register_filtered_callback(monitor, NULL, f, udata);
+}
+
+int ty_monitor_register_filtered_callback(ty_monitor *monitor, const ty_monitor_filter *filter,
+                                          ty_monitor_callback_func *f, void *udata)
 {
     assert(monitor);
     assert(f);
 
-    struct callback callback = {
+    _ty_monitor_callback_array *callbacks = &monitor->callbacks;
+    int r;
+
+    struct _ty_monitor_callback callback = {
         .id = monitor->current_callback_id++,
         .f = f,
         .udata = udata
     };
-    return ty_libhs_translate_error(_hs_array_push(&monitor->callbacks, callback));
+    if (filter) {
+        callback.events = filter->events;
+        callback.capabilities = filter->capabilities;
+
+        // Board callbacks are stored with the board, other boards never see them
+        if (filter->board) {
+            assert(filter->board->monitor == monitor);
+            callbacks = &filter->board->callbacks;
+        }
+    }
+
+    r = _hs_array_push(callbacks, callback);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    return callback.id;
+}
+
+static bool remove_callback(_ty_monitor_callback_array *callbacks, int id)
+{
+    for (size_t i = 0; i < callbacks->count; i++) {
+        if (callbacks->values[i].id == id) {
+            _hs_array_remove(callbacks, i, 1);
+            return true;
+        }
+    }
+
+    return false;
 }
 
 void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
@@ -597,11 +858,11 @@ void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
     assert(monitor);
     assert(id >= 0);
 
-    for (size_t i = 0; i < monitor->callbacks.count; i++) {
-        if (monitor->callbacks.values[i].id == id) {
-            _hs_array_remove(&monitor->callbacks, i, 1);
-            break;
-        }
+    if (remove_callback(&monitor->callbacks, id))
+        return;
+    for (size_t i = 0; i < monitor->boards.count; i++) {
+        if (remove_callback(&monitor->boards.values[i]->callbacks, id))
+            return;
     }
 }
 
@@ -650,6 +911,10 @@ int ty_monitor_refresh(ty_monitor *monitor)
         return ty_libhs_translate_error(r);
     }
 
+    r = publish_snapshot(monitor);
+    if (r < 0)
+        return r;
+
     ty_mutex_lock(&monitor->refresh_mutex);
     ty_cond_broadcast(&monitor->refresh_cond);
     ty_mutex_unlock(&monitor->refresh_mutex);
@@ -657,31 +922,114 @@ int ty_monitor_refresh(ty_monitor *monitor)
     return 0;
 }
 
+static int init_wait_set(ty_monitor *monitor)
+{
+    ty_descriptor_set set = {0};
+    int r;
+
+    // The monitor descriptors don't change, no need to register them on each call
+    if (monitor->wait_set)
+        return 0;
+
+    r = ty_event_set_new(&monitor->wait_set);
+    if (r < 0)
+        return r;
+
+    ty_monitor_get_descriptors(monitor, &set, 1);
+    r = ty_event_set_add_descriptors(monitor->wait_set, &set);
+    if (r < 0) {
+        ty_event_set_free(monitor->wait_set);
+        monitor->wait_set = NULL;
+        return r;
+    }
+
+    return 0;
+}
+
+int ty_monitor_set_interrupt_descriptor(ty_monitor *monitor, ty_descriptor desc)
+{
+    assert(monitor);
+    assert(monitor->main_thread_id == ty_thread_get_self_id());
+
+    int r;
+
+    ty_monitor_clear_interrupt_descriptor(monitor);
+
+    r = init_wait_set(monitor);
+    if (r < 0)
+        return r;
+    r = ty_event_set_add(monitor->wait_set, desc, 2);
+    if (r < 0)
+        return r;
+    monitor->has_interrupt_desc = true;
+
+    return 0;
+}
+
+void ty_monitor_clear_interrupt_descriptor(ty_monitor *monitor)
+{
+    assert(monitor);
+    assert(monitor->main_thread_id == ty_thread_get_self_id());
+
+    if (monitor->has_interrupt_desc) {
+        ty_event_set_remove(monitor->wait_set, 2);
+        monitor->has_interrupt_desc = false;
+    }
+
+    ty_mutex_lock(&monitor->refresh_mutex);
+    monitor->interrupted = false;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+}
+
+static void interrupt_waits(ty_monitor *monitor)
+{
+    ty_mutex_lock(&monitor->refresh_mutex);
+    monitor->interrupted = true;
+    ty_cond_broadcast(&monitor->refresh_cond);
+    for (size_t i = 0; i < monitor->boards.count; i++) {
+        ty_board *board = monitor->boards.values[i];
+
+        for (size_t j = 0; j < board->waiters.count; j++)
+            ty_cond_signal(&board->waiters.values[j]->cond);
+    }
+    ty_mutex_unlock(&monitor->refresh_mutex);
+}
+
 int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout)
 {
     assert(monitor);
     assert(f || (monitor->main_thread_id == ty_thread_get_self_id()));
 
-    ty_descriptor_set set = {0};
     uint64_t start;
     int r;
 
     start = hs_millis();
     if (monitor->main_thread_id != ty_thread_get_self_id()) {
         ty_mutex_lock(&monitor->refresh_mutex);
-        while (!(r = (*f)(monitor, udata))) {
+        while (!monitor->interrupted && !(r = (*f)(monitor, udata))) {
             r = ty_cond_wait(&monitor->refresh_cond, &monitor->refresh_mutex,
                              hs_adjust_timeout(timeout, start));
             if (!r)
                 break;
         }
+        if (monitor->interrupted)
+            r = TY_ERROR_INTERRUPTED;
         ty_mutex_unlock(&monitor->refresh_mutex);
 
+        if (r == TY_ERROR_INTERRUPTED)
+            return ty_error(TY_ERROR_INTERRUPTED, "Wait for device was interrupted");
         return r;
     } else {
-        ty_monitor_get_descriptors(monitor, &set, 1);
+        r = init_wait_set(monitor);
+        if (r < 0)
+            return r;
 
         do {
+            int id;
+
+            if (monitor->interrupted)
+                return ty_error(TY_ERROR_INTERRUPTED, "Wait for device was interrupted");
+
             r = ty_monitor_refresh(monitor);
             if (r < 0)
                 return (int)r;
@@ -692,17 +1040,80 @@ int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, i
                     return r;
             }
 
-            r = ty_poll(&set, hs_adjust_timeout(timeout, start));
+            r = ty_event_set_wait(monitor->wait_set, &id, 1, hs_adjust_timeout(timeout, start));
+            if (r > 0 && id == 2)
+                interrupt_waits(monitor);
         } while (r > 0);
         return r;
     }
 }
 
+int _ty_monitor_wait_board(ty_monitor *monitor, ty_board *board, int capabilities,
+                           ty_monitor_wait_func *f, void *udata, int timeout)
+{
+    assert(monitor);
+    assert(board);
+    assert(f);
+
+    struct _ty_board_waiter waiter = {0};
+    uint64_t start;
+    int r;
+
+    // The main thread refreshes the monitor itself, nothing to target
+    if (monitor->main_thread_id == ty_thread_get_self_id())
+        return ty_monitor_wait(monitor, f, udata, timeout);
+
+    r = ty_cond_init(&waiter.cond);
+    if (r < 0)
+        return r;
+    waiter.capabilities = capabilities;
+
+    start = hs_millis();
+    ty_mutex_lock(&monitor->refresh_mutex);
+
+    r = _hs_array_push(&board->waiters, &waiter);
+    if (r < 0) {
+        r = ty_libhs_translate_error(r);
+        goto cleanup;
+    }
+
+    while (!monitor->interrupted && !(r = (*f)(monitor, udata))) {
+        if (!ty_cond_wait(&waiter.cond, &monitor->refresh_mutex, hs_adjust_timeout(timeout, start)))
+            break;
+    }
+    if (monitor->interrupted)
+        r = TY_ERROR_INTERRUPTED;
+
+    for (size_t i = 0; i < board->waiters.count; i++) {
+        if (board->waiters.values[i] == &waiter) {
+            _hs_array_remove(&board->waiters, i, 1);
+            break;
+        }
+    }
+
+cleanup:
+    ty_mutex_unlock(&monitor->refresh_mutex);
+    ty_cond_release(&waiter.cond);
+
+    if (r == TY_ERROR_INTERRUPTED)
+        return ty_error(TY_ERROR_INTERRUPTED, "Wait for device was interrupted");
+    return r;
+}
+
 int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata)
 {
     assert(monitor);
     assert(f);
 
+    // Other threads must not touch the live board list
+    if (monitor->main_thread_id != ty_thread_get_self_id()) {
+        ty_monitor_snapshot *snapshot = ty_monitor_get_snapshot(monitor);
+        int r = ty_monitor_snapshot_list(snapshot, f, udata);
+        ty_monitor_snapshot_unref(snapshot);
+
+        return r;
+    }
+
     for (size_t i = 0; i < monitor->boards.count; i++) {
         ty_board *board_it = monitor->boards.values[i];
 
@@ -715,3 +1126,166 @@ int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udat
 
     return 0;
 }
+
+ty_monitor_snapshot *ty_monitor_get_snapshot(ty_monitor *monitor)
+{
+    assert(monitor);
+
+    ty_monitor_snapshot *snapshot;
+
+    ty_mutex_lock(&monitor->snapshot_mutex);
+    snapshot = ty_monitor_snapshot_ref(monitor->snapshot);
+    ty_mutex_unlock(&monitor->snapshot_mutex);
+
+    return snapshot;
+}
+
+ty_monitor_snapshot *ty_monitor_snapshot_ref(ty_monitor_snapshot *snapshot)
+{
+    assert(snapshot);
+
+    _ty_refcount_increase(&snapshot->refcount);
+    return snapshot;
+}
+
+void ty_monitor_snapshot_unref(ty_monitor_snapshot *snapshot)
+{
+    if (snapshot) {
+        if (_ty_refcount_decrease(&snapshot->refcount))
+            return;
+
+        free_snapshot(snapshot);
+    }
+}
+
+uint64_t ty_monitor_snapshot_get_version(const ty_monitor_snapshot *snapshot)
+{
+    assert(snapshot);
+    return snapshot->version;
+}
+
+size_t ty_monitor_snapshot_get_count(const ty_monitor_snapshot *snapshot)
+{
+    assert(snapshot);
+    return snapshot->boards_count;
+}
+
+ty_board *ty_monitor_snapshot_get_board(const ty_monitor_snapshot *snapshot, size_t idx)
+{
+    assert(snapshot);
+    assert(idx < snapshot->boards_count);
+
+    return snapshot->boards[idx].board;
+}
+
+int ty_monitor_snapshot_get_capabilities(const ty_monitor_snapshot *snapshot, size_t idx)
+{
+    assert(snapshot);
+    assert(idx < snapshot->boards_count);
+
+    return snapshot->boards[idx].capabilities;
+}
+
+int ty_monitor_snapshot_list(const ty_monitor_snapshot *snapshot, ty_monitor_callback_func *f,
+                             void *udata)
+{
+    assert(snapshot);
+    assert(f);
+
+    for (size_t i = 0; i < snapshot->boards_count; i++) {
+        int r = (*f)(snapshot->boards[i].board, TY_MONITOR_EVENT_ADDED, udata);
+        if (r)
+            return r;
+    }
+
+    return 0;
+}
+
+static void find_best_board(ty_board *board, const struct _ty_board_query *query,
+                            ty_board **rbest)
+{
+    if (board->status != TY_BOARD_STATUS_ONLINE)
+        return;
+    if (query && !_ty_board_matches_query(board, query))
+        return;
+
+    if (!*rbest || ty_models[board->model].priority > ty_models[(*rbest)->model].priority)
+        *rbest = board;
+}
+
+int ty_monitor_find_board(ty_monitor *monitor, const char *id, ty_board **rboard)
+{
+    assert(monitor);
+    assert(rboard);
+
+    struct _ty_board_query query;
+    ty_board *best = NULL;
+
+    if (id)
+        _ty_board_parse_query(id, &query);
+
+    // The indexes belong to the main thread, other threads search the snapshot
+    if (monitor->main_thread_id != ty_thread_get_self_id()) {
+        ty_monitor_snapshot *snapshot = ty_monitor_get_snapshot(monitor);
+
+        for (size_t i = 0; i < snapshot->boards_count; i++) {
+            ty_board *board = snapshot->boards[i].board;
+
+            if (id && !_ty_board_matches_query(board, &query))
+                continue;
+            if (!best || ty_models[board->model].priority > ty_models[best->model].priority)
+                best = board;
+        }
+        if (best)
+            ty_board_ref(best);
+
+        ty_monitor_snapshot_unref(snapshot);
+
+        if (!best)
+            return 0;
+        *rboard = best;
+        return 1;
+    }
+
+    if (!id) {
+        for (size_t i = 0; i < monitor->boards.count; i++)
+            find_best_board(monitor->boards.values[i], NULL, &best);
+        goto exit;
+    }
+
+    // Custom tags can look like anything, so always check the tag index first
+    _hs_htable_foreach_hash(cur, &monitor->boards_by_tag, _hs_htable_hash_str(id)) {
+        ty_board *board = _HS_CONTAINER_OF(cur, ty_board, tag_hnode);
+        find_best_board(board, &query, &best);
+    }
+
+    // Boards without a serial number use "?" in their id, they are indexed under that
+    if (query.serial.ptr) {
+        _hs_htable_foreach_hash(cur, &monitor->boards_by_serial, hash_id_part(&query.serial)) {
+            ty_board *board = _HS_CONTAINER_OF(cur, ty_board, serial_hnode);
+            find_best_board(board, &query, &best);
+        }
+    } else if (query.location) {
+        _hs_htable_foreach_hash(cur, &monitor->boards_by_location,
+                                _hs_htable_hash_str(query.location)) {
+            ty_board *board = _HS_CONTAINER_OF(cur, ty_board, location_hnode);
+            find_best_board(board, &query, &best);
+        }
+
+        // The location can also be an interface path, which is not indexed
+        if (!best) {
+            for (size_t i = 0; i < monitor->boards.count; i++)
+                find_best_board(monitor->boards.values[i], &query, &best);
+        }
+    } else {
+        for (size_t i = 0; i < monitor->boards.count; i++)
+            find_best_board(monitor->boards.values[i], &query, &best);
+    }
+
+exit:
+    if (!best)
+        return 0;
+
+    *rboard = ty_board_ref(best);
+    return 1;
+}
@@ -12,12 +12,14 @@
 #define TY_MONITOR_H
 
 #include "common.h"
+#include "system.h"
 
 _HS_BEGIN_C
 
 struct ty_board;
 
 typedef struct ty_monitor ty_monitor;
+typedef struct ty_monitor_snapshot ty_monitor_snapshot;
 
 typedef enum ty_monitor_event {
     TY_MONITOR_EVENT_ADDED,
@@ -29,6 +31,16 @@ typedef enum ty_monitor_event {
 typedef int ty_monitor_callback_func(struct ty_board *board, ty_monitor_event event, void *udata);
 typedef int ty_monitor_wait_func(ty_monitor *monitor, void *udata);
 
+typedef struct ty_monitor_filter {
+    // Only notify changes of this board, or NULL for all boards
+    struct ty_board *board;
+    // Mask of (1 << TY_MONITOR_EVENT_*) values, or 0 for all events
+    int events;
+    /* Mask of (1 << TY_BOARD_CAPABILITY_*) values, or 0. If set, only notify changes that
+       add or remove one of these capabilities, and TY_MONITOR_EVENT_DROPPED. */
+    int capabilities;
+} ty_monitor_filter;
+
 int ty_monitor_new(ty_monitor **rmonitor);
 void ty_monitor_free(ty_monitor *monitor);
 
@@ -38,12 +50,35 @@ void ty_monitor_stop(ty_monitor *monitor);
 void ty_monitor_get_descriptors(const ty_monitor *monitor, struct ty_descriptor_set *set, int id);
 
 int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
+int ty_monitor_register_filtered_callback(ty_monitor *monitor, const ty_monitor_filter *filter,
+                                          ty_monitor_callback_func *f, void *udata);
 void ty_monitor_deregister_callback(ty_monitor *monitor, int id);
 
 int ty_monitor_refresh(ty_monitor *monitor);
 int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout);
 
+/* Once the descriptor becomes readable (e.g. a socket closed by its peer), pending and future
+   monitor and board waits fail with TY_ERROR_INTERRUPTED in every thread, until the descriptor
+   is cleared. Only the main thread notices it, while it is inside ty_monitor_wait(). */
+int ty_monitor_set_interrupt_descriptor(ty_monitor *monitor, ty_descriptor desc);
+void ty_monitor_clear_interrupt_descriptor(ty_monitor *monitor);
+
 int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
+int ty_monitor_find_board(ty_monitor *monitor, const char *id, struct ty_board **rboard);
+
+/* Snapshots are immutable lists of the online boards, which any thread can use without
+   blocking the monitor. ty_monitor_list() and ty_monitor_find_board() use them when called
+   outside of the monitor thread. */
+ty_monitor_snapshot *ty_monitor_get_snapshot(ty_monitor *monitor);
+ty_monitor_snapshot *ty_monitor_snapshot_ref(ty_monitor_snapshot *snapshot);
+void ty_monitor_snapshot_unref(ty_monitor_snapshot *snapshot);
+
+uint64_t ty_monitor_snapshot_get_version(const ty_monitor_snapshot *snapshot);
+size_t ty_monitor_snapshot_get_count(const ty_monitor_snapshot *snapshot);
+struct ty_board *ty_monitor_snapshot_get_board(const ty_monitor_snapshot *snapshot, size_t idx);
+int ty_monitor_snapshot_get_capabilities(const ty_monitor_snapshot *snapshot, size_t idx);
+int ty_monitor_snapshot_list(const ty_monitor_snapshot *snapshot, ty_monitor_callback_func *f,
+                             void *udata);
 
 _HS_END_C
 
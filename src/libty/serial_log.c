@@ -0,0 +1,868 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+#include "common.h"
+#include "../libhs/array.h"
+#include "compress.h"
+#include "serial_log.h"
+
+/* The file starts with a text header:
+
+       TYLOG2 <data size> <oldest block> <last block> <last block sequence number>
+
+   padded with spaces to FILE_HEADER_SIZE. Offsets are relative to the end of the
+   header, all values are fixed-width hexadecimal. Blocks follow each other in the
+   data area, when the next one does not fit it goes back to the start.
+
+   Block header (little-endian):
+
+       0  "TYB1"               24 last time (int64)
+       4  sequence number      32 line count
+       8  first line (uint64)  36 text size
+       16 first time (int64)   40 payload size (text + time marks)
+                               44 compressed size
+                               48 flags (BLOCK_FLAG_*)
+                               52 FNV-1a hash of header bytes [0, 52), filter and data
+
+   followed by the trigram filter and the compressed payload: LZ4, and Huffman coding
+   on top of it unless that does not help. Time marks are pairs of varints (offset delta,
+   zigzag time delta), one for each write that changed the time. */
+
+#define FILE_HEADER_SIZE 128
+#define BLOCK_HEADER_SIZE 64
+#define FILTER_SIZE 1024
+#define FILTER_HASH_BITS 13
+#define MAX_TEXT_SIZE 65536
+#define MAX_MARKS 4096
+// Offset deltas take up to 3 bytes, time deltas up to 10
+#define MAX_PAYLOAD_SIZE (MAX_TEXT_SIZE + MAX_MARKS * 13)
+#define MAX_BLOCK_SIZE (BLOCK_HEADER_SIZE + FILTER_SIZE + ty_lz4_compress_bound(MAX_PAYLOAD_SIZE))
+#define MIN_CAPACITY (4 * MAX_BLOCK_SIZE)
+
+#define BLOCK_FLAG_HUFFMAN 0x1
+
+struct block_header {
+    uint32_t seq;
+    uint64_t first_line;
+    int64_t first_time;
+    int64_t last_time;
+    uint32_t line_count;
+    uint32_t text_size;
+    uint32_t payload_size;
+    uint32_t compressed_size;
+    uint32_t flags;
+
+    // Hash of the header alone, and of the whole block as stored in the header
+    uint32_t header_hash;
+    uint32_t block_hash;
+};
+
+struct block_ref {
+    uint64_t offset;
+    uint32_t size;
+};
+
+struct time_mark {
+    uint32_t offset;
+    int64_t time;
+};
+
+struct ty_serial_log {
+    FILE *fp;
+    char *filename;
+
+    uint64_t capacity;
+    // Complete blocks still in the file, from the oldest to the newest
+    _HS_ARRAY(struct block_ref) blocks;
+
+    // The last block, which grows until it is full
+    uint64_t tail_offset;
+    uint32_t tail_seq;
+    uint64_t tail_line;
+    char *text;
+    size_t text_len;
+    struct time_mark marks[MAX_MARKS];
+    unsigned int marks_count;
+    // A partial version of the tail block is in the file
+    bool tail_written;
+    bool dirty;
+
+    uint8_t *payload;
+    uint8_t *lz4;
+    uint8_t *block;
+};
+
+static int seek_file(FILE *fp, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(fp, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static int truncate_file(FILE *fp, uint64_t size)
+{
+    if (fflush(fp))
+        return -1;
+#ifdef _WIN32
+    return _chsize_s(_fileno(fp), (__int64)size) ? -1 : 0;
+#else
+    return ftruncate(fileno(fp), (off_t)size);
+#endif
+}
+
+static uint32_t hash_fnv1a(uint32_t hash, const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= buf[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline unsigned int hash_trigram(const uint8_t *ptr)
+{
+    uint32_t value = (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16);
+    return (value * 2654435761u) >> (32 - FILTER_HASH_BITS);
+}
+
+static inline void put_u32(uint8_t *ptr, uint32_t value)
+{
+    for (unsigned int i = 0; i < 4; i++)
+        ptr[i] = (uint8_t)(value >> (i * 8));
+}
+
+static inline void put_u64(uint8_t *ptr, uint64_t value)
+{
+    for (unsigned int i = 0; i < 8; i++)
+        ptr[i] = (uint8_t)(value >> (i * 8));
+}
+
+static inline uint32_t get_u32(const uint8_t *ptr)
+{
+    uint32_t value = 0;
+    for (unsigned int i = 0; i < 4; i++)
+        value |= (uint32_t)ptr[i] << (i * 8);
+    return value;
+}
+
+static inline uint64_t get_u64(const uint8_t *ptr)
+{
+    uint64_t value = 0;
+    for (unsigned int i = 0; i < 8; i++)
+        value |= (uint64_t)ptr[i] << (i * 8);
+    return value;
+}
+
+static uint8_t *put_varint(uint8_t *ptr, uint64_t value)
+{
+    while (value >= 0x80) {
+        *ptr++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *ptr++ = (uint8_t)value;
+
+    return ptr;
+}
+
+static bool get_varint(const uint8_t **rptr, const uint8_t *end, uint64_t *rvalue)
+{
+    const uint8_t *ptr = *rptr;
+    uint64_t value = 0;
+
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        if (ptr >= end)
+            return false;
+        value |= (uint64_t)(*ptr & 0x7F) << shift;
+        if (!(*ptr++ & 0x80)) {
+            *rptr = ptr;
+            *rvalue = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint64_t compute_capacity(uint64_t size)
+{
+    uint64_t capacity = size > FILE_HEADER_SIZE ? size - FILE_HEADER_SIZE : 0;
+    return capacity > MIN_CAPACITY ? capacity : MIN_CAPACITY;
+}
+
+static int write_error(ty_serial_log *log)
+{
+    if (errno == EIO || errno == ENOSPC)
+        return ty_error(TY_ERROR_IO, "I/O error while writing to '%s'", log->filename);
+    return ty_error(TY_ERROR_SYSTEM, "Failed to write to '%s': %s", log->filename,
+                    strerror(errno));
+}
+
+static int write_file_header(ty_serial_log *log)
+{
+    char header[FILE_HEADER_SIZE + 1];
+    uint64_t oldest = log->blocks.count ? log->blocks.values[0].offset : log->tail_offset;
+    int len;
+
+    len = snprintf(header, sizeof(header), "TYLOG2 %016" PRIx64 " %016" PRIx64 " %016" PRIx64
+                                           " %08" PRIx32,
+                   log->capacity, oldest, log->tail_offset, log->tail_seq);
+    memset(header + len, ' ', (size_t)(FILE_HEADER_SIZE - 1 - len));
+    header[FILE_HEADER_SIZE - 1] = '\n';
+
+    if (seek_file(log->fp, 0) < 0 || fwrite(header, 1, FILE_HEADER_SIZE, log->fp) != FILE_HEADER_SIZE ||
+            fflush(log->fp))
+        return write_error(log);
+
+    return 0;
+}
+
+/* Make room for a tail block of the given size, dropping the oldest blocks in the way.
+   Blocks past the tail are older than the ones before it. */
+static int place_tail(ty_serial_log *log, uint64_t size)
+{
+    size_t drop = 0;
+
+    if (log->tail_offset + size > log->capacity) {
+        // Readers must not mistake an older version of the tail block for the real one
+        if (log->tail_written) {
+            static const uint8_t zero[4];
+
+            if (seek_file(log->fp, FILE_HEADER_SIZE + log->tail_offset) < 0 ||
+                    fwrite(zero, 1, sizeof(zero), log->fp) != sizeof(zero))
+                return write_error(log);
+            log->tail_written = false;
+        }
+
+        while (drop < log->blocks.count && log->blocks.values[drop].offset >= log->tail_offset)
+            drop++;
+        log->tail_offset = 0;
+    }
+    while (drop < log->blocks.count &&
+           log->blocks.values[drop].offset >= log->tail_offset &&
+           log->blocks.values[drop].offset < log->tail_offset + size)
+        drop++;
+
+    if (drop)
+        _hs_array_remove(&log->blocks, 0, drop);
+
+    return 0;
+}
+
+// Writes the first text_len bytes of the tail (with their marks) as the tail block
+static int write_tail_block(ty_serial_log *log, size_t text_len, unsigned int marks_count,
+                            uint32_t *rsize, uint32_t *rline_count)
+{
+    uint8_t *header = log->block;
+    uint8_t *filter = header + BLOCK_HEADER_SIZE;
+    uint8_t *data = filter + FILTER_SIZE;
+    uint32_t line_count = 0;
+    size_t payload_len, lz4_len, compressed_len;
+    uint32_t flags = 0;
+    uint32_t size;
+    int r;
+
+    memcpy(log->payload, log->text, text_len);
+    {
+        uint8_t *ptr = log->payload + text_len;
+        uint32_t prev_offset = 0;
+        int64_t prev_time = log->marks[0].time;
+
+        for (unsigned int i = 0; i < marks_count; i++) {
+            int64_t delta = log->marks[i].time - prev_time;
+
+            ptr = put_varint(ptr, log->marks[i].offset - prev_offset);
+            ptr = put_varint(ptr, delta >= 0 ? (uint64_t)delta << 1
+                                             : ((uint64_t)-(delta + 1) << 1) | 1);
+            prev_offset = log->marks[i].offset;
+            prev_time = log->marks[i].time;
+        }
+        payload_len = (size_t)(ptr - log->payload);
+    }
+
+    memset(filter, 0, FILTER_SIZE);
+    for (size_t i = 0; i < text_len; i++) {
+        if (log->text[i] == '\n')
+            line_count++;
+        if (i + 3 <= text_len) {
+            unsigned int bit = hash_trigram((const uint8_t *)log->text + i);
+            filter[bit / 8] |= (uint8_t)(1 << (bit % 8));
+        }
+    }
+
+    lz4_len = ty_lz4_compress(log->payload, payload_len, log->lz4);
+    compressed_len = ty_huffman_compress(log->lz4, lz4_len, data);
+    if (compressed_len) {
+        flags |= BLOCK_FLAG_HUFFMAN;
+    } else {
+        memcpy(data, log->lz4, lz4_len);
+        compressed_len = lz4_len;
+    }
+
+    memset(header, 0, BLOCK_HEADER_SIZE);
+    memcpy(header, "TYB1", 4);
+    put_u32(header + 4, log->tail_seq);
+    put_u64(header + 8, log->tail_line);
+    put_u64(header + 16, (uint64_t)log->marks[0].time);
+    put_u64(header + 24, (uint64_t)log->marks[marks_count - 1].time);
+    put_u32(header + 32, line_count);
+    put_u32(header + 36, (uint32_t)text_len);
+    put_u32(header + 40, (uint32_t)payload_len);
+    put_u32(header + 44, (uint32_t)compressed_len);
+    put_u32(header + 48, flags);
+    put_u32(header + 52, hash_fnv1a(hash_fnv1a(2166136261u, header, 52), filter,
+                                    FILTER_SIZE + compressed_len));
+
+    size = (uint32_t)(BLOCK_HEADER_SIZE + FILTER_SIZE + compressed_len);
+    r = place_tail(log, size);
+    if (r < 0)
+        return r;
+
+    if (seek_file(log->fp, FILE_HEADER_SIZE + log->tail_offset) < 0 ||
+            fwrite(log->block, 1, size, log->fp) != size)
+        return write_error(log);
+
+    if (rsize)
+        *rsize = size;
+    if (rline_count)
+        *rline_count = line_count;
+    return 0;
+}
+
+/* Completes the tail block, and starts a new one with the rest of the last line. Set whole
+   to cut after the last byte instead. */
+static int commit_tail(ty_serial_log *log, bool whole)
+{
+    size_t text_len;
+    unsigned int marks_count;
+    struct block_ref ref;
+    uint32_t line_count;
+    int r;
+
+    text_len = log->text_len;
+    while (!whole && text_len && log->text[text_len - 1] != '\n')
+        text_len--;
+    // A very long line, cut it
+    if (!text_len)
+        text_len = log->text_len;
+    marks_count = 0;
+    while (marks_count < log->marks_count && log->marks[marks_count].offset < text_len)
+        marks_count++;
+
+    r = write_tail_block(log, text_len, marks_count, &ref.size, &line_count);
+    if (r < 0)
+        return r;
+
+    ref.offset = log->tail_offset;
+    r = _hs_array_push(&log->blocks, ref);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    log->tail_offset += ref.size;
+    log->tail_seq++;
+    log->tail_line += line_count;
+    log->tail_written = false;
+
+    memmove(log->text, log->text + text_len, log->text_len - text_len);
+    log->text_len -= text_len;
+    if (log->text_len) {
+        // The mark in effect at the cut applies to the start of the new block
+        unsigned int first = marks_count;
+        if (first == log->marks_count || log->marks[first].offset > text_len)
+            first--;
+
+        log->marks_count -= first;
+        memmove(log->marks, log->marks + first, log->marks_count * sizeof(*log->marks));
+        for (unsigned int i = 0; i < log->marks_count; i++)
+            log->marks[i].offset = log->marks[i].offset > text_len
+                                   ? (uint32_t)(log->marks[i].offset - text_len) : 0;
+    } else {
+        log->marks_count = 0;
+    }
+    log->dirty = true;
+
+    return 0;
+}
+
+int ty_serial_log_open(const char *filename, uint64_t size, ty_serial_log **rlog)
+{
+    assert(filename);
+    assert(rlog);
+
+    ty_serial_log *log;
+    int r;
+
+    log = calloc(1, sizeof(*log));
+    if (!log)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    log->filename = strdup(filename);
+    log->text = malloc(MAX_TEXT_SIZE);
+    log->payload = malloc(MAX_PAYLOAD_SIZE);
+    log->lz4 = malloc(ty_lz4_compress_bound(MAX_PAYLOAD_SIZE));
+    log->block = malloc(MAX_BLOCK_SIZE);
+    if (!log->filename || !log->text || !log->payload || !log->lz4 || !log->block) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    log->capacity = compute_capacity(size);
+
+restart:
+#ifdef _WIN32
+    log->fp = fopen(filename, "w+b");
+#else
+    log->fp = fopen(filename, "w+be");
+#endif
+    if (!log->fp) {
+        switch (errno) {
+            case EINTR: {
+                goto restart;
+            } break;
+
+            case EACCES: {
+                r = ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                r = ty_error(TY_ERROR_NOT_FOUND, "Directory of '%s' does not exist", filename);
+            } break;
+
+            default: {
+                r = ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename,
+                             strerror(errno));
+            } break;
+        }
+        goto error;
+    }
+
+    r = write_file_header(log);
+    if (r < 0)
+        goto error;
+
+    *rlog = log;
+    return 0;
+
+error:
+    ty_serial_log_close(log);
+    return r;
+}
+
+void ty_serial_log_close(ty_serial_log *log)
+{
+    if (log) {
+        if (log->fp) {
+            ty_serial_log_flush(log);
+            fclose(log->fp);
+        }
+
+        free(log->block);
+        free(log->lz4);
+        free(log->payload);
+        free(log->text);
+        _hs_array_release(&log->blocks);
+        free(log->filename);
+    }
+
+    free(log);
+}
+
+int ty_serial_log_write(ty_serial_log *log, const char *buf, size_t len, int64_t time)
+{
+    assert(log);
+    assert(buf || !len);
+
+    while (len) {
+        size_t part_len;
+        int r;
+
+        if (!log->marks_count || log->marks[log->marks_count - 1].time != time) {
+            // End the block early rather than lose timestamps
+            if (log->marks_count == MAX_MARKS) {
+                r = commit_tail(log, false);
+                if (r < 0)
+                    return r;
+                if (log->marks_count == MAX_MARKS) {
+                    r = commit_tail(log, true);
+                    if (r < 0)
+                        return r;
+                }
+            }
+
+            log->marks[log->marks_count].offset = (uint32_t)log->text_len;
+            log->marks[log->marks_count].time = time;
+            log->marks_count++;
+        }
+
+        part_len = _HS_MIN(len, MAX_TEXT_SIZE - log->text_len);
+        memcpy(log->text + log->text_len, buf, part_len);
+        log->text_len += part_len;
+        buf += part_len;
+        len -= part_len;
+        log->dirty = true;
+
+        if (log->text_len == MAX_TEXT_SIZE) {
+            r = commit_tail(log, false);
+            if (r < 0)
+                return r;
+        }
+    }
+
+    return 0;
+}
+
+int ty_serial_log_flush(ty_serial_log *log)
+{
+    assert(log);
+
+    int r;
+
+    if (!log->dirty)
+        return 0;
+
+    if (log->text_len) {
+        r = write_tail_block(log, log->text_len, log->marks_count, NULL, NULL);
+        if (r < 0)
+            return r;
+        log->tail_written = true;
+    }
+    r = write_file_header(log);
+    if (r < 0)
+        return r;
+
+    log->dirty = false;
+    return 0;
+}
+
+int ty_serial_log_sync(ty_serial_log *log)
+{
+    assert(log);
+
+    int r;
+
+    r = ty_serial_log_flush(log);
+    if (r < 0)
+        return r;
+
+#ifdef _WIN32
+    if (_commit(_fileno(log->fp)) < 0)
+        return write_error(log);
+#else
+    if (fsync(fileno(log->fp)) < 0)
+        return write_error(log);
+#endif
+
+    return 0;
+}
+
+int ty_serial_log_resize(ty_serial_log *log, uint64_t size)
+{
+    assert(log);
+
+    uint64_t capacity = compute_capacity(size);
+    uint8_t *data = NULL;
+    uint64_t data_len = 0;
+    size_t first = log->blocks.count;
+    int r;
+
+    if (capacity == log->capacity)
+        return 0;
+
+    // Keep the most recent blocks, with room left for the tail block
+    while (first && data_len + log->blocks.values[first - 1].size + MAX_BLOCK_SIZE <= capacity) {
+        first--;
+        data_len += log->blocks.values[first].size;
+    }
+
+    if (data_len) {
+        data = malloc(data_len);
+        if (!data)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+
+        uint64_t offset = 0;
+        for (size_t i = first; i < log->blocks.count; i++) {
+            struct block_ref *ref = &log->blocks.values[i];
+
+            if (seek_file(log->fp, FILE_HEADER_SIZE + ref->offset) < 0 ||
+                    fread(data + offset, 1, ref->size, log->fp) != ref->size) {
+                r = ty_error(TY_ERROR_IO, "I/O error while reading from '%s'", log->filename);
+                goto cleanup;
+            }
+            ref->offset = offset;
+            offset += ref->size;
+        }
+    }
+    if (first)
+        _hs_array_remove(&log->blocks, 0, first);
+
+    log->capacity = capacity;
+    log->tail_offset = data_len;
+    log->tail_written = false;
+    log->dirty = true;
+
+    if (truncate_file(log->fp, FILE_HEADER_SIZE) < 0 ||
+            (data_len && (seek_file(log->fp, FILE_HEADER_SIZE) < 0 ||
+                          fwrite(data, 1, data_len, log->fp) != data_len))) {
+        r = write_error(log);
+        goto cleanup;
+    }
+    r = ty_serial_log_flush(log);
+
+cleanup:
+    free(data);
+    return r;
+}
+
+static bool read_block_header(FILE *fp, uint64_t capacity, uint64_t offset,
+                              struct block_header *rheader)
+{
+    uint8_t buf[BLOCK_HEADER_SIZE];
+
+    if (offset + BLOCK_HEADER_SIZE + FILTER_SIZE > capacity)
+        return false;
+    if (seek_file(fp, FILE_HEADER_SIZE + offset) < 0 ||
+            fread(buf, 1, sizeof(buf), fp) != sizeof(buf))
+        return false;
+    if (memcmp(buf, "TYB1", 4))
+        return false;
+
+    rheader->seq = get_u32(buf + 4);
+    rheader->first_line = get_u64(buf + 8);
+    rheader->first_time = (int64_t)get_u64(buf + 16);
+    rheader->last_time = (int64_t)get_u64(buf + 24);
+    rheader->line_count = get_u32(buf + 32);
+    rheader->text_size = get_u32(buf + 36);
+    rheader->payload_size = get_u32(buf + 40);
+    rheader->compressed_size = get_u32(buf + 44);
+    rheader->flags = get_u32(buf + 48);
+    rheader->header_hash = hash_fnv1a(2166136261u, buf, 52);
+    rheader->block_hash = get_u32(buf + 52);
+
+    if (rheader->text_size > MAX_TEXT_SIZE || rheader->payload_size > MAX_PAYLOAD_SIZE ||
+            rheader->text_size > rheader->payload_size ||
+            rheader->compressed_size > ty_lz4_compress_bound(MAX_PAYLOAD_SIZE) ||
+            offset + BLOCK_HEADER_SIZE + FILTER_SIZE + rheader->compressed_size > capacity)
+        return false;
+
+    return true;
+}
+
+static bool filter_may_contain(const uint8_t *filter, const char *needle, size_t needle_len)
+{
+    for (size_t i = 0; i + 3 <= needle_len; i++) {
+        unsigned int bit = hash_trigram((const uint8_t *)needle + i);
+        if (!(filter[bit / 8] & (1 << (bit % 8))))
+            return false;
+    }
+    return true;
+}
+
+static const char *find_needle(const char *text, size_t len, const char *needle,
+                               size_t needle_len)
+{
+    if (needle_len > len)
+        return NULL;
+
+    for (size_t i = 0; i <= len - needle_len; i++) {
+        const char *ptr = memchr(text + i, needle[0], len - needle_len - i + 1);
+        if (!ptr)
+            return NULL;
+        if (!memcmp(ptr, needle, needle_len))
+            return ptr;
+        i = (size_t)(ptr - text);
+    }
+
+    return NULL;
+}
+
+static bool decode_block(const struct block_header *header, const uint8_t *data,
+                         uint8_t *lz4, uint8_t *payload)
+{
+    if (header->flags & BLOCK_FLAG_HUFFMAN) {
+        size_t lz4_len = ty_huffman_decompressed_size(data, header->compressed_size);
+
+        if (lz4_len > ty_lz4_compress_bound(MAX_PAYLOAD_SIZE) ||
+                !ty_huffman_decompress(data, header->compressed_size, lz4, lz4_len))
+            return false;
+        return ty_lz4_decompress(lz4, lz4_len, payload, header->payload_size);
+    } else {
+        return ty_lz4_decompress(data, header->compressed_size, payload, header->payload_size);
+    }
+}
+
+static int search_block(const struct block_header *header, const uint8_t *payload,
+                        const ty_serial_log_query *query, size_t needle_len,
+                        ty_serial_log_line_func *f, void *udata)
+{
+    const char *text = (const char *)payload;
+    const uint8_t *marks = payload + header->text_size;
+    const uint8_t *marks_end = payload + header->payload_size;
+    uint64_t next_mark_offset = 0;
+    int64_t time = header->first_time;
+    int64_t next_mark_time = header->first_time;
+    bool have_mark;
+    ty_serial_log_line line;
+    size_t start = 0;
+
+    {
+        uint64_t delta;
+        have_mark = get_varint(&marks, marks_end, &next_mark_offset) &&
+                    get_varint(&marks, marks_end, &delta);
+    }
+
+    line.number = header->first_line;
+    while (start < header->text_size) {
+        const char *end = memchr(text + start, '\n', header->text_size - start);
+        size_t len = end ? (size_t)(end - text) - start : header->text_size - start;
+
+        // Advance to the mark in effect at the start of the line
+        while (have_mark && next_mark_offset <= start) {
+            uint64_t offset_delta, time_delta;
+
+            time = next_mark_time;
+            have_mark = get_varint(&marks, marks_end, &offset_delta) &&
+                        get_varint(&marks, marks_end, &time_delta);
+            if (have_mark) {
+                next_mark_offset += offset_delta;
+                next_mark_time += (time_delta & 1) ? -(int64_t)(time_delta >> 1) - 1
+                                                   : (int64_t)(time_delta >> 1);
+            }
+        }
+
+        line.time = time;
+        line.text = text + start;
+        line.len = len;
+        if (len && line.text[len - 1] == '\r')
+            line.len--;
+
+        if (time >= query->start_time && time <= query->end_time &&
+                (!needle_len || find_needle(line.text, line.len, query->needle, needle_len))) {
+            int r = (*f)(&line, udata);
+            if (r)
+                return r;
+        }
+
+        line.number++;
+        start += len + 1;
+    }
+
+    return 0;
+}
+
+int ty_serial_log_search(const char *filename, const ty_serial_log_query *query,
+                         ty_serial_log_line_func *f, void *udata)
+{
+    assert(filename);
+    assert(query);
+    assert(f);
+
+    FILE *fp;
+    char file_header[FILE_HEADER_SIZE + 1] = {0};
+    uint64_t capacity, offset, tail_offset;
+    uint32_t tail_seq, seq = 0;
+    bool first = true, retried = false;
+    size_t needle_len = query->needle ? strlen(query->needle) : 0;
+    uint8_t *block = NULL, *lz4 = NULL, *payload = NULL;
+    int r;
+
+restart:
+#ifdef _WIN32
+    fp = fopen(filename, "rb");
+#else
+    fp = fopen(filename, "rbe");
+#endif
+    if (!fp) {
+        switch (errno) {
+            case EINTR: {
+                goto restart;
+            } break;
+
+            case EACCES: {
+                return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                return ty_error(TY_ERROR_NOT_FOUND, "File '%s' does not exist", filename);
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename,
+                                strerror(errno));
+            } break;
+        }
+    }
+
+    if (fread(file_header, 1, FILE_HEADER_SIZE, fp) != FILE_HEADER_SIZE ||
+            sscanf(file_header, "TYLOG2 %" SCNx64 " %" SCNx64 " %" SCNx64 " %" SCNx32,
+                   &capacity, &offset, &tail_offset, &tail_seq) != 4) {
+        r = ty_error(TY_ERROR_PARSE, "File '%s' is not a serial log", filename);
+        goto cleanup;
+    }
+
+    block = malloc(MAX_BLOCK_SIZE);
+    lz4 = malloc(ty_lz4_compress_bound(MAX_PAYLOAD_SIZE));
+    payload = malloc(MAX_PAYLOAD_SIZE);
+    if (!block || !lz4 || !payload) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    for (;;) {
+        struct block_header header;
+        uint8_t *filter = block + BLOCK_HEADER_SIZE;
+        uint8_t *data = filter + FILTER_SIZE;
+
+        if (!read_block_header(fp, capacity, offset, &header) || (!first && header.seq != seq)) {
+            // The writer went back to the start of the ring after the previous block
+            if (first || retried || !offset)
+                break;
+            offset = 0;
+            retried = true;
+            continue;
+        }
+        first = false;
+        retried = false;
+
+        if (header.first_time <= query->end_time && header.last_time >= query->start_time) {
+            if (fread(filter, 1, FILTER_SIZE, fp) != FILTER_SIZE)
+                break;
+
+            if (needle_len < 3 || filter_may_contain(filter, query->needle, needle_len)) {
+                // Stop at blocks that are being rewritten by the writer
+                if (fread(data, 1, header.compressed_size, fp) != header.compressed_size ||
+                        hash_fnv1a(header.header_hash, filter, FILTER_SIZE + header.compressed_size) !=
+                            header.block_hash ||
+                        !decode_block(&header, data, lz4, payload))
+                    break;
+
+                r = search_block(&header, payload, query, needle_len, f, udata);
+                if (r)
+                    goto cleanup;
+            }
+        }
+
+        if (header.seq == tail_seq)
+            break;
+        seq = header.seq + 1;
+        offset = (seq == tail_seq) ? tail_offset
+                                   : offset + BLOCK_HEADER_SIZE + FILTER_SIZE + header.compressed_size;
+    }
+
+    r = 0;
+cleanup:
+    free(payload);
+    free(lz4);
+    free(block);
+    fclose(fp);
+    return r;
+}
@@ -0,0 +1,72 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_SERIAL_LOG_H
+#define TY_SERIAL_LOG_H
+
+#include "common.h"
+
+_HS_BEGIN_C
+
+/* Compressed ring log of serial output. The text is cut in blocks of about 64 kB, at line
+   boundaries when possible, and each block is compressed on its own (LZ4 followed by
+   Huffman coding). Once the file is full the oldest blocks are overwritten.
+
+   Each block header records its first line number and time range, along with a small
+   trigram filter of its content. Searches use these to skip blocks, and only decompress
+   the ones that may contain matching lines.
+
+   The last block stays in memory until it is full, ty_serial_log_flush() writes it out
+   so that readers can see recent output. Each flush compresses and rewrites the whole
+   partial block, so call it sparingly (before searching, or on a long interval). */
+
+typedef struct ty_serial_log ty_serial_log;
+
+typedef struct ty_serial_log_line {
+    uint64_t number;
+    // Milliseconds since the Unix epoch, when the line started
+    int64_t time;
+
+    // Without the line ending
+    const char *text;
+    size_t len;
+} ty_serial_log_line;
+
+typedef struct ty_serial_log_query {
+    // Inclusive range, use INT64_MIN and INT64_MAX for no limit
+    int64_t start_time;
+    int64_t end_time;
+
+    // Lines must contain this string, NULL or empty to get all of them
+    const char *needle;
+} ty_serial_log_query;
+
+typedef int ty_serial_log_line_func(const ty_serial_log_line *line, void *udata);
+
+// The file is truncated, and the size is rounded up to fit at least 4 blocks
+int ty_serial_log_open(const char *filename, uint64_t size, ty_serial_log **rlog);
+void ty_serial_log_close(ty_serial_log *log);
+
+int ty_serial_log_write(ty_serial_log *log, const char *buf, size_t len, int64_t time);
+int ty_serial_log_flush(ty_serial_log *log);
+int ty_serial_log_sync(ty_serial_log *log);
+
+// Keeps the most recent blocks that fit
+int ty_serial_log_resize(ty_serial_log *log, uint64_t size);
+
+/* Calls f for each line matching the query, from the oldest to the newest, and stops if
+   it returns non-zero (and returns that value). Reading a file that is being written by
+   another process is fine, at worst the search stops early. */
+int ty_serial_log_search(const char *filename, const ty_serial_log_query *query,
+                         ty_serial_log_line_func *f, void *udata);
+
+_HS_END_C
+
+#endif
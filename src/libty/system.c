@@ -50,3 +50,17 @@ void ty_descriptor_set_remove(ty_descriptor_set *set, int id)
 
     set->count = count;
 }
+
+int ty_event_set_add_descriptors(ty_event_set *set, const ty_descriptor_set *descs)
+{
+    assert(set);
+    assert(descs);
+
+    for (unsigned int i = 0; i < descs->count; i++) {
+        int r = ty_event_set_add(set, descs->desc[i], descs->id[i]);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
@@ -38,7 +38,8 @@ typedef enum ty_standard_stream {
 
 typedef enum ty_standard_path {
     TY_PATH_EXECUTABLE_DIRECTORY = 0,
-    TY_PATH_CONFIG_DIRECTORY
+    TY_PATH_CONFIG_DIRECTORY,
+    TY_PATH_CACHE_DIRECTORY
 } ty_standard_path;
 
 enum {
@@ -48,12 +49,20 @@ enum {
     TY_DESCRIPTOR_MODE_FILE = 8
 };
 
+typedef struct ty_file_info {
+    uint64_t size;
+    // Only meaningful for comparisons, the resolution depends on the platform
+    int64_t mtime;
+} ty_file_info;
+
 typedef struct ty_descriptor_set {
     unsigned int count;
     ty_descriptor desc[64];
     int id[64];
 } ty_descriptor_set;
 
+typedef struct ty_event_set ty_event_set;
+
 enum {
     TY_TERMINAL_RAW = 0x1,
     TY_TERMINAL_SILENT = 0x2
@@ -75,7 +84,26 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
 
 int ty_poll(const ty_descriptor_set *set, int timeout);
 
+/* Persistent alternative to ty_poll(), for loops that wait on the same descriptors again
+   and again. It uses epoll on Linux, there is no limit on the number of descriptors (except
+   on Windows, where WaitForMultipleObjects() caps it at 64). */
+int ty_event_set_new(ty_event_set **rset);
+void ty_event_set_free(ty_event_set *set);
+
+int ty_event_set_add(ty_event_set *set, ty_descriptor desc, int id);
+int ty_event_set_add_descriptors(ty_event_set *set, const ty_descriptor_set *descs);
+int ty_event_set_modify(ty_event_set *set, ty_descriptor desc, int id);
+void ty_event_set_remove(ty_event_set *set, int id);
+void ty_event_set_clear(ty_event_set *set);
+unsigned int ty_event_set_count(const ty_event_set *set);
+
+// Stores the ids of all ready descriptors (once each) and returns how many, 0 on timeout
+int ty_event_set_wait(ty_event_set *set, int *rids, unsigned int max_ids, int timeout);
+
 bool ty_compare_paths(const char *path1, const char *path2);
+// Creates missing parent directories too, succeeds if the directory already exists
+int ty_create_directory(const char *path);
+int ty_stat_file(const char *path, ty_file_info *rinfo);
 
 int ty_terminal_setup(int flags);
 void ty_terminal_restore(void);
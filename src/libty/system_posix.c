@@ -22,9 +22,29 @@
     #include <sys/select.h>
 #else
     #include <poll.h>
+    #include <sys/epoll.h>
 #endif
+#include "../libhs/array.h"
 #include "system.h"
 
+struct event_entry {
+    ty_descriptor desc;
+    int id;
+    // Regular files (and a few devices such as /dev/null) cannot be used with epoll
+    bool always_ready;
+};
+
+struct ty_event_set {
+#ifdef __APPLE__
+    fd_set fds;
+    int max_fd;
+#else
+    int epoll_fd;
+#endif
+
+    _HS_ARRAY(struct event_entry) entries;
+};
+
 struct child_report {
     ty_err err;
     char msg[512];
@@ -105,6 +125,12 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
                 ADD_DIRECTORY("%s/Library/Preferences", home_dir);
             ADD_DIRECTORY("/Library/Preferences");
         } break;
+
+        case TY_PATH_CACHE_DIRECTORY: {
+            const char *home_dir = getenv("HOME");
+            if (home_dir)
+                ADD_DIRECTORY("%s/Library/Caches", home_dir);
+        } break;
     }
 
 #undef ADD_DIRECTORY
@@ -119,7 +145,8 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
         }
     }
 
-    assert(paths_count);
+    // Without HOME, there is no user cache directory
+    assert(paths_count || std_path == TY_PATH_CACHE_DIRECTORY);
     return paths_count;
 
 overflow:
@@ -228,6 +255,17 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
                 config_dirs += len + !!config_dirs[len];
             }
         } break;
+
+        case TY_PATH_CACHE_DIRECTORY: {
+            const char *cache_home_dir = getenv("XDG_CACHE_HOME");
+            if (cache_home_dir) {
+                ADD_DIRECTORY("%s", cache_home_dir);
+            } else {
+                const char *home_dir = getenv("HOME");
+                if (home_dir)
+                    ADD_DIRECTORY("%s/.cache", home_dir);
+            }
+        } break;
     }
 
 #undef ADD_DIRECTORY
@@ -242,7 +280,8 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
         }
     }
 
-    assert(paths_count);
+    // Without HOME, there is no user cache directory
+    assert(paths_count || std_path == TY_PATH_CACHE_DIRECTORY);
     return paths_count;
 
 overflow:
@@ -291,6 +330,261 @@ restart:
 
 #endif
 
+int ty_event_set_new(ty_event_set **rset)
+{
+    assert(rset);
+
+    ty_event_set *set;
+
+    set = calloc(1, sizeof(*set));
+    if (!set)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+#ifdef __APPLE__
+    FD_ZERO(&set->fds);
+    set->max_fd = -1;
+#else
+    set->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (set->epoll_fd < 0) {
+        free(set);
+        return ty_error(TY_ERROR_SYSTEM, "epoll_create1() failed: %s", strerror(errno));
+    }
+#endif
+
+    *rset = set;
+    return 0;
+}
+
+void ty_event_set_free(ty_event_set *set)
+{
+    if (set) {
+#ifndef __APPLE__
+        close(set->epoll_fd);
+#endif
+        _hs_array_release(&set->entries);
+    }
+
+    free(set);
+}
+
+#ifndef __APPLE__
+static uint64_t pack_epoll_data(int fd, int id)
+{
+    return ((uint64_t)(uint32_t)id << 32) | (uint32_t)fd;
+}
+#endif
+
+int ty_event_set_add(ty_event_set *set, ty_descriptor desc, int id)
+{
+    assert(set);
+    assert(desc >= 0);
+
+    struct event_entry entry = {
+        .desc = desc,
+        .id = id
+    };
+    int r;
+
+    for (size_t i = 0; i < set->entries.count; i++) {
+        if (set->entries.values[i].desc == desc)
+            return ty_error(TY_ERROR_EXISTS, "Descriptor %d is already in this event set", desc);
+    }
+
+#ifdef __APPLE__
+    if (desc >= FD_SETSIZE)
+        return ty_error(TY_ERROR_RANGE, "Descriptor %d is too high for select()", desc);
+
+    FD_SET(desc, &set->fds);
+    set->max_fd = _HS_MAX(set->max_fd, desc);
+#else
+    struct epoll_event ev = {0};
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = pack_epoll_data(desc, id);
+    if (epoll_ctl(set->epoll_fd, EPOLL_CTL_ADD, desc, &ev) < 0) {
+        if (errno != EPERM)
+            return ty_error(TY_ERROR_SYSTEM, "epoll_ctl() failed: %s", strerror(errno));
+
+        // Same behavior as poll(), which always reports these as readable
+        entry.always_ready = true;
+    }
+#endif
+
+    r = _hs_array_push(&set->entries, entry);
+    if (r < 0) {
+#ifdef __APPLE__
+        FD_CLR(desc, &set->fds);
+#else
+        if (!entry.always_ready)
+            epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, desc, NULL);
+#endif
+        return ty_libhs_translate_error(r);
+    }
+
+    return 0;
+}
+
+int ty_event_set_modify(ty_event_set *set, ty_descriptor desc, int id)
+{
+    assert(set);
+
+    for (size_t i = 0; i < set->entries.count; i++) {
+        struct event_entry *entry = &set->entries.values[i];
+
+        if (entry->desc == desc) {
+#ifndef __APPLE__
+            if (!entry->always_ready) {
+                struct epoll_event ev = {0};
+
+                ev.events = EPOLLIN;
+                ev.data.u64 = pack_epoll_data(desc, id);
+                if (epoll_ctl(set->epoll_fd, EPOLL_CTL_MOD, desc, &ev) < 0)
+                    return ty_error(TY_ERROR_SYSTEM, "epoll_ctl() failed: %s", strerror(errno));
+            }
+#endif
+            entry->id = id;
+
+            return 0;
+        }
+    }
+
+    return ty_error(TY_ERROR_NOT_FOUND, "Descriptor %d is not in this event set", desc);
+}
+
+static void release_event_entry(ty_event_set *set, const struct event_entry *entry)
+{
+#ifdef __APPLE__
+    FD_CLR(entry->desc, &set->fds);
+#else
+    /* The descriptor may be closed already, in which case the kernel has dropped it from
+       the epoll set on its own. */
+    if (!entry->always_ready)
+        epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, entry->desc, NULL);
+#endif
+}
+
+void ty_event_set_remove(ty_event_set *set, int id)
+{
+    assert(set);
+
+    size_t count = 0;
+    for (size_t i = 0; i < set->entries.count; i++) {
+        const struct event_entry *entry = &set->entries.values[i];
+
+        if (entry->id == id) {
+            release_event_entry(set, entry);
+        } else {
+            set->entries.values[count++] = *entry;
+        }
+    }
+    set->entries.count = count;
+
+#ifdef __APPLE__
+    set->max_fd = -1;
+    for (size_t i = 0; i < set->entries.count; i++)
+        set->max_fd = _HS_MAX(set->max_fd, set->entries.values[i].desc);
+#endif
+}
+
+void ty_event_set_clear(ty_event_set *set)
+{
+    assert(set);
+
+    for (size_t i = 0; i < set->entries.count; i++)
+        release_event_entry(set, &set->entries.values[i]);
+    set->entries.count = 0;
+
+#ifdef __APPLE__
+    set->max_fd = -1;
+#endif
+}
+
+unsigned int ty_event_set_count(const ty_event_set *set)
+{
+    assert(set);
+    return (unsigned int)set->entries.count;
+}
+
+static void add_ready_id(int *rids, unsigned int max_ids, unsigned int *rcount, int id)
+{
+    for (unsigned int i = 0; i < *rcount; i++) {
+        if (rids[i] == id)
+            return;
+    }
+    if (*rcount < max_ids)
+        rids[(*rcount)++] = id;
+}
+
+int ty_event_set_wait(ty_event_set *set, int *rids, unsigned int max_ids, int timeout)
+{
+    assert(set);
+    assert(rids);
+    assert(max_ids);
+
+    unsigned int count = 0;
+    uint64_t start;
+    int r;
+
+    if (timeout < 0)
+        timeout = -1;
+
+#ifdef __APPLE__
+    fd_set fds;
+    struct timeval tv;
+
+    start = hs_millis();
+restart:
+    fds = set->fds;
+    if (timeout >= 0) {
+        int adjusted_timeout = hs_adjust_timeout(timeout, start);
+        tv.tv_sec = adjusted_timeout / 1000;
+        tv.tv_usec = (adjusted_timeout % 1000) * 1000;
+        r = select(set->max_fd + 1, &fds, NULL, NULL, &tv);
+    } else {
+        r = select(set->max_fd + 1, &fds, NULL, NULL, NULL);
+    }
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "select() failed: %s", strerror(errno));
+    }
+
+    for (size_t i = 0; i < set->entries.count && r; i++) {
+        const struct event_entry *entry = &set->entries.values[i];
+
+        if (FD_ISSET(entry->desc, &fds))
+            add_ready_id(rids, max_ids, &count, entry->id);
+    }
+#else
+    struct epoll_event events[64];
+
+    for (size_t i = 0; i < set->entries.count; i++) {
+        const struct event_entry *entry = &set->entries.values[i];
+
+        if (entry->always_ready) {
+            add_ready_id(rids, max_ids, &count, entry->id);
+            timeout = 0;
+        }
+    }
+
+    start = hs_millis();
+restart:
+    r = epoll_wait(set->epoll_fd, events, _HS_COUNTOF(events), hs_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "epoll_wait() failed: %s", strerror(errno));
+    }
+
+    for (int i = 0; i < r; i++)
+        add_ready_id(rids, max_ids, &count, (int)(uint32_t)(events[i].data.u64 >> 32));
+#endif
+
+    return (int)count;
+}
+
 bool ty_compare_paths(const char *path1, const char *path2)
 {
     assert(path1);
@@ -312,6 +606,82 @@ bool ty_compare_paths(const char *path1, const char *path2)
     return sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino;
 }
 
+int ty_stat_file(const char *path, ty_file_info *rinfo)
+{
+    assert(path);
+    assert(rinfo);
+
+    struct stat sb;
+    int r;
+
+    r = stat(path, &sb);
+    if (r < 0) {
+        switch (errno) {
+            case EACCES: {
+                return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", path);
+            } break;
+            case EIO: {
+                return ty_error(TY_ERROR_IO, "I/O error while getting information about '%s'",
+                                path);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                return ty_error(TY_ERROR_NOT_FOUND, "File '%s' does not exist", path);
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_SYSTEM, "stat('%s') failed: %s", path, strerror(errno));
+            } break;
+        }
+    }
+
+    rinfo->size = (uint64_t)sb.st_size;
+#if defined(__APPLE__)
+    rinfo->mtime = (int64_t)sb.st_mtimespec.tv_sec * 1000000000 + sb.st_mtimespec.tv_nsec;
+#else
+    rinfo->mtime = (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+#endif
+
+    return 0;
+}
+
+int ty_create_directory(const char *path)
+{
+    assert(path);
+
+    char buf[TY_PATH_MAX_SIZE];
+    size_t len;
+
+    len = strlen(path);
+    if (len >= sizeof(buf))
+        return ty_error(TY_ERROR_RANGE, "Path '%s' is too long", path);
+    memcpy(buf, path, len + 1);
+
+    for (size_t i = 1; i <= len; i++) {
+        if (buf[i] && !strchr(TY_PATH_SEPARATORS, buf[i]))
+            continue;
+
+        buf[i] = 0;
+        if (mkdir(buf, 0755) < 0 && errno != EEXIST) {
+            switch (errno) {
+                case EACCES:
+                case EPERM:
+                case EROFS: {
+                    return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", buf);
+                } break;
+
+                default: {
+                    return ty_error(TY_ERROR_SYSTEM, "mkdir('%s') failed: %s", buf,
+                                    strerror(errno));
+                } break;
+            }
+        }
+        buf[i] = path[i];
+    }
+
+    return 0;
+}
+
 int ty_terminal_setup(int flags)
 {
     struct termios tio;
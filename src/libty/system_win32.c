@@ -16,6 +16,11 @@
 #include <shlobj.h>
 #include "system.h"
 
+struct ty_event_set {
+    // WaitForMultipleObjects() cannot wait on more than 64 handles anyway
+    ty_descriptor_set descs;
+};
+
 static DWORD orig_console_mode;
 static bool saved_console_mode;
 
@@ -34,6 +39,74 @@ bool ty_compare_paths(const char *path1, const char *path2)
     return strcasecmp(path1, path2) == 0;
 }
 
+int ty_stat_file(const char *path, ty_file_info *rinfo)
+{
+    assert(path);
+    assert(rinfo);
+
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+
+    if (!GetFileAttributesEx(path, GetFileExInfoStandard, &attr)) {
+        switch (GetLastError()) {
+            case ERROR_ACCESS_DENIED: {
+                return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", path);
+            } break;
+            case ERROR_FILE_NOT_FOUND:
+            case ERROR_PATH_NOT_FOUND: {
+                return ty_error(TY_ERROR_NOT_FOUND, "File '%s' does not exist", path);
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_SYSTEM, "GetFileAttributesEx('%s') failed: %s", path,
+                                hs_win32_strerror(0));
+            } break;
+        }
+    }
+
+    rinfo->size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    rinfo->mtime = (int64_t)(((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) |
+                             attr.ftLastWriteTime.dwLowDateTime);
+
+    return 0;
+}
+
+int ty_create_directory(const char *path)
+{
+    assert(path);
+
+    char buf[TY_PATH_MAX_SIZE];
+    size_t len;
+
+    len = strlen(path);
+    if (len >= sizeof(buf))
+        return ty_error(TY_ERROR_RANGE, "Path '%s' is too long", path);
+    memcpy(buf, path, len + 1);
+
+    for (size_t i = strspn(buf, TY_PATH_SEPARATORS) + 1; i <= len; i++) {
+        if (buf[i] && !strchr(TY_PATH_SEPARATORS, buf[i]))
+            continue;
+
+        /* Drive letters and UNC prefixes cannot be created, only errors for the
+           complete path matter. */
+        buf[i] = 0;
+        if (!CreateDirectory(buf, NULL) && GetLastError() != ERROR_ALREADY_EXISTS && i == len) {
+            switch (GetLastError()) {
+                case ERROR_ACCESS_DENIED: {
+                    return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", buf);
+                } break;
+
+                default: {
+                    return ty_error(TY_ERROR_SYSTEM, "CreateDirectory('%s') failed: %s", buf,
+                                    hs_win32_strerror(0));
+                } break;
+            }
+        }
+        buf[i] = path[i];
+    }
+
+    return 0;
+}
+
 unsigned int ty_descriptor_get_modes(ty_descriptor desc)
 {
     DWORD tmp;
@@ -102,6 +175,10 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
             ADD_SHELL_DIRECTORY(CSIDL_APPDATA);
             ADD_SHELL_DIRECTORY(CSIDL_COMMON_APPDATA);
         } break;
+
+        case TY_PATH_CACHE_DIRECTORY: {
+            ADD_SHELL_DIRECTORY(CSIDL_LOCAL_APPDATA);
+        } break;
     }
 
 #undef ADD_SHELL_DIRECTORY
@@ -146,6 +223,122 @@ int ty_poll(const ty_descriptor_set *set, int timeout)
     return set->id[ret - WAIT_OBJECT_0];
 }
 
+int ty_event_set_new(ty_event_set **rset)
+{
+    assert(rset);
+
+    ty_event_set *set;
+
+    set = calloc(1, sizeof(*set));
+    if (!set)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    *rset = set;
+    return 0;
+}
+
+void ty_event_set_free(ty_event_set *set)
+{
+    free(set);
+}
+
+int ty_event_set_add(ty_event_set *set, ty_descriptor desc, int id)
+{
+    assert(set);
+    assert(desc);
+
+    for (unsigned int i = 0; i < set->descs.count; i++) {
+        if (set->descs.desc[i] == desc)
+            return ty_error(TY_ERROR_EXISTS, "Handle is already in this event set");
+    }
+    if (set->descs.count >= _HS_COUNTOF(set->descs.desc))
+        return ty_error(TY_ERROR_RANGE, "Cannot wait on more than %u handles",
+                        (unsigned int)_HS_COUNTOF(set->descs.desc));
+
+    ty_descriptor_set_add(&set->descs, desc, id);
+    return 0;
+}
+
+int ty_event_set_modify(ty_event_set *set, ty_descriptor desc, int id)
+{
+    assert(set);
+
+    for (unsigned int i = 0; i < set->descs.count; i++) {
+        if (set->descs.desc[i] == desc) {
+            set->descs.id[i] = id;
+            return 0;
+        }
+    }
+
+    return ty_error(TY_ERROR_NOT_FOUND, "Handle is not in this event set");
+}
+
+void ty_event_set_remove(ty_event_set *set, int id)
+{
+    assert(set);
+    ty_descriptor_set_remove(&set->descs, id);
+}
+
+void ty_event_set_clear(ty_event_set *set)
+{
+    assert(set);
+    ty_descriptor_set_clear(&set->descs);
+}
+
+unsigned int ty_event_set_count(const ty_event_set *set)
+{
+    assert(set);
+    return set->descs.count;
+}
+
+static void add_ready_id(int *rids, unsigned int max_ids, unsigned int *rcount, int id)
+{
+    for (unsigned int i = 0; i < *rcount; i++) {
+        if (rids[i] == id)
+            return;
+    }
+    if (*rcount < max_ids)
+        rids[(*rcount)++] = id;
+}
+
+int ty_event_set_wait(ty_event_set *set, int *rids, unsigned int max_ids, int timeout)
+{
+    assert(set);
+    assert(rids);
+    assert(max_ids);
+
+    const ty_descriptor_set *descs = &set->descs;
+    unsigned int count = 0;
+    DWORD ret;
+
+    if (!descs->count) {
+        if (timeout >= 0)
+            Sleep((DWORD)timeout);
+        return 0;
+    }
+
+    ret = WaitForMultipleObjects((DWORD)descs->count, descs->desc, FALSE,
+                                 timeout < 0 ? INFINITE : (DWORD)timeout);
+    switch (ret) {
+        case WAIT_FAILED: {
+            return ty_error(TY_ERROR_SYSTEM, "WaitForMultipleObjects() failed: %s",
+                            hs_win32_strerror(0));
+        } break;
+        case WAIT_TIMEOUT: {
+            return 0;
+        } break;
+    }
+
+    // Only the first signaled handle is reported, check the ones after it
+    add_ready_id(rids, max_ids, &count, descs->id[ret - WAIT_OBJECT_0]);
+    for (DWORD i = ret - WAIT_OBJECT_0 + 1; i < descs->count; i++) {
+        if (WaitForSingleObject(descs->desc[i], 0) == WAIT_OBJECT_0)
+            add_ready_id(rids, max_ids, &count, descs->id[i]);
+    }
+
+    return (int)count;
+}
+
 int ty_terminal_setup(int flags)
 {
     HANDLE handle;
@@ -0,0 +1,590 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifdef __linux__
+    // For struct ucred
+    #define _GNU_SOURCE
+#endif
+#ifndef _WIN32
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+#include "../libhs/array.h"
+#include "../libty/system.h"
+#include "main.h"
+
+/* The daemon sends a single byte once it accepts a connection. The client then sends its
+   standard descriptors with SCM_RIGHTS, along with the size of the request. The request
+   contains the working directory and the arguments (starting with the command name),
+   separated by NUL bytes. The daemon runs the command with these descriptors and answers
+   with the exit code, as a 32-bit integer. If the client goes away in the meantime, the
+   daemon interrupts the board waits of the command.
+
+   Both sides check that the other one runs as the same user, and the socket lives in a
+   directory that only this user can access. */
+
+#define MAX_REQUEST_SIZE 65536
+// Clients run the command themselves if the daemon is busy for longer than this
+#define READY_TIMEOUT 3000
+
+static void print_daemon_usage(FILE *f)
+{
+    fprintf(f, "usage: %s daemon [options]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "The daemon keeps the board monitor running, and the list, reset and upload\n"
+               "commands run through it when it is available. Commands run one at a time, and\n"
+               "run on their own when the daemon stays busy for more than a few seconds.\n\n"
+               "The monitor command, list --watch and upload --wait never use the daemon.\n");
+}
+
+#ifndef _WIN32
+
+// The directory must belong to us, and nobody else can get in
+static bool check_socket_dir(const char *dir)
+{
+    struct stat sb;
+
+    if (lstat(dir, &sb) < 0)
+        return false;
+    if (!S_ISDIR(sb.st_mode) || sb.st_uid != getuid() || (sb.st_mode & 0077)) {
+        ty_log(TY_LOG_WARNING, "Ignoring daemon directory '%s' with unsafe ownership or permissions",
+               dir);
+        return false;
+    }
+
+    return true;
+}
+
+static bool get_socket_address(bool create, struct sockaddr_un *raddr)
+{
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    char dir[sizeof(raddr->sun_path)];
+    int r;
+
+    memset(raddr, 0, sizeof(*raddr));
+    raddr->sun_family = AF_UNIX;
+
+    // Without a runtime directory, make a private one in /tmp
+    if (runtime_dir && runtime_dir[0]) {
+        r = snprintf(dir, sizeof(dir), "%s", runtime_dir);
+    } else {
+        r = snprintf(dir, sizeof(dir), "/tmp/%s-%u", TY_CONFIG_TYCMD_EXECUTABLE,
+                     (unsigned int)getuid());
+        if (r >= 0 && (size_t)r < sizeof(dir) && create && mkdir(dir, 0700) < 0 &&
+                errno != EEXIST) {
+            ty_log(TY_LOG_WARNING, "Cannot create directory '%s': %s", dir, strerror(errno));
+            return false;
+        }
+    }
+    if (r < 0 || (size_t)r >= sizeof(dir) || !check_socket_dir(dir))
+        return false;
+
+    r = snprintf(raddr->sun_path, sizeof(raddr->sun_path), "%s/%s.socket", dir,
+                 TY_CONFIG_TYCMD_EXECUTABLE);
+    return r >= 0 && (size_t)r < sizeof(raddr->sun_path);
+}
+
+static bool check_peer(int fd)
+{
+    uid_t uid;
+
+#ifdef __linux__
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return false;
+    uid = cred.uid;
+#else
+    gid_t gid;
+
+    if (getpeereid(fd, &uid, &gid) < 0)
+        return false;
+#endif
+
+    return uid == getuid();
+}
+
+static int connect_socket(const struct sockaddr_un *addr, int *rfd)
+{
+    int fd;
+
+#ifdef SOCK_CLOEXEC
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+#endif
+    if (fd < 0)
+        return ty_error(TY_ERROR_SYSTEM, "socket() failed: %s", strerror(errno));
+
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return 0;
+    }
+
+    *rfd = fd;
+    return 1;
+}
+
+static int read_full(int fd, void *buf, size_t size)
+{
+    size_t offset = 0;
+
+    while (offset < size) {
+        ssize_t len = read(fd, (uint8_t *)buf + offset, size - offset);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return -1;
+        offset += (size_t)len;
+    }
+
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t size)
+{
+    size_t offset = 0;
+
+    while (offset < size) {
+        ssize_t len = write(fd, (const uint8_t *)buf + offset, size - offset);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            return -1;
+        offset += (size_t)len;
+    }
+
+    return 0;
+}
+
+int forward_to_daemon(int argc, char *argv[], int *rret)
+{
+    struct sockaddr_un addr;
+    char cwd[TY_PATH_MAX_SIZE];
+    int fd = -1;
+    char *buf = NULL;
+    uint32_t size;
+    int32_t ret;
+    int r;
+
+    if (!get_socket_address(false, &addr))
+        return 0;
+    r = connect_socket(&addr, &fd);
+    if (r <= 0)
+        return r;
+
+    // Our descriptors and arguments must not end up with another user
+    if (!check_peer(fd)) {
+        ty_log(TY_LOG_WARNING, "Ignoring daemon socket '%s' owned by another user", addr.sun_path);
+        close(fd);
+        return 0;
+    }
+
+    // The daemon may be stuck on another command, don't wait for it forever
+    {
+        ty_descriptor_set set = {0};
+        uint8_t ready;
+
+        ty_descriptor_set_add(&set, fd, 1);
+        r = ty_poll(&set, READY_TIMEOUT);
+        if (r < 0)
+            goto cleanup;
+        if (!r)
+            ty_log(TY_LOG_WARNING, "Daemon is busy, running command directly");
+        if (!r || read_full(fd, &ready, sizeof(ready)) < 0) {
+            r = 0;
+            goto cleanup;
+        }
+    }
+
+    if (!getcwd(cwd, sizeof(cwd))) {
+        r = ty_error(TY_ERROR_SYSTEM, "getcwd() failed: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    size = (uint32_t)strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++)
+        size += (uint32_t)strlen(argv[i]) + 1;
+    if (size > MAX_REQUEST_SIZE) {
+        r = ty_error(TY_ERROR_PARAM, "Command line is too long for the daemon");
+        goto cleanup;
+    }
+
+    buf = (char *)malloc(size);
+    if (!buf) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    {
+        char *ptr = buf;
+
+        strcpy(ptr, cwd);
+        ptr += strlen(ptr) + 1;
+        for (int i = 0; i < argc; i++) {
+            strcpy(ptr, argv[i]);
+            ptr += strlen(ptr) + 1;
+        }
+    }
+
+    {
+        int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        union {
+            char buf[CMSG_SPACE(sizeof(fds))];
+            struct cmsghdr align;
+        } control;
+        struct iovec iov = {&size, sizeof(size)};
+        struct msghdr msg = {0};
+        struct cmsghdr *cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        if (sendmsg(fd, &msg, 0) < (ssize_t)sizeof(size) || write_full(fd, buf, size) < 0) {
+            r = ty_error(TY_ERROR_IO, "Failed to send command to daemon: %s", strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    // From here on the command may have started, we cannot fall back to running it ourselves
+    if (read_full(fd, &ret, sizeof(ret)) < 0) {
+        r = ty_error(TY_ERROR_IO, "Lost connection to daemon");
+        goto cleanup;
+    }
+
+    *rret = ret;
+    r = 1;
+cleanup:
+    free(buf);
+    close(fd);
+    return r;
+}
+
+static int receive_request(int fd, int rfds[3], char **rbuf, uint32_t *rsize)
+{
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    uint32_t size;
+    struct iovec iov = {&size, sizeof(size)};
+    struct msghdr msg = {0};
+    struct cmsghdr *cmsg;
+    char *buf;
+    ssize_t len;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    do {
+        len = recvmsg(fd, &msg, 0);
+    } while (len < 0 && errno == EINTR);
+    if (!len || (len < 0 && errno == ECONNRESET)) {
+        // Probe from another daemon (see listen_socket), or client that stopped waiting
+        *rbuf = NULL;
+        return 0;
+    }
+    if (len < (ssize_t)sizeof(size))
+        return ty_error(TY_ERROR_IO, "Malformed daemon request");
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        return ty_error(TY_ERROR_IO, "Malformed daemon request");
+    memcpy(rfds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    if (!size || size > MAX_REQUEST_SIZE)
+        goto malformed;
+    buf = (char *)malloc(size);
+    if (!buf) {
+        for (unsigned int i = 0; i < 3; i++)
+            close(rfds[i]);
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+    if (read_full(fd, buf, size) < 0 || buf[size - 1]) {
+        free(buf);
+        goto malformed;
+    }
+
+    *rbuf = buf;
+    *rsize = size;
+    return 0;
+
+malformed:
+    for (unsigned int i = 0; i < 3; i++)
+        close(rfds[i]);
+    return ty_error(TY_ERROR_IO, "Malformed daemon request");
+}
+
+static int run_request(ty_monitor *monitor, int fd, const int saved_fds[3])
+{
+    int fds[3];
+    char *buf = NULL;
+    uint32_t size;
+    _HS_ARRAY(char *) args = {0};
+    int32_t ret = EXIT_FAILURE;
+    int r;
+
+    if (!check_peer(fd))
+        return ty_error(TY_ERROR_ACCESS, "Refusing daemon request from another user");
+
+    // Clients that stopped waiting are gone, receive_request() treats them like probes
+    {
+        uint8_t ready = 1;
+        write_full(fd, &ready, sizeof(ready));
+    }
+
+    // Don't let a stuck client block the daemon forever
+    {
+        struct timeval tv = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    r = receive_request(fd, fds, &buf, &size);
+    if (r < 0)
+        return r;
+    if (!buf)
+        return 0;
+
+    for (char *ptr = buf + strlen(buf) + 1; ptr < buf + size; ptr += strlen(ptr) + 1) {
+        r = _hs_array_push(&args, ptr);
+        if (r < 0) {
+            r = ty_libhs_translate_error(r);
+            goto cleanup;
+        }
+    }
+    r = _hs_array_push(&args, NULL);
+    if (r < 0) {
+        r = ty_libhs_translate_error(r);
+        goto cleanup;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (unsigned int i = 0; i < 3; i++)
+        dup2(fds[i], (int)i);
+
+    if (chdir(buf) < 0) {
+        ty_log(TY_LOG_ERROR, "Cannot change to directory '%s': %s", buf, strerror(errno));
+    } else {
+        /* The client has nothing more to send, so the socket only becomes readable if it
+           goes away (e.g. Ctrl+C). Stop waiting for boards when that happens, or uploads
+           waiting for someone to press the button would block the daemon forever. */
+        r = ty_monitor_set_interrupt_descriptor(monitor, fd);
+        if (r >= 0) {
+            ret = run_forwarded_command((int)args.count - 1, args.values);
+            ty_monitor_clear_interrupt_descriptor(monitor);
+        }
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdin);
+    for (unsigned int i = 0; i < 3; i++)
+        dup2(saved_fds[i], (int)i);
+    if (chdir("/") < 0)
+        ty_log(TY_LOG_WARNING, "Cannot change to directory '/': %s", strerror(errno));
+
+    write_full(fd, &ret, sizeof(ret));
+
+    r = 0;
+cleanup:
+    _hs_array_release(&args);
+    free(buf);
+    for (unsigned int i = 0; i < 3; i++)
+        close(fds[i]);
+    return r;
+}
+
+static int listen_socket(const struct sockaddr_un *addr, int *rfd)
+{
+    const char *path = addr->sun_path;
+    mode_t old_umask;
+    int fd = -1;
+    int r;
+
+    // A socket left behind by a dead daemon refuses connections, it is safe to remove it
+    r = connect_socket(addr, &fd);
+    if (r < 0)
+        return r;
+    if (r) {
+        close(fd);
+        return ty_error(TY_ERROR_BUSY, "Another daemon is listening on '%s'", path);
+    }
+    unlink(path);
+
+#ifdef SOCK_CLOEXEC
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+#endif
+    if (fd < 0)
+        return ty_error(TY_ERROR_SYSTEM, "socket() failed: %s", strerror(errno));
+
+    // The socket runs commands on our boards, keep other users out
+    old_umask = umask(0077);
+    r = bind(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    umask(old_umask);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "bind('%s') failed: %s", path, strerror(errno));
+        close(fd);
+        return r;
+    }
+    if (listen(fd, 16) < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "listen() failed: %s", strerror(errno));
+        close(fd);
+        unlink(path);
+        return r;
+    }
+
+    *rfd = fd;
+    return 0;
+}
+
+static int serve(void)
+{
+    struct sockaddr_un addr;
+    ty_monitor *monitor;
+    int listen_fd = -1;
+    int saved_fds[3] = {-1, -1, -1};
+    int r;
+
+    if (!get_socket_address(true, &addr))
+        return ty_error(TY_ERROR_PARAM, "Cannot find a safe place for the daemon socket");
+
+    // Enumerate once, all the requests reuse this monitor
+    r = get_monitor(&monitor);
+    if (r < 0)
+        return r;
+
+    for (unsigned int i = 0; i < 3; i++) {
+        saved_fds[i] = dup((int)i);
+        if (saved_fds[i] < 0) {
+            r = ty_error(TY_ERROR_SYSTEM, "dup() failed: %s", strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    r = listen_socket(&addr, &listen_fd);
+    if (r < 0)
+        goto cleanup;
+
+    // Clients can go away in the middle of a command
+    signal(SIGPIPE, SIG_IGN);
+
+    ty_log(TY_LOG_INFO, "Listening on '%s'", addr.sun_path);
+
+    while (true) {
+        ty_descriptor_set set = {0};
+
+        ty_monitor_get_descriptors(monitor, &set, 1);
+        ty_descriptor_set_add(&set, listen_fd, 2);
+
+        r = ty_poll(&set, -1);
+        if (r < 0)
+            goto cleanup;
+
+        if (r == 1) {
+            r = ty_monitor_refresh(monitor);
+            if (r < 0)
+                goto cleanup;
+        } else if (r == 2) {
+            int fd;
+
+            fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                r = ty_error(TY_ERROR_SYSTEM, "accept() failed: %s", strerror(errno));
+                goto cleanup;
+            }
+
+            // Pick up events that arrived along with the request
+            r = ty_monitor_refresh(monitor);
+            if (r >= 0)
+                run_request(monitor, fd, saved_fds);
+            close(fd);
+            if (r < 0)
+                goto cleanup;
+        }
+    }
+
+cleanup:
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(addr.sun_path);
+    }
+    for (unsigned int i = 0; i < 3; i++) {
+        if (saved_fds[i] >= 0)
+            close(saved_fds[i]);
+    }
+    return r;
+}
+
+#else
+
+int forward_to_daemon(int argc, char *argv[], int *rret)
+{
+    _HS_UNUSED(argc);
+    _HS_UNUSED(argv);
+    _HS_UNUSED(rret);
+
+    return 0;
+}
+
+static int serve(void)
+{
+    return ty_error(TY_ERROR_UNSUPPORTED, "Daemon mode is not supported on this platform");
+}
+
+#endif
+
+int run_daemon(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_daemon_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (!parse_common_option(&optl, opt)) {
+            print_daemon_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "No positional argument is allowed");
+        print_daemon_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    r = serve();
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -216,6 +216,12 @@ int list(int argc, char *argv[])
     ty_monitor *monitor;
     int r;
 
+    // The daemon runs commands again and again in the same process
+    list_output = OUTPUT_PLAIN;
+    list_verbose = false;
+    list_watch = false;
+    json_comma = false;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
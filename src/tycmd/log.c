@@ -0,0 +1,146 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <time.h>
+#include "main.h"
+#include "../libty/serial_log.h"
+
+static ty_serial_log_query log_query = {INT64_MIN, INT64_MAX, NULL};
+static bool log_timestamps = false;
+static bool log_line_numbers = false;
+
+static void print_log_usage(FILE *f)
+{
+    fprintf(f, "usage: %s log [options] <logs>\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Log options:\n"
+               "       --since <time>       Skip lines older than this (local time)\n"
+               "       --until <time>       Skip lines more recent than this (local time)\n"
+               "   -s, --search <string>    Only print lines that contain this string\n"
+               "   -t, --timestamps         Print the time each line was received\n"
+               "   -n, --line-numbers       Print line numbers\n\n"
+               "Times use the format 'YYYY-MM-DD [HH:MM[:SS]]'.\n");
+}
+
+static bool parse_time(const char *str, int64_t *rtime)
+{
+    struct tm tm = {0};
+    int len = 0;
+
+    if (sscanf(str, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &len) < 3)
+        return false;
+    str += len;
+    if (*str == ' ' || *str == 'T') {
+        len = 0;
+        if (sscanf(str + 1, "%d:%d%n:%d%n", &tm.tm_hour, &tm.tm_min, &len, &tm.tm_sec,
+                   &len) < 2)
+            return false;
+        str += len + 1;
+    }
+    if (*str)
+        return false;
+
+    tm.tm_year -= 1900;
+    tm.tm_mon--;
+    tm.tm_isdst = -1;
+
+    time_t time = mktime(&tm);
+    if (time == (time_t)-1)
+        return false;
+
+    *rtime = (int64_t)time * 1000;
+    return true;
+}
+
+static int print_line(const ty_serial_log_line *line, void *udata)
+{
+    _HS_UNUSED(udata);
+
+    if (log_line_numbers)
+        printf("%8" PRIu64 "  ", line->number + 1);
+    if (log_timestamps) {
+        time_t time = (time_t)(line->time / 1000);
+        struct tm tm;
+        char buf[32];
+
+#ifdef _WIN32
+        localtime_s(&tm, &time);
+#else
+        localtime_r(&time, &tm);
+#endif
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+        printf("%s.%03d  ", buf, (int)(line->time % 1000));
+    }
+
+    fwrite(line->text, 1, line->len, stdout);
+    putchar('\n');
+
+    return 0;
+}
+
+int run_log(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_log_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--since") == 0 || strcmp(opt, "--until") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            int64_t *ptr = (opt[2] == 's') ? &log_query.start_time : &log_query.end_time;
+
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '%s' takes an argument", opt);
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            if (!parse_time(value, ptr)) {
+                ty_log(TY_LOG_ERROR, "Invalid time '%s' for option '%s'", value, opt);
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--search") == 0 || strcmp(opt, "-s") == 0) {
+            log_query.needle = ty_optline_get_value(&optl);
+            if (!log_query.needle) {
+                ty_log(TY_LOG_ERROR, "Option '--search' takes an argument");
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--timestamps") == 0 || strcmp(opt, "-t") == 0) {
+            log_timestamps = true;
+        } else if (strcmp(opt, "--line-numbers") == 0 || strcmp(opt, "-n") == 0) {
+            log_line_numbers = true;
+        } else if (!parse_common_option(&optl, opt)) {
+            print_log_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    opt = ty_optline_consume_non_option(&optl);
+    if (!opt) {
+        ty_log(TY_LOG_ERROR, "Missing log filename");
+        print_log_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    do {
+        r = ty_serial_log_search(opt, &log_query, print_line, NULL);
+        if (r < 0)
+            return EXIT_FAILURE;
+    } while ((opt = ty_optline_consume_non_option(&optl)));
+
+    return EXIT_SUCCESS;
+}
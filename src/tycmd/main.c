@@ -26,11 +26,15 @@ int identify(int argc, char *argv[]);
 int list(int argc, char *argv[]);
 int monitor(int argc, char *argv[]);
 int reset(int argc, char *argv[]);
+int run_daemon(int argc, char *argv[]);
+int run_log(int argc, char *argv[]);
 int upload(int argc, char *argv[]);
 
 static const struct command commands[] = {
+    {"daemon",   run_daemon, "Keep boards monitored and run commands for other instances"},
     {"identify", identify, "Identify models compatible with firmware"},
     {"list",     list,     "List available boards"},
+    {"log",      run_log,  "Print or search serial logs written by TyCommander"},
     {"monitor",  monitor,  "Open serial (or emulated) connection with board"},
     {"reset",    reset,    "Reset board"},
     {"upload",   upload,   "Upload new firmware"},
@@ -43,6 +47,7 @@ static const char *main_board_tag = NULL;
 
 static ty_monitor *main_board_monitor;
 static ty_board *main_board;
+static bool main_board_dirty = false;
 
 static void print_version(FILE *f)
 {
@@ -154,6 +159,17 @@ int get_board(ty_board **rboard)
     if (r < 0)
         return r;
 
+    // The tag can change after the monitor has started, in daemon requests
+    if (main_board_dirty) {
+        ty_board_unref(main_board);
+        main_board = NULL;
+
+        r = ty_monitor_list(main_board_monitor, board_callback, NULL);
+        if (r < 0)
+            return r;
+        main_board_dirty = false;
+    }
+
     if (!main_board) {
         if (main_board_tag) {
             return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' not found", main_board_tag);
@@ -166,6 +182,11 @@ int get_board(ty_board **rboard)
     return 0;
 }
 
+const char *get_board_tag(void)
+{
+    return main_board_tag;
+}
+
 bool parse_common_option(ty_optline_context *optl, char *arg)
 {
     if (strcmp(arg, "--board") == 0 || strcmp(arg, "-B") == 0) {
@@ -174,6 +195,7 @@ bool parse_common_option(ty_optline_context *optl, char *arg)
             ty_log(TY_LOG_ERROR, "Option '--board' takes an argument");
             return false;
         }
+        main_board_dirty = true;
         return true;
     } else if (strcmp(arg, "--quiet") == 0 || strcmp(arg, "-q") == 0) {
         ty_config_verbosity--;
@@ -184,6 +206,68 @@ bool parse_common_option(ty_optline_context *optl, char *arg)
     }
 }
 
+static const struct command *find_command(const char *name)
+{
+    for (const struct command *cmd = commands; cmd->name; cmd++) {
+        if (strcmp(cmd->name, name) == 0)
+            return cmd;
+    }
+
+    return NULL;
+}
+
+/* Only short commands go through the daemon, it runs them one at a time. Watching the
+   board list or a serial monitor would block it, and so would waiting for someone to press
+   the reset button. Their startup cost does not matter anyway. */
+static bool is_forwardable(const struct command *cmd, int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+
+    if (cmd->f != list && cmd->f != reset && cmd->f != upload)
+        return false;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if ((cmd->f == list && (strcmp(opt, "--watch") == 0 || strcmp(opt, "-w") == 0)) ||
+                (cmd->f == upload && (strcmp(opt, "--wait") == 0 || strcmp(opt, "-w") == 0))) {
+            return false;
+        } else if (strcmp(opt, "--board") == 0 || strcmp(opt, "-B") == 0 ||
+                   (cmd->f == list && (strcmp(opt, "--output") == 0 || strcmp(opt, "-O") == 0)) ||
+                   (cmd->f == upload && (strcmp(opt, "--rtc") == 0 || strcmp(opt, "--format") == 0 ||
+                                         strcmp(opt, "-f") == 0 ||
+                                         strcmp(opt, "--board-list") == 0))) {
+            ty_optline_get_value(&optl);
+        }
+    }
+
+    return true;
+}
+
+int run_forwarded_command(int argc, char *argv[])
+{
+    const struct command *cmd;
+    int verbosity = ty_config_verbosity;
+    int r;
+
+    cmd = argc ? find_command(argv[0]) : NULL;
+    if (!cmd || !is_forwardable(cmd, argc, argv)) {
+        ty_log(TY_LOG_ERROR, "Command '%s' cannot run in the daemon", argc ? argv[0] : "");
+        return EXIT_FAILURE;
+    }
+
+    main_board_tag = NULL;
+    main_board_dirty = true;
+
+    r = (*cmd->f)(argc, argv);
+
+    // The options point into the request, which is about to go away
+    main_board_tag = NULL;
+    ty_config_verbosity = verbosity;
+
+    return r;
+}
+
 int main(int argc, char *argv[])
 {
     const struct command *cmd;
@@ -224,16 +308,23 @@ int main(int argc, char *argv[])
         return EXIT_SUCCESS;
     }
 
-    for (cmd = commands; cmd->name; cmd++) {
-        if (strcmp(cmd->name, argv[1]) == 0)
-            break;
-    }
-    if (!cmd->name) {
+    cmd = find_command(argv[1]);
+    if (!cmd) {
         ty_log(TY_LOG_ERROR, "Unknown command '%s'", argv[1]);
         print_main_usage(stderr);
         return EXIT_FAILURE;
     }
 
+    if (is_forwardable(cmd, argc - 1, argv + 1)) {
+        int ret;
+
+        r = forward_to_daemon(argc - 1, argv + 1, &ret);
+        if (r < 0)
+            return EXIT_FAILURE;
+        if (r)
+            return ret;
+    }
+
     r = (*cmd->f)(argc - 1, argv + 1);
 
     ty_board_unref(main_board);
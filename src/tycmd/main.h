@@ -26,6 +26,10 @@ bool parse_common_option(ty_optline_context *optl, char *arg);
 
 int get_monitor(ty_monitor **rmonitor);
 int get_board(ty_board **rboard);
+const char *get_board_tag(void);
+
+int forward_to_daemon(int argc, char *argv[], int *rret);
+int run_forwarded_command(int argc, char *argv[]);
 
 _HS_END_C
 
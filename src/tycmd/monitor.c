@@ -23,6 +23,23 @@ enum {
     DIRECTION_OUTPUT = 2
 };
 
+enum {
+    FORMAT_TEXT,
+    FORMAT_JSON
+};
+
+struct board_stream {
+    ty_board *board;
+    // Open serial interface, NULL while the board is away
+    ty_board_interface *iface;
+    int id;
+    // Without --reconnect, streams end for good when the board goes away
+    bool ended;
+
+    char line[1024];
+    size_t line_len;
+};
+
 #define BUFFER_SIZE 8192
 #define ERROR_IO_TIMEOUT 5000
 
@@ -33,6 +50,14 @@ static hs_serial_config monitor_serial_config = {
 static int monitor_directions = DIRECTION_INPUT | DIRECTION_OUTPUT;
 static bool monitor_reconnect = false;
 static int monitor_timeout_eof = 200;
+static bool monitor_all = false;
+static int monitor_format = FORMAT_TEXT;
+
+static struct board_stream *monitor_streams;
+static unsigned int monitor_streams_count;
+static int monitor_next_stream_id = 2;
+static ty_event_set *monitor_event_set;
+static int monitor_outfd = -1;
 
 #ifdef _WIN32
 static bool monitor_fake_echo;
@@ -61,7 +86,11 @@ static void print_monitor_usage(FILE *f)
                "   -D, --direction <dir>    Open serial connection in given direction\n"
                "                            Supports input, output, both (default)\n"
                "       --timeout-eof <ms>   Time before closing after EOF on standard input\n"
-               "                            Defaults to %d ms, use -1 to disable\n\n", monitor_timeout_eof);
+               "                            Defaults to %d ms, use -1 to disable\n"
+               "       --all                Follow all boards (matching --board), including new ones\n"
+               "                            Standard input is ignored in this mode\n"
+               "       --format <format>    Output format for --all, one line per record\n"
+               "                            Supports text (default) and json\n\n", monitor_timeout_eof);
 
     fprintf(f, "Serial settings:\n"
                "   -b, --baudrate <rate>    Use baudrate for serial port\n"
@@ -211,169 +240,573 @@ static int open_serial_interface(ty_board *board, ty_board_interface **riface)
     return 0;
 }
 
-static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
+static int fill_event_set(ty_event_set *set, ty_board *board)
 {
+    ty_descriptor_set descs = {0};
     ty_board_interface *iface = NULL;
     int r;
 
-    ty_descriptor_set_clear(set);
+    ty_event_set_clear(set);
 
     // Board events / state changes
-    ty_monitor_get_descriptors(ty_board_get_monitor(board), set, 1);
+    ty_monitor_get_descriptors(ty_board_get_monitor(board), &descs, 1);
 
     r = open_serial_interface(board, &iface);
     if (r < 0)
         return r;
 
     if (monitor_directions & DIRECTION_INPUT)
-        ty_board_interface_get_descriptors(iface, set, 2);
+        ty_board_interface_get_descriptors(iface, &descs, 2);
 #ifdef _WIN32
     if (monitor_directions & DIRECTION_OUTPUT) {
         if (monitor_input_available) {
-            ty_descriptor_set_add(set, monitor_input_available, 3);
+            ty_descriptor_set_add(&descs, monitor_input_available, 3);
         } else {
-            ty_descriptor_set_add(set, GetStdHandle(STD_INPUT_HANDLE), 3);
+            ty_descriptor_set_add(&descs, GetStdHandle(STD_INPUT_HANDLE), 3);
         }
     }
 #else
     if (monitor_directions & DIRECTION_OUTPUT)
-        ty_descriptor_set_add(set, STDIN_FILENO, 3);
+        ty_descriptor_set_add(&descs, STDIN_FILENO, 3);
 #endif
 
+    r = ty_event_set_add_descriptors(set, &descs);
+
     /* ty_board_interface_unref() keeps iface->open_count > 0 so the device file does not
        get closed, and we can monitor the descriptor. When the refcount reaches 0, the
        device is closed anyway so we don't leak anything. */
     ty_board_interface_unref(iface);
 
-    return 0;
+    return r;
 }
 
 static int loop(ty_board *board, int outfd)
 {
-    ty_descriptor_set set = {0};
+    ty_event_set *set = NULL;
     int timeout;
     char buf[BUFFER_SIZE];
     ssize_t r;
 
-restart:
-    r = fill_descriptor_set(&set, board);
+    r = ty_event_set_new(&set);
     if (r < 0)
         return (int)r;
+
+restart:
+    r = fill_event_set(set, board);
+    if (r < 0)
+        goto cleanup;
     timeout = -1;
 
     ty_log(TY_LOG_INFO, "Monitoring '%s'", ty_board_get_tag(board));
 
     while (true) {
-        if (!set.count)
-            return 0;
-
-        r = ty_poll(&set, timeout);
-        if (r < 0)
-            return (int)r;
-
-        switch (r) {
-            case 0: {
-                return 0;
-            } break;
+        int ids[3];
+        int ids_count;
 
-            case 1: {
-                r = ty_monitor_refresh(ty_board_get_monitor(board));
-                if (r < 0)
-                    return (int)r;
+        if (!ty_event_set_count(set)) {
+            r = 0;
+            goto cleanup;
+        }
 
-                if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL)) {
-                    if (!monitor_reconnect)
-                        return 0;
+        // Removing descriptors below also drops the remaining ids of this wakeup
+        ids_count = ty_event_set_wait(set, ids, _HS_COUNTOF(ids), timeout);
+        if (ids_count <= 0) {
+            r = ids_count;
+            goto cleanup;
+        }
 
-                    ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(board));
-                    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_SERIAL, -1);
+        for (int i = 0; i < ids_count; i++) {
+            switch (ids[i]) {
+                case 1: {
+                    r = ty_monitor_refresh(ty_board_get_monitor(board));
                     if (r < 0)
-                        return (int)r;
+                        goto cleanup;
 
-                    goto restart;
-                }
-            } break;
+                    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL)) {
+                        if (!monitor_reconnect) {
+                            r = 0;
+                            goto cleanup;
+                        }
 
-            case 2: {
-                r = ty_board_serial_read(board, buf, sizeof(buf), 0);
-                if (r < 0) {
-                    if (r == TY_ERROR_IO && monitor_reconnect) {
-                        timeout = ERROR_IO_TIMEOUT;
-                        ty_descriptor_set_remove(&set, 2);
-                        ty_descriptor_set_remove(&set, 3);
-                        break;
+                        ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(board));
+                        r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_SERIAL, -1);
+                        if (r < 0)
+                            goto cleanup;
+
+                        goto restart;
+                    }
+                } break;
+
+                case 2: {
+                    r = ty_board_serial_read(board, buf, sizeof(buf), 0);
+                    if (r < 0) {
+                        if (r == TY_ERROR_IO && monitor_reconnect) {
+                            timeout = ERROR_IO_TIMEOUT;
+                            ty_event_set_remove(set, 2);
+                            ty_event_set_remove(set, 3);
+                            ids_count = 0;
+                            break;
+                        }
+                        goto cleanup;
                     }
-                    return (int)r;
-                }
 
 #ifdef _WIN32
-                r = write(outfd, buf, (unsigned int)r);
+                    r = write(outfd, buf, (unsigned int)r);
 #else
-                r = write(outfd, buf, (size_t)r);
+                    r = write(outfd, buf, (size_t)r);
 #endif
-                if (r < 0) {
-                    if (errno == EIO)
-                        return ty_error(TY_ERROR_IO, "I/O error on standard output");
-                    return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
-                                    strerror(errno));
-                }
-            } break;
+                    if (r < 0) {
+                        if (errno == EIO) {
+                            r = ty_error(TY_ERROR_IO, "I/O error on standard output");
+                        } else {
+                            r = ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                                         strerror(errno));
+                        }
+                        goto cleanup;
+                    }
+                } break;
 
-            case 3: {
+                case 3: {
 #ifdef _WIN32
-                if (monitor_input_available) {
-                    if (monitor_input_ret < 0)
-                        return (int)monitor_input_ret;
-
-                    memcpy(buf, monitor_input_line, (size_t)monitor_input_ret);
-                    r = monitor_input_ret;
-
-                    ResetEvent(monitor_input_available);
-                    SetEvent(monitor_input_processed);
-                } else {
-                    r = read(STDIN_FILENO, buf, sizeof(buf));
-                }
+                    if (monitor_input_available) {
+                        if (monitor_input_ret < 0) {
+                            r = monitor_input_ret;
+                            goto cleanup;
+                        }
+
+                        memcpy(buf, monitor_input_line, (size_t)monitor_input_ret);
+                        r = monitor_input_ret;
+
+                        ResetEvent(monitor_input_available);
+                        SetEvent(monitor_input_processed);
+                    } else {
+                        r = read(STDIN_FILENO, buf, sizeof(buf));
+                    }
 #else
-                r = read(STDIN_FILENO, buf, sizeof(buf));
+                    r = read(STDIN_FILENO, buf, sizeof(buf));
 #endif
-                if (r < 0) {
-                    if (errno == EIO)
-                        return ty_error(TY_ERROR_IO, "I/O error on standard input");
-                    return ty_error(TY_ERROR_IO, "Failed to read from standard input: %s",
-                                    strerror(errno));
-                }
-                if (!r) {
-                    if (monitor_timeout_eof >= 0) {
-                        /* EOF reached, don't listen to stdin anymore, and start timeout to give some
-                           time for the device to send any data before closing down. */
-                        timeout = monitor_timeout_eof;
-                        ty_descriptor_set_remove(&set, 1);
-                        ty_descriptor_set_remove(&set, 3);
+                    if (r < 0) {
+                        if (errno == EIO) {
+                            r = ty_error(TY_ERROR_IO, "I/O error on standard input");
+                        } else {
+                            r = ty_error(TY_ERROR_IO, "Failed to read from standard input: %s",
+                                         strerror(errno));
+                        }
+                        goto cleanup;
+                    }
+                    if (!r) {
+                        if (monitor_timeout_eof >= 0) {
+                            /* EOF reached, don't listen to stdin anymore, and start timeout to give some
+                               time for the device to send any data before closing down. */
+                            timeout = monitor_timeout_eof;
+                            ty_event_set_remove(set, 1);
+                            ty_event_set_remove(set, 3);
+                            ids_count = 0;
+                            break;
+                        }
+                        break;
                     }
-                    break;
-                }
 
 #ifdef _WIN32
-                if (monitor_fake_echo) {
-                    r = write(outfd, buf, (unsigned int)r);
-                    if (r < 0)
-                        return (int)r;
-                }
+                    if (monitor_fake_echo) {
+                        r = write(outfd, buf, (unsigned int)r);
+                        if (r < 0)
+                            goto cleanup;
+                    }
 #endif
 
-                r = ty_board_serial_write(board, buf, (size_t)r);
-                if (r < 0) {
-                    if (r == TY_ERROR_IO && monitor_reconnect) {
-                        timeout = ERROR_IO_TIMEOUT;
-                        ty_descriptor_set_remove(&set, 2);
-                        ty_descriptor_set_remove(&set, 3);
-                        break;
+                    r = ty_board_serial_write(board, buf, (size_t)r);
+                    if (r < 0) {
+                        if (r == TY_ERROR_IO && monitor_reconnect) {
+                            timeout = ERROR_IO_TIMEOUT;
+                            ty_event_set_remove(set, 2);
+                            ty_event_set_remove(set, 3);
+                            ids_count = 0;
+                            break;
+                        }
+                        goto cleanup;
                     }
-                    return (int)r;
+                } break;
+            }
+        }
+    }
+
+cleanup:
+    ty_event_set_free(set);
+    return (int)r;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len) {
+#ifdef _WIN32
+        int r = write(fd, buf, (unsigned int)len);
+#else
+        ssize_t r = write(fd, buf, len);
+#endif
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EIO)
+                return ty_error(TY_ERROR_IO, "I/O error on standard output");
+            return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                            strerror(errno));
+        }
+
+        buf += r;
+        len -= (size_t)r;
+    }
+
+    return 0;
+}
+
+// Length of the valid UTF-8 sequence at the start of str, or 0 if there is none
+static size_t check_utf8_sequence(const unsigned char *str, size_t len)
+{
+    uint32_t uc;
+    size_t seq_len;
+
+    if (str[0] < 0xC2) {
+        return 0;
+    } else if (str[0] < 0xE0) {
+        seq_len = 2;
+        uc = str[0] & 0x1Fu;
+    } else if (str[0] < 0xF0) {
+        seq_len = 3;
+        uc = str[0] & 0x0Fu;
+    } else if (str[0] < 0xF5) {
+        seq_len = 4;
+        uc = str[0] & 0x07u;
+    } else {
+        return 0;
+    }
+    if (seq_len > len)
+        return 0;
+
+    for (size_t i = 1; i < seq_len; i++) {
+        if ((str[i] & 0xC0) != 0x80)
+            return 0;
+        uc = (uc << 6) | (str[i] & 0x3Fu);
+    }
+
+    // Reject overlong forms, UTF-16 surrogates and code points above U+10FFFF
+    if ((seq_len == 3 && uc < 0x800) || (seq_len == 4 && uc < 0x10000) ||
+            (uc >= 0xD800 && uc <= 0xDFFF) || uc > 0x10FFFF)
+        return 0;
+
+    return seq_len;
+}
+
+/* Serial output is not guaranteed to be UTF-8, invalid bytes are replaced with U+FFFD
+   so that the output stays valid JSON. */
+static size_t append_json_string(char *buf, size_t size, const char *str, size_t len)
+{
+    size_t pos = 0;
+
+    // Leave room for the longest escape sequence and the closing quote
+    for (size_t i = 0; i < len && pos + 8 < size; i++) {
+        unsigned char c = (unsigned char)str[i];
+
+        if (c >= 0x80) {
+            size_t seq_len = check_utf8_sequence((const unsigned char *)str + i, len - i);
+
+            if (seq_len) {
+                memcpy(buf + pos, str + i, seq_len);
+                pos += seq_len;
+                i += seq_len - 1;
+            } else {
+                memcpy(buf + pos, "\\ufffd", 6);
+                pos += 6;
+            }
+            continue;
+        }
+
+        switch (c) {
+            case '"': { memcpy(buf + pos, "\\\"", 2); pos += 2; } break;
+            case '\\': { memcpy(buf + pos, "\\\\", 2); pos += 2; } break;
+            case '\n': { memcpy(buf + pos, "\\n", 2); pos += 2; } break;
+            case '\r': { memcpy(buf + pos, "\\r", 2); pos += 2; } break;
+            case '\t': { memcpy(buf + pos, "\\t", 2); pos += 2; } break;
+
+            default: {
+                if (c < 0x20) {
+                    pos += (size_t)snprintf(buf + pos, size - pos, "\\u%04x", c);
+                } else {
+                    buf[pos++] = (char)c;
                 }
             } break;
         }
     }
+
+    return pos;
+}
+
+static int emit_stream_line(struct board_stream *stream)
+{
+    const char *tag = ty_board_get_tag(stream->board);
+    char out[sizeof(stream->line) * 6 + 512];
+    size_t len = stream->line_len;
+    size_t pos = 0;
+
+    if (len && stream->line[len - 1] == '\r')
+        len--;
+
+    switch (monitor_format) {
+        case FORMAT_TEXT: {
+            size_t tag_len = _HS_MIN(strlen(tag), 256);
+
+            memcpy(out, tag, tag_len);
+            pos = tag_len;
+            memcpy(out + pos, ": ", 2);
+            pos += 2;
+            memcpy(out + pos, stream->line, len);
+            pos += len;
+        } break;
+
+        case FORMAT_JSON: {
+            memcpy(out, "{\"board\": \"", 11);
+            pos = 11;
+            pos += append_json_string(out + pos, 256, tag, strlen(tag));
+            memcpy(out + pos, "\", \"line\": \"", 12);
+            pos += 12;
+            pos += append_json_string(out + pos, sizeof(out) - pos - 3, stream->line, len);
+            memcpy(out + pos, "\"}", 2);
+            pos += 2;
+        } break;
+    }
+    out[pos++] = '\n';
+
+    stream->line_len = 0;
+    return write_all(monitor_outfd, out, pos);
+}
+
+static struct board_stream *find_stream(const ty_board *board, int id)
+{
+    for (unsigned int i = 0; i < monitor_streams_count; i++) {
+        struct board_stream *stream = &monitor_streams[i];
+
+        if (board ? stream->board == board : stream->id == id)
+            return stream;
+    }
+
+    return NULL;
+}
+
+static int attach_stream(struct board_stream *stream)
+{
+    ty_descriptor_set descs = {0};
+    ty_board_interface *iface = NULL;
+    int r;
+
+    r = open_serial_interface(stream->board, &iface);
+    if (r < 0)
+        return r;
+    ty_board_interface_ref(iface);
+
+    ty_board_interface_get_descriptors(iface, &descs, stream->id);
+    r = ty_event_set_add_descriptors(monitor_event_set, &descs);
+    if (r < 0) {
+        ty_event_set_remove(monitor_event_set, stream->id);
+        ty_board_interface_close(iface);
+        ty_board_interface_unref(iface);
+        return r;
+    }
+    stream->iface = iface;
+
+    ty_log(TY_LOG_INFO, "Monitoring '%s'", ty_board_get_tag(stream->board));
+    return 0;
+}
+
+static int detach_stream(struct board_stream *stream)
+{
+    int r = 0;
+
+    if (stream->iface) {
+        ty_event_set_remove(monitor_event_set, stream->id);
+        ty_board_interface_close(stream->iface);
+        ty_board_interface_unref(stream->iface);
+        stream->iface = NULL;
+
+        if (stream->line_len)
+            r = emit_stream_line(stream);
+
+        if (monitor_reconnect) {
+            ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(stream->board));
+        } else {
+            ty_log(TY_LOG_INFO, "Stopped monitoring '%s'", ty_board_get_tag(stream->board));
+            stream->ended = true;
+        }
+    }
+
+    return r;
+}
+
+static void remove_stream(struct board_stream *stream)
+{
+    ty_board_unref(stream->board);
+
+    unsigned int idx = (unsigned int)(stream - monitor_streams);
+    memmove(stream, stream + 1, (monitor_streams_count - idx - 1) * sizeof(*stream));
+    monitor_streams_count--;
+}
+
+static int follow_board(ty_board *board, ty_monitor_event event, void *udata)
+{
+    struct board_stream *stream;
+    int r;
+
+    _HS_UNUSED(udata);
+
+    if (!ty_board_matches_tag(board, get_board_tag()))
+        return 0;
+
+    stream = find_stream(board, 0);
+    switch (event) {
+        case TY_MONITOR_EVENT_ADDED:
+        case TY_MONITOR_EVENT_CHANGED: {
+            if (!stream) {
+                struct board_stream *new_streams;
+
+                new_streams = realloc(monitor_streams,
+                                      (monitor_streams_count + 1) * sizeof(*monitor_streams));
+                if (!new_streams)
+                    return ty_error(TY_ERROR_MEMORY, NULL);
+                monitor_streams = new_streams;
+
+                stream = &monitor_streams[monitor_streams_count++];
+                memset(stream, 0, sizeof(*stream));
+                stream->board = ty_board_ref(board);
+                stream->id = monitor_next_stream_id++;
+            }
+            if (stream->ended)
+                return 0;
+
+            if (ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL)) {
+                if (!stream->iface) {
+                    r = attach_stream(stream);
+                    if (r < 0)
+                        return r;
+                }
+            } else {
+                r = detach_stream(stream);
+                if (r < 0)
+                    return r;
+            }
+        } break;
+
+        case TY_MONITOR_EVENT_DISAPPEARED: {
+            if (stream) {
+                r = detach_stream(stream);
+                if (r < 0)
+                    return r;
+            }
+        } break;
+
+        case TY_MONITOR_EVENT_DROPPED: {
+            if (stream) {
+                r = detach_stream(stream);
+                remove_stream(stream);
+                if (r < 0)
+                    return r;
+            }
+        } break;
+    }
+
+    return 0;
+}
+
+static int read_stream(struct board_stream *stream)
+{
+    char buf[BUFFER_SIZE];
+    ssize_t r;
+
+    r = ty_board_serial_read(stream->board, buf, sizeof(buf), 0);
+    if (r < 0) {
+        // Same as the single board mode, except that other boards keep going
+        if (r == TY_ERROR_IO || r == TY_ERROR_MODE)
+            return detach_stream(stream);
+        return (int)r;
+    }
+
+    for (ssize_t i = 0; i < r; i++) {
+        stream->line[stream->line_len++] = buf[i];
+
+        if (buf[i] == '\n' || stream->line_len == sizeof(stream->line)) {
+            if (buf[i] == '\n')
+                stream->line_len--;
+
+            int r2 = emit_stream_line(stream);
+            if (r2 < 0)
+                return r2;
+        }
+    }
+
+    return 0;
+}
+
+static int loop_all(ty_monitor *monitor, int outfd)
+{
+    ty_descriptor_set descs = {0};
+    int r;
+
+    monitor_outfd = outfd;
+
+    r = ty_event_set_new(&monitor_event_set);
+    if (r < 0)
+        return r;
+
+    // Board events / state changes
+    ty_monitor_get_descriptors(monitor, &descs, 1);
+    r = ty_event_set_add_descriptors(monitor_event_set, &descs);
+    if (r < 0)
+        goto cleanup;
+
+    r = ty_monitor_register_callback(monitor, follow_board, NULL);
+    if (r < 0)
+        goto cleanup;
+    r = ty_monitor_list(monitor, follow_board, NULL);
+    if (r < 0)
+        goto cleanup;
+
+    if (!monitor_streams_count)
+        ty_log(TY_LOG_INFO, "Waiting for boards...");
+
+    while (true) {
+        int ids[64];
+        int ids_count;
+
+        ids_count = ty_event_set_wait(monitor_event_set, ids, _HS_COUNTOF(ids), -1);
+        if (ids_count < 0) {
+            r = ids_count;
+            goto cleanup;
+        }
+
+        for (int i = 0; i < ids_count; i++) {
+            if (ids[i] == 1) {
+                r = ty_monitor_refresh(monitor);
+            } else {
+                // The board may have gone away while we processed the previous ids
+                struct board_stream *stream = find_stream(NULL, ids[i]);
+                r = stream && stream->iface ? read_stream(stream) : 0;
+            }
+            if (r < 0)
+                goto cleanup;
+        }
+    }
+
+cleanup:
+    while (monitor_streams_count) {
+        struct board_stream *stream = &monitor_streams[monitor_streams_count - 1];
+
+        detach_stream(stream);
+        remove_stream(stream);
+    }
+    free(monitor_streams);
+    monitor_streams = NULL;
+    ty_event_set_free(monitor_event_set);
+    monitor_event_set = NULL;
+
+    return r;
 }
 
 int monitor(int argc, char *argv[])
@@ -496,6 +929,25 @@ int monitor(int argc, char *argv[])
                 print_monitor_usage(stderr);
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(opt, "--all") == 0) {
+            monitor_all = true;
+        } else if (strcmp(opt, "--format") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--format' takes an argument");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            if (strcmp(value, "text") == 0) {
+                monitor_format = FORMAT_TEXT;
+            } else if (strcmp(value, "json") == 0) {
+                monitor_format = FORMAT_JSON;
+            } else {
+                ty_log(TY_LOG_ERROR, "--format must be one of: text or json");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
         } else if (strcmp(opt, "--raw") == 0 || strcmp(opt, "-r") == 0) {
             monitor_term_flags |= TY_TERMINAL_RAW;
         } else if (strcmp(opt, "--reconnect") == 0 || strcmp(opt, "-R") == 0) {
@@ -529,8 +981,10 @@ int monitor(int argc, char *argv[])
         print_monitor_usage(stderr);
         return EXIT_FAILURE;
     }
+    if (monitor_all)
+        monitor_directions = DIRECTION_INPUT;
 
-    if (ty_standard_get_modes(TY_STREAM_INPUT) & TY_DESCRIPTOR_MODE_TERMINAL) {
+    if (!monitor_all && (ty_standard_get_modes(TY_STREAM_INPUT) & TY_DESCRIPTOR_MODE_TERMINAL)) {
 #ifdef _WIN32
         if (monitor_term_flags & TY_TERMINAL_RAW && !(monitor_term_flags & TY_TERMINAL_SILENT)) {
             monitor_term_flags |= TY_TERMINAL_SILENT;
@@ -565,11 +1019,21 @@ int monitor(int argc, char *argv[])
     if (r < 0)
         goto cleanup;
 
-    r = get_board(&board);
-    if (r < 0)
-        goto cleanup;
+    if (monitor_all) {
+        ty_monitor *monitor;
 
-    r = loop(board, outfd);
+        r = get_monitor(&monitor);
+        if (r < 0)
+            goto cleanup;
+
+        r = loop_all(monitor, outfd);
+    } else {
+        r = get_board(&board);
+        if (r < 0)
+            goto cleanup;
+
+        r = loop(board, outfd);
+    }
 
 cleanup:
 #ifdef _WIN32
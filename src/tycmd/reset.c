@@ -32,6 +32,9 @@ int reset(int argc, char *argv[])
     ty_task *task = NULL;
     int r;
 
+    // The daemon runs commands again and again in the same process
+    reset_bootloader = false;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
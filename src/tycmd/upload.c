@@ -12,8 +12,25 @@
 #include "../libty/task.h"
 #include "main.h"
 
+struct upload_job {
+    char *tag;
+    ty_board *board;
+    ty_task *task;
+
+    unsigned int progress_step;
+    char error[256];
+};
+
 static int upload_flags = 0;
 static const char *upload_firmware_format = NULL;
+static bool upload_all = false;
+static const char *upload_board_list = NULL;
+
+static struct upload_job *upload_jobs;
+static unsigned int upload_jobs_count;
+
+static ty_message_func *previous_message_handler = ty_message_default_handler;
+static void *previous_message_udata = NULL;
 
 static void print_upload_usage(FILE *f)
 {
@@ -27,11 +44,18 @@ static void print_upload_usage(FILE *f)
                "       --nocheck            Force upload even if the board is not compatible\n"
                "       --noreset            Do not reset the device once the upload is finished\n"
                "       --rtc <MODE>         Set RTC if supported: local (default), utc, none\n"
-               "       --delegate           Reboot the board and let Teensy Loader do the rest\n\n"
+               "       --delegate           Reboot the board and let Teensy Loader do the rest\n"
+               "       --adaptive           Learn and reuse the fastest safe bootloader timings\n"
+               "       --differential       Skip upload if the board already has this firmware\n\n"
                "   -f, --format <format>    Firmware file format (autodetected by default)\n\n"
+               "       --all                Upload to all boards (matching --board) in parallel\n"
+               "       --board-list <file>  Upload in parallel to boards listed in file (one tag\n"
+               "                            per line)\n\n"
                "You can pass multiple firmwares, and the first compatible one will be used.\n\n"
                "Use '-' to read firmware from stdin, in which case you need to specificy the\n"
-               "format with -f <format>.\n\n");
+               "format with -f <format>.\n\n"
+               "Differential uploads rely on a cache of what was last uploaded to each board,\n"
+               "it cannot see uploads made by other tools (such as Teensy Loader).\n\n");
 
     fprintf(f, "Supported firmware formats: ");
     for (unsigned int i = 0; i < ty_firmware_formats_count; i++)
@@ -39,6 +63,302 @@ static void print_upload_usage(FILE *f)
     fprintf(f, ".\n");
 }
 
+static struct upload_job *find_job(const ty_task *task)
+{
+    for (unsigned int i = 0; i < upload_jobs_count; i++) {
+        if (upload_jobs[i].task == task)
+            return &upload_jobs[i];
+    }
+
+    return NULL;
+}
+
+/* Progress bars from several boards would overwrite each other, so we only report
+   progress every 25% on separate lines. Everything else goes to the handler that was
+   installed before the upload started. */
+static void parallel_message_handler(const ty_message_data *msg, void *udata)
+{
+    struct upload_job *job = msg->task ? find_job(msg->task) : NULL;
+
+    _HS_UNUSED(udata);
+
+    if (!job) {
+        (*previous_message_handler)(msg, previous_message_udata);
+        return;
+    }
+
+    switch (msg->type) {
+        case TY_MESSAGE_LOG: {
+            if (msg->u.log.level == TY_LOG_ERROR)
+                snprintf(job->error, sizeof(job->error), "%s", msg->u.log.msg);
+            (*previous_message_handler)(msg, previous_message_udata);
+        } break;
+
+        case TY_MESSAGE_PROGRESS: {
+            unsigned int step = msg->u.progress.max ?
+                                (unsigned int)(4 * msg->u.progress.value / msg->u.progress.max) : 4;
+
+            if (!msg->u.progress.value || step > job->progress_step) {
+                job->progress_step = step;
+                if (ty_config_verbosity >= TY_LOG_INFO)
+                    printf("%28s  %s... %u%%\n", msg->ctx ? msg->ctx : "", msg->u.progress.action,
+                           step * 25);
+                fflush(stdout);
+            }
+        } break;
+
+        case TY_MESSAGE_STATUS: {
+        } break;
+    }
+}
+
+static int add_job(const char *tag)
+{
+    struct upload_job *new_jobs;
+
+    new_jobs = realloc(upload_jobs, (upload_jobs_count + 1) * sizeof(*upload_jobs));
+    if (!new_jobs)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    upload_jobs = new_jobs;
+
+    memset(&upload_jobs[upload_jobs_count], 0, sizeof(*upload_jobs));
+    upload_jobs[upload_jobs_count].tag = strdup(tag);
+    if (!upload_jobs[upload_jobs_count].tag)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    upload_jobs_count++;
+
+    return 0;
+}
+
+static int add_board_job(ty_board *board, ty_monitor_event event, void *udata)
+{
+    const char *tag = udata;
+    int r;
+
+    _HS_UNUSED(event);
+
+    if (!ty_board_matches_tag(board, tag))
+        return 0;
+    if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD) &&
+            !ty_board_has_capability(board, TY_BOARD_CAPABILITY_REBOOT))
+        return 0;
+
+    r = add_job(ty_board_get_tag(board));
+    if (r < 0)
+        return r;
+    upload_jobs[upload_jobs_count - 1].board = ty_board_ref(board);
+
+    return 0;
+}
+
+static bool has_job(const char *tag, const ty_board *board)
+{
+    for (unsigned int i = 0; i < upload_jobs_count; i++) {
+        if (!strcmp(upload_jobs[i].tag, tag) || (board && upload_jobs[i].board == board))
+            return true;
+    }
+
+    return false;
+}
+
+static int load_board_list(ty_monitor *monitor, const char *filename)
+{
+    FILE *fp;
+    char line[256];
+    int r;
+
+restart:
+#ifdef _WIN32
+    fp = fopen(filename, "r");
+#else
+    fp = fopen(filename, "re");
+#endif
+    if (!fp) {
+        switch (errno) {
+            case EINTR: {
+                goto restart;
+            } break;
+
+            case EACCES: {
+                return ty_error(TY_ERROR_ACCESS, "Permission denied for board list '%s'", filename);
+            } break;
+            case EIO: {
+                return ty_error(TY_ERROR_IO, "I/O error while opening board list '%s'", filename);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                return ty_error(TY_ERROR_NOT_FOUND, "Board list '%s' does not exist", filename);
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename,
+                                strerror(errno));
+            } break;
+        }
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        ty_board *board = NULL;
+
+        char *tag = line + strspn(line, " \t");
+        tag[strcspn(tag, "\r\n")] = 0;
+        for (size_t len = strlen(tag); len && strchr(" \t", tag[len - 1]); len--)
+            tag[len - 1] = 0;
+        if (!tag[0] || tag[0] == '#')
+            continue;
+
+        // Two jobs for the same board would fight over it
+        ty_monitor_find_board(monitor, tag, &board);
+        if (has_job(tag, board)) {
+            ty_log(TY_LOG_WARNING, "Board '%s' is listed more than once in '%s'", tag, filename);
+            ty_board_unref(board);
+            continue;
+        }
+
+        r = add_job(tag);
+        if (r < 0) {
+            ty_board_unref(board);
+            goto cleanup;
+        }
+        upload_jobs[upload_jobs_count - 1].board = board;
+    }
+
+    r = 0;
+cleanup:
+    fclose(fp);
+    return r;
+}
+
+static int check_jobs(ty_monitor *monitor, void *udata)
+{
+    _HS_UNUSED(monitor);
+    _HS_UNUSED(udata);
+
+    for (unsigned int i = 0; i < upload_jobs_count; i++) {
+        if (upload_jobs[i].task && !ty_task_wait(upload_jobs[i].task, TY_TASK_STATUS_FINISHED, 0))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int upload_parallel(ty_firmware **fws, unsigned int fws_count)
+{
+    ty_monitor *monitor;
+    ty_pool *pool;
+    unsigned int started = 0, failed = 0;
+    int r;
+
+    r = get_monitor(&monitor);
+    if (r < 0)
+        return r;
+
+    if (upload_board_list) {
+        r = load_board_list(monitor, upload_board_list);
+    } else {
+        r = ty_monitor_list(monitor, add_board_job, (void *)get_board_tag());
+    }
+    if (r < 0)
+        goto cleanup;
+    if (!upload_jobs_count) {
+        r = ty_error(TY_ERROR_NOT_FOUND, "No board available");
+        goto cleanup;
+    }
+
+    // Don't let the pool size decide how many boards get flashed at once
+    r = ty_pool_get_default(&pool);
+    if (r < 0)
+        goto cleanup;
+    if (ty_pool_get_max_threads(pool) < upload_jobs_count) {
+        r = ty_pool_set_max_threads(pool, upload_jobs_count);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    ty_message_get_handler(&previous_message_handler, &previous_message_udata);
+    ty_message_redirect(parallel_message_handler, NULL);
+
+    for (unsigned int i = 0; i < upload_jobs_count; i++) {
+        struct upload_job *job = &upload_jobs[i];
+
+        if (!job->board) {
+            snprintf(job->error, sizeof(job->error), "Board '%s' not found", job->tag);
+            continue;
+        }
+
+        // The firmwares are refcounted and shared by all the tasks
+        r = ty_upload(job->board, fws, fws_count, upload_flags, &job->task);
+        if (r < 0) {
+            snprintf(job->error, sizeof(job->error), "%s", ty_error_last_message());
+            continue;
+        }
+        r = ty_task_start(job->task);
+        if (r < 0) {
+            snprintf(job->error, sizeof(job->error), "%s", ty_error_last_message());
+            ty_task_unref(job->task);
+            job->task = NULL;
+            continue;
+        }
+
+        started++;
+    }
+
+    // The tasks need the main thread to refresh the monitor while they wait for the boards
+    r = 0;
+    if (started) {
+        do {
+            r = ty_monitor_wait(monitor, check_jobs, NULL, 200);
+        } while (!r);
+    }
+
+    /* There is no way to cancel the tasks, so if the monitor failed we have to wait for
+       them to give up before we can free anything they use. */
+    if (r < 0) {
+        for (unsigned int i = 0; i < upload_jobs_count; i++) {
+            if (upload_jobs[i].task)
+                ty_task_join(upload_jobs[i].task);
+        }
+    }
+
+    ty_message_redirect(previous_message_handler, previous_message_udata);
+    if (r < 0)
+        goto cleanup;
+
+    for (unsigned int i = 0; i < upload_jobs_count; i++) {
+        struct upload_job *job = &upload_jobs[i];
+
+        if (!job->task || job->task->ret < 0) {
+            if (!job->error[0])
+                snprintf(job->error, sizeof(job->error), "Upload failed");
+            failed++;
+        }
+    }
+
+    ty_log(TY_LOG_INFO, "Upload summary: %u board(s) succeeded, %u failed",
+           upload_jobs_count - failed, failed);
+    for (unsigned int i = 0; i < upload_jobs_count; i++) {
+        struct upload_job *job = &upload_jobs[i];
+
+        if (job->error[0]) {
+            ty_log(TY_LOG_INFO, "  %-26s FAILED (%s)", job->tag, job->error);
+        } else {
+            ty_log(TY_LOG_INFO, "  %-26s OK", job->tag);
+        }
+    }
+
+    r = failed ? TY_ERROR_OTHER : 0;
+cleanup:
+    for (unsigned int i = 0; i < upload_jobs_count; i++) {
+        ty_task_unref(upload_jobs[i].task);
+        ty_board_unref(upload_jobs[i].board);
+        free(upload_jobs[i].tag);
+    }
+    free(upload_jobs);
+    upload_jobs = NULL;
+    upload_jobs_count = 0;
+    return r;
+}
+
 int upload(int argc, char *argv[])
 {
     ty_optline_context optl;
@@ -49,6 +369,12 @@ int upload(int argc, char *argv[])
     ty_task *task = NULL;
     int r;
 
+    // The daemon runs commands again and again in the same process
+    upload_flags = 0;
+    upload_firmware_format = NULL;
+    upload_all = false;
+    upload_board_list = NULL;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -82,6 +408,10 @@ int upload(int argc, char *argv[])
             }
         } else if (strcmp(opt, "--delegate") == 0) {
             upload_flags |= TY_UPLOAD_DELEGATE;
+        } else if (strcmp(opt, "--adaptive") == 0) {
+            upload_flags |= TY_UPLOAD_ADAPTIVE;
+        } else if (strcmp(opt, "--differential") == 0) {
+            upload_flags |= TY_UPLOAD_DIFFERENTIAL;
         } else if (strcmp(opt, "--format") == 0 || strcmp(opt, "-f") == 0) {
             upload_firmware_format = ty_optline_get_value(&optl);
             if (!upload_firmware_format) {
@@ -89,6 +419,15 @@ int upload(int argc, char *argv[])
                 print_upload_usage(stderr);
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(opt, "--all") == 0) {
+            upload_all = true;
+        } else if (strcmp(opt, "--board-list") == 0) {
+            upload_board_list = ty_optline_get_value(&optl);
+            if (!upload_board_list) {
+                ty_log(TY_LOG_ERROR, "Option '--board-list' takes an argument");
+                print_upload_usage(stderr);
+                return EXIT_FAILURE;
+            }
         } else if (!parse_common_option(&optl, opt)) {
             print_upload_usage(stderr);
             return EXIT_FAILURE;
@@ -113,6 +452,13 @@ int upload(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (upload_all || upload_board_list) {
+        r = upload_parallel(fws, fws_count);
+        for (unsigned int i = 0; i < fws_count; i++)
+            ty_firmware_unref(fws[i]);
+        goto cleanup;
+    }
+
     r = get_board(&board);
     if (r < 0)
         goto cleanup;
@@ -11,11 +11,10 @@
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
-#include <QMutexLocker>
-#include <QPlainTextDocumentLayout>
-#include <QTextBlock>
-#include <QTextCursor>
+
+#include <algorithm>
 
 #include "board.hpp"
 #include "../libhs/device.h"
@@ -27,26 +26,10 @@
 using namespace std;
 
 #define MAX_RECENT_FIRMWARES 4
-#define SERIAL_LOG_DELIMITER "\n@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n"
 
-Board::Board(ty_board *board, QObject *parent)
-    : QObject(parent), board_(ty_board_ref(board))
+Board::Board(ty_board *board, shared_ptr<SerialLogWriter> log_writer, QObject *parent)
+    : QObject(parent), board_(ty_board_ref(board)), serial_log_(log_writer)
 {
-    serial_document_.setDocumentLayout(new QPlainTextDocumentLayout(&serial_document_));
-    serial_document_.setUndoRedoEnabled(false);
-
-    /* Doing font changes in Board is ugly, but the whole shared serial document thing
-       we do is ugly and will need to change eventually. */
-    {
-        QFont font("monospace", 9);
-        if (!QFontInfo(font).fixedPitch()) {
-            font.setStyleHint(QFont::Monospace);
-            if (!QFontInfo(font).fixedPitch())
-                font.setStyleHint(QFont::TypeWriter);
-        }
-        serial_document_.setDefaultFont(font);
-    }
-
     // The monitor will move the serial notifier to a dedicated thread
     connect(&serial_notifier_, &DescriptorNotifier::activated, this, &Board::serialReceived,
             Qt::DirectConnection);
@@ -54,10 +37,20 @@ Board::Board(ty_board *board, QObject *parent)
     error_timer_.setInterval(TY_SHOW_ERROR_TIMEOUT);
     error_timer_.setSingleShot(true);
     connect(&error_timer_, &QTimer::timeout, this, &Board::updateStatus);
+
+    // Called from the log writer thread, or under the log lock
+    serial_log_.setErrorHandler([=](const QString &msg) {
+        ty_log(TY_LOG_ERROR, "%s", msg.toUtf8().constData());
+        QMetaObject::invokeMethod(this, "notifyLog", Qt::QueuedConnection,
+                                  Q_ARG(ty_log_level, TY_LOG_ERROR), Q_ARG(QString, msg));
+        QMetaObject::invokeMethod(this, "settingsChanged", Qt::QueuedConnection);
+    });
 }
 
 Board::~Board()
 {
+    // Make sure the writer thread is done with us before anything goes away
+    serial_log_.close();
     ty_board_interface_close(serial_iface_);
     ty_board_unref(board_);
 }
@@ -86,9 +79,8 @@ void Board::loadSettings(Monitor *monitor)
         serial_codec_name_ = "UTF-8";
         serial_codec_ = QTextCodec::codecForName("UTF-8");
     }
-    serial_decoder_.reset(serial_codec_->makeDecoder());
     clear_on_reset_ = db_.get("clearOnReset", false).toBool();
-    serial_document_.setMaximumBlockCount(db_.get("scrollBackLimit", 200000).toInt());
+    serial_store_.setMaximumLines(db_.get("scrollBackLimit", 200000).toUInt());
     {
         bool default_serial;
         if (model() != TY_MODEL_GENERIC && monitor) {
@@ -393,16 +385,38 @@ TaskInterface Board::sendFile(const QString &filename)
 
 void Board::appendFakeSerialRead(const QString &s)
 {
-    if (serial_log_file_.isOpen()) {
-        auto buf = serial_codec_->fromUnicode(s);
-        QMutexLocker locker(&serial_lock_);
-        writeToSerialLog(buf.constData(), buf.size());
-        locker.unlock();
-    }
+    auto buf = serial_codec_->fromUnicode(s);
 
-    QTextCursor cursor(&serial_document_);
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertText(s);
+    serial_log_.append(buf.constData(), static_cast<size_t>(buf.size()));
+    serial_store_.append(buf.constData(), static_cast<size_t>(buf.size()));
+    emit serialAppended();
+}
+
+bool Board::searchSerialLog(const QDateTime &start, const QDateTime &end,
+                            const QString &needle,
+                            const function<bool(quint64 number, const QDateTime &time,
+                                                const QString &text)> &f)
+{
+    if (serial_log_.filename().isEmpty())
+        return false;
+
+    auto needle_buf = serial_codec_->fromUnicode(needle);
+    ty_serial_log_query query;
+    query.start_time = start.isValid() ? start.toMSecsSinceEpoch() : INT64_MIN;
+    query.end_time = end.isValid() ? end.toMSecsSinceEpoch() : INT64_MAX;
+    query.needle = needle_buf.constData();
+
+    int r = serial_log_.search(query, [&](const ty_serial_log_line &line) {
+        auto text = serial_codec_->toUnicode(line.text, static_cast<int>(line.len));
+        return f(line.number, QDateTime::fromMSecsSinceEpoch(line.time), text) ? 0 : 1;
+    });
+    return r >= 0;
+}
+
+void Board::clearSerial()
+{
+    serial_store_.clear();
+    emit serialReset();
 }
 
 void Board::setTag(const QString &tag)
@@ -480,10 +494,10 @@ void Board::setSerialCodecName(QString codec_name)
 
     serial_codec_name_ = codec_name;
     serial_codec_ = codec;
-    serial_decoder_.reset(serial_codec_->makeDecoder());
 
     db_.put("serialCodec", codec_name);
     emit settingsChanged();
+    emit serialReset();
 }
 
 void Board::setClearOnReset(bool clear_on_reset)
@@ -499,10 +513,10 @@ void Board::setClearOnReset(bool clear_on_reset)
 
 void Board::setScrollBackLimit(unsigned int limit)
 {
-    if (static_cast<int>(limit) == serial_document_.maximumBlockCount())
+    if (limit == serial_store_.maximumLines())
         return;
 
-    serial_document_.setMaximumBlockCount(static_cast<int>(limit));
+    serial_store_.setMaximumLines(limit);
 
     db_.put("scrollBackLimit", limit);
     emit settingsChanged();
@@ -603,95 +617,104 @@ void Board::serialReceived(ty_descriptor desc)
 {
     Q_UNUSED(desc);
 
-    QMutexLocker locker(&serial_lock_);
-
     ty_error_mask(TY_ERROR_MODE);
     ty_error_mask(TY_ERROR_IO);
 
-    size_t previous_len = serial_buf_len_;
+    size_t received = 0;
     /* On OSX El Capitan (at least), serial device reads are often partial (512 and 1020 bytes
        reads happen pretty often), so try hard to empty the OS buffer. The Qt event loop may not
        give us back control before some time, and we want to avoid buffer overruns. */
     for (unsigned int i = 0; i < 4; i++) {
-        if (serial_buf_len_ == sizeof(serial_buf_))
-            break;
+        char *ptr;
+        size_t len = serial_ring_.writeSpan(&ptr);
+
+        if (!len) {
+            /* The GUI thread is behind. Stop reading and leave the data in the OS buffers (and
+               in the device) until appendBufferToSerialStore() makes room, dropping it here
+               is not an option. */
+            serial_notifier_.setEnabled(false);
+            serial_stalled_ = true;
+            atomic_thread_fence(memory_order_seq_cst);
+
+            // Unless the ring was drained in the meantime
+            len = serial_ring_.writeSpan(&ptr);
+            if (!len) {
+                serial_ring_.recordStall();
+                break;
+            }
+            if (serial_stalled_.exchange(false))
+                serial_notifier_.setEnabled(true);
+        }
 
-        int r = ty_board_serial_read(board_, serial_buf_ + serial_buf_len_,
-                                     sizeof(serial_buf_) - serial_buf_len_, 0);
+        int r = ty_board_serial_read(board_, ptr, len, 0);
         if (r < 0) {
             serial_notifier_.clear();
             break;
         }
         if (!r)
             break;
-        serial_buf_len_ += static_cast<size_t>(r);
+
+        serial_log_.append(ptr, static_cast<size_t>(r));
+        serial_ring_.commitWrite(static_cast<size_t>(r));
+        received += static_cast<size_t>(r);
     }
 
     ty_error_unmask();
     ty_error_unmask();
 
-    if (serial_log_file_.isOpen())
-        writeToSerialLog(serial_buf_ + previous_len, serial_buf_len_ - previous_len);
-
-    locker.unlock();
-
-    if (!previous_len && serial_buf_len_)
-        QMetaObject::invokeMethod(this, "appendBufferToSerialDocument", Qt::QueuedConnection);
+    if (received) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!serial_notify_pending_.exchange(true))
+            emit serialPending();
+    }
 }
 
-// You need to lock serial_lock_ before you call this
-void Board::writeToSerialLog(const char *buf, size_t len)
+// Called by Monitor, at most once per frame
+void Board::appendBufferToSerialStore()
 {
-    serial_log_file_.unsetError();
+    serial_notify_pending_ = false;
+    atomic_thread_fence(memory_order_seq_cst);
 
-    qint64 pos = serial_log_file_.pos();
-    if (pos + len > serial_log_size_) {
-        auto part_len = serial_log_size_ - pos;
-        serial_log_file_.write(buf, part_len);
-        serial_log_file_.seek(0);
-        serial_log_file_.write(buf + part_len, len - part_len);
-    } else {
-        serial_log_file_.write(buf, len);
-    }
+    /* Only take what is there now, anything newer comes with another call. Decoding is left
+       to the view, which only does it for the lines it shows. */
+    size_t remaining = serial_ring_.size();
+    bool appended = remaining;
+    while (remaining) {
+        const char *ptr;
+        size_t len = min(serial_ring_.readSpan(&ptr), remaining);
 
-    if (!serial_log_file_.atEnd()) {
-        pos = serial_log_file_.pos();
-        if (pos + sizeof(SERIAL_LOG_DELIMITER) >= serial_log_size_) {
-            serial_log_file_.resize(pos);
-            serial_log_file_.seek(0);
-        } else {
-            serial_log_file_.write(SERIAL_LOG_DELIMITER);
-            serial_log_file_.seek(pos);
-        }
+        serial_store_.append(ptr, len);
+        serial_ring_.commitRead(len);
+        remaining -= len;
     }
 
-    if (serial_log_file_.error() != QFileDevice::NoError) {
-        auto error_msg = QString("Closed serial log file after error: %1")
-                         .arg(serial_log_file_.errorString());
-        ty_log(TY_LOG_ERROR, "%s", error_msg.toUtf8().constData());
-        QMetaObject::invokeMethod(this, "notifyLog", Qt::QueuedConnection,
-                                  Q_ARG(ty_log_level, TY_LOG_ERROR), Q_ARG(QString, error_msg));
-
-        serial_log_file_.close();
-        emit settingsChanged();
+    atomic_thread_fence(memory_order_seq_cst);
+    if (serial_stalled_.exchange(false)) {
+        QMetaObject::invokeMethod(&serial_notifier_, "setEnabled", Qt::QueuedConnection,
+                                  Q_ARG(bool, true));
+        logSerialStalls();
     }
+
+    if (appended)
+        emit serialAppended();
 }
 
-void Board::appendBufferToSerialDocument()
+/* Nothing is lost when the ring fills up, but the device (or the OS) has to hold the data
+   and the user should know why output lags. Once a minute is enough, the tooltip in the
+   board list has the totals. */
+void Board::logSerialStalls()
 {
-    QMutexLocker locker(&serial_lock_);
-    auto str = serial_decoder_->toUnicode(serial_buf_, static_cast<int>(serial_buf_len_));
-    serial_buf_len_ = 0;
-    locker.unlock();
+    auto stats = serial_ring_.stats();
+    auto now = QDateTime::currentMSecsSinceEpoch();
 
-    // Hack to fix extra empty lines when CR and LF are put in separate buffers.
-    // That's something that will go away with VT-100 support.
-    if (str.endsWith('\r'))
-        str.resize(str.size() - 1);
+    if (stats.stalls == serial_stalls_logged_ || now - serial_stall_log_time_ < 60000)
+        return;
 
-    QTextCursor cursor(&serial_document_);
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertText(str);
+    ty_log(TY_LOG_WARNING, "Serial output of '%s' arrives faster than TyCommander can process it, "
+                           "reading was paused %" PRIu64 " time(s)",
+           tag().toUtf8().constData(), stats.stalls - serial_stalls_logged_);
+    serial_stalls_logged_ = stats.stalls;
+    serial_stall_log_time_ = now;
 }
 
 void Board::notifyFinished(bool success, std::shared_ptr<void> result)
@@ -717,7 +740,7 @@ void Board::refreshBoard()
     if (clear_on_reset_) {
         if (hasCapability(TY_BOARD_CAPABILITY_SERIAL)) {
             if (serial_clear_when_available_) {
-                serial_document_.clear();
+                clearSerial();
                 updateSerialLogState(true);
             }
             serial_clear_when_available_ = false;
@@ -783,26 +806,21 @@ void Board::updateSerialLogState(bool new_file)
         return;
     }
 
-    QMutexLocker locker(&serial_lock_);
-
-    if (serial_log_file_.fileName().isEmpty() || new_file) {
-        serial_log_file_.close();
-        serial_log_file_.setFileName(findLogFilename(id(), 4));
-    }
+    if (serial_log_.filename().isEmpty() || new_file)
+        serial_log_.setFilename(findLogFilename(id(), 4));
 
     if (serial_log_size_) {
-        if (!serial_log_file_.isOpen()) {
-            if (!serial_log_file_.open(QIODevice::WriteOnly)) {
+        if (!serial_log_.isOpen()) {
+            if (!serial_log_.open(serial_log_size_)) {
                 ty_log(TY_LOG_ERROR, "Cannot open board log '%s' for writing",
-                       serial_log_file_.fileName().toUtf8().constData());
+                       serial_log_.filename().toUtf8().constData());
             }
+        } else {
+            serial_log_.resize(serial_log_size_);
         }
-        if (serial_log_file_.isOpen() &&
-                static_cast<size_t>(serial_log_file_.size()) > serial_log_size_)
-            serial_log_file_.resize(serial_log_size_);
     } else {
-        serial_log_file_.close();
-        serial_log_file_.remove();
+        serial_log_.close();
+        QFile::remove(serial_log_.filename());
     }
 }
 
@@ -852,7 +870,7 @@ QString Board::findLogFilename(const QString &id, unsigned int max)
     auto dir = serial_log_dir_.isEmpty() ? QDir::tempPath() : serial_log_dir_;
     auto prefix = QString("%1/%2-%3").arg(dir, QCoreApplication::applicationName(), id);
     for (unsigned int i = 1; i <= max; i++) {
-        auto filename = QString("%1-%2.txt").arg(prefix).arg(i);
+        auto filename = QString("%1-%2.tylog").arg(prefix).arg(i);
         QFileInfo info(filename);
 
         if (!info.exists())
@@ -11,16 +11,15 @@
 #ifndef BOARD_HH
 #define BOARD_HH
 
-#include <QFile>
+#include <QDateTime>
 #include <QIcon>
-#include <QMutex>
 #include <QStringList>
 #include <QTextCodec>
-#include <QTextDecoder>
-#include <QTextDocument>
 #include <QThread>
 #include <QTimer>
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -29,6 +28,9 @@
 #include "descriptor_notifier.hpp"
 #include "firmware.hpp"
 #include "../libty/monitor.h"
+#include "serial_log.hpp"
+#include "serial_ring.hpp"
+#include "serial_store.hpp"
 #include "task.hpp"
 
 class Monitor;
@@ -53,12 +55,14 @@ class Board : public QObject, public std::enable_shared_from_this<Board> {
     ty_board_interface *serial_iface_ = nullptr;
     DescriptorNotifier serial_notifier_;
     QTextCodec *serial_codec_;
-    std::unique_ptr<QTextDecoder> serial_decoder_;
-    QMutex serial_lock_;
-    char serial_buf_[262144];
-    size_t serial_buf_len_ = 0;
-    QTextDocument serial_document_;
-    QFile serial_log_file_;
+    // About 1 second of full speed USB, the GUI thread drains it much more often than that
+    SerialRing serial_ring_{1024 * 1024};
+    std::atomic<bool> serial_notify_pending_{false};
+    std::atomic<bool> serial_stalled_{false};
+    uint64_t serial_stalls_logged_ = 0;
+    qint64 serial_stall_log_time_ = 0;
+    SerialStore serial_store_;
+    SerialLog serial_log_;
     bool serial_clear_when_available_ = false;
 
     QTimer error_timer_;
@@ -123,14 +127,15 @@ public:
     QString serialCodecName() const { return serial_codec_name_; }
     QTextCodec *serialCodec() const { return serial_codec_; }
     bool clearOnReset() const { return clear_on_reset_; }
-    unsigned int scrollBackLimit() const { return serial_document_.maximumBlockCount(); }
+    unsigned int scrollBackLimit() const { return static_cast<unsigned int>(serial_store_.maximumLines()); }
     bool enableSerial() const { return enable_serial_; }
     size_t serialLogSize() const { return serial_log_size_; }
-    QString serialLogFilename() const { return serial_log_file_.fileName(); }
+    QString serialLogFilename() const { return serial_log_.filename(); }
 
     bool serialOpen() const { return serial_iface_; }
+    SerialRing::Stats serialStats() const { return serial_ring_.stats(); }
     bool serialIsSerial() const;
-    QTextDocument &serialDocument() { return serial_document_; }
+    SerialStore &serialStore() { return serial_store_; }
 
     static QStringList makeCapabilityList(uint16_t capabilities);
     static QString makeCapabilityString(uint16_t capabilities, QString empty_str = QString());
@@ -145,6 +150,14 @@ public:
     TaskInterface sendFile(const QString &filename);
 
     void appendFakeSerialRead(const QString &s);
+    void clearSerial();
+
+    /* Lines of the serial log file that start within [start, end] and contain needle,
+       from the oldest one. Invalid times leave the range open, and f returns false to
+       stop early. */
+    bool searchSerialLog(const QDateTime &start, const QDateTime &end, const QString &needle,
+                         const std::function<bool(quint64 number, const QDateTime &time,
+                                                  const QString &text)> &f);
 
     TaskInterface task() const { return task_; }
     ty_task_status taskStatus() const { return task_.status(); }
@@ -182,22 +195,29 @@ signals:
 
     void dropped();
 
+    // Emitted from the serial thread, Monitor batches the flushes of all boards
+    void serialPending();
+    void serialAppended();
+    // The whole serial output must be decoded again (cleared, or new codec)
+    void serialReset();
+
 private slots:
     void updateStatus();
 
     void serialReceived(ty_descriptor desc);
-    void appendBufferToSerialDocument();
 
     void notifyFinished(bool success, std::shared_ptr<void> result);
 
 private:
-    Board(ty_board *board, QObject *parent = nullptr);
+    Board(ty_board *board, std::shared_ptr<SerialLogWriter> log_writer,
+          QObject *parent = nullptr);
     void loadSettings(Monitor *monitor);
     QString findLogFilename(const QString &id, unsigned int max);
 
     void setThreadPool(ty_pool *pool) { pool_ = pool; }
 
-    void writeToSerialLog(const char *buf, size_t len);
+    void appendBufferToSerialStore();
+    void logSerialStalls();
 
     void refreshBoard();
     bool updateSerialInterface();
@@ -16,8 +16,12 @@
 #include <QStylePainter>
 #include <QStyleOptionGroupBox>
 #include <QTextBlock>
+#include <QTextCodec>
+
+#include <algorithm>
 
 #include "enhanced_widgets.hpp"
+#include "serial_store.hpp"
 
 using namespace std;
 
@@ -187,10 +191,89 @@ EnhancedPlainText::EnhancedPlainText(const QString &text, QWidget *parent)
     connect(this, &EnhancedPlainText::textChanged, this, &EnhancedPlainText::fixScrollValue);
 }
 
+// Out of line because of std::unique_ptr<QTextDecoder>
+EnhancedPlainText::~EnhancedPlainText()
+{
+}
+
+void EnhancedPlainText::setSerialStore(SerialStore *store, QTextCodec *codec)
+{
+    store_ = store;
+    store_codec_ = codec;
+
+    if (store_) {
+        document()->setMaximumBlockCount(WindowLines);
+        reloadFromStore();
+    } else {
+        store_decoder_.reset();
+        window_first_ = 0;
+        window_end_ = 0;
+        window_tail_ = false;
+        clear();
+    }
+}
+
+void EnhancedPlainText::appendFromStore()
+{
+    if (!store_)
+        return;
+    // The user is reading older lines, moveWindow() catches up when they scroll down
+    if (!window_tail_)
+        return;
+    // Nobody would see it, showEvent() catches up
+    if (!isVisible()) {
+        store_pending_ = true;
+        return;
+    }
+    store_pending_ = false;
+
+    // Appending more than a window would only get trimmed, and what we had may be gone
+    if (store_->startOffset() > window_tail_offset_ ||
+            store_->endLine() - window_end_ >= static_cast<uint64_t>(WindowLines)) {
+        bool autoscroll = monitor_autoscroll_;
+        uint64_t top = window_first_ + static_cast<uint64_t>(verticalScrollBar()->value());
+
+        reloadFromStore();
+        if (!autoscroll) {
+            monitor_autoscroll_ = false;
+            verticalScrollBar()->setValue(static_cast<int>(max(top, window_first_) - window_first_));
+        }
+        return;
+    }
+
+    auto buf = store_->read(window_tail_offset_, store_->endOffset());
+    window_tail_offset_ = store_->endOffset();
+    if (buf.isEmpty())
+        return;
+
+    QTextCursor cursor(document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(decodeStoreBytes(buf));
+
+    // The document drops blocks beyond WindowLines on its own
+    window_end_ = store_->endLine();
+    window_first_ = window_end_ - static_cast<uint64_t>(document()->blockCount());
+}
+
+void EnhancedPlainText::reloadFromStore()
+{
+    if (!store_)
+        return;
+
+    uint64_t end = store_->endLine();
+    loadWindow(end - min(end, static_cast<uint64_t>(WindowLines)));
+
+    monitor_autoscroll_ = true;
+    verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+}
+
 void EnhancedPlainText::showEvent(QShowEvent *e)
 {
     QPlainTextEdit::showEvent(e);
 
+    if (store_pending_)
+        appendFromStore();
+
     /* This is a hacky way to call QPlainTextEditPrivate::_q_adjustScrollbars() without
        private headers, we need that to work around a Qt bug where the scrollbar is not
        updated correctly on text insertions while the widget is hidden. */
@@ -214,6 +297,9 @@ void EnhancedPlainText::keyPressEvent(QKeyEvent *e)
 
 void EnhancedPlainText::fixScrollValue()
 {
+    if (window_moving_)
+        return;
+
     auto vbar = verticalScrollBar();
 
     if (monitor_autoscroll_) {
@@ -228,7 +314,19 @@ void EnhancedPlainText::fixScrollValue()
 
 void EnhancedPlainText::updateScrollInfo()
 {
+    if (window_moving_)
+        return;
+
     auto vbar = verticalScrollBar();
+
+    if (store_) {
+        if (vbar->value() == vbar->minimum() && window_first_ > store_->firstLine()) {
+            moveWindow(false);
+        } else if (vbar->value() == vbar->maximum() && !window_tail_) {
+            moveWindow(true);
+        }
+    }
+
     auto cursor = cursorForPosition(QPoint(0, 0));
 
     monitor_autoscroll_ = vbar->value() >= vbar->maximum() - 1;
@@ -242,3 +340,66 @@ void EnhancedPlainText::updateScrollInfo()
         monitor_cursor_ = cursor;
     }
 }
+
+void EnhancedPlainText::loadWindow(uint64_t first)
+{
+    uint64_t store_first = store_->firstLine();
+    uint64_t store_end = store_->endLine();
+
+    first = max(first, store_first);
+    first = min(first, max(store_first, store_end - min(store_end, static_cast<uint64_t>(WindowLines))));
+    uint64_t end = min(first + static_cast<uint64_t>(WindowLines), store_end);
+
+    // A fresh decoder, so that appends continue where the window ends
+    store_decoder_.reset(store_codec_->makeDecoder());
+    store_decoder_cr_ = false;
+
+    window_moving_ = true;
+    setPlainText(decodeStoreBytes(store_->readLines(first, end)));
+    window_moving_ = false;
+
+    store_pending_ = false;
+    window_first_ = first;
+    window_end_ = end;
+    window_tail_ = (end == store_end);
+    window_tail_offset_ = window_tail_ ? store_->endOffset() : 0;
+}
+
+void EnhancedPlainText::moveWindow(bool forward)
+{
+    auto vbar = verticalScrollBar();
+    uint64_t top = window_first_ + static_cast<uint64_t>(vbar->value());
+
+    if (forward) {
+        loadWindow(window_first_ + WindowLines / 2);
+    } else {
+        loadWindow(window_first_ - min(window_first_, static_cast<uint64_t>(WindowLines / 2)));
+    }
+
+    // Keep the same line at the top of the viewport
+    window_moving_ = true;
+    vbar->setValue(static_cast<int>(max(top, window_first_) - window_first_));
+    window_moving_ = false;
+}
+
+// Same line breaks as the store: LF, CRLF or a lone CR all end up as a single LF
+QString EnhancedPlainText::decodeStoreBytes(const QByteArray &buf)
+{
+    auto str = store_decoder_->toUnicode(buf);
+
+    int len = 0;
+    for (int i = 0; i < str.size(); i++) {
+        QChar c = str[i];
+
+        if (c == '\n' && store_decoder_cr_) {
+            store_decoder_cr_ = false;
+            continue;
+        }
+        store_decoder_cr_ = (c == '\r');
+
+        str[len++] = store_decoder_cr_ ? QChar('\n') : c;
+    }
+    str.truncate(len);
+
+    return str;
+}
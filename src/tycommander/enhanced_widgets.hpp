@@ -17,6 +17,13 @@
 #include <QProxyStyle>
 #include <QStringList>
 
+#include <memory>
+#include <stdint.h>
+
+class QTextCodec;
+class QTextDecoder;
+class SerialStore;
+
 // --------------------------------------------------------
 // EnhancedGroupBox
 // --------------------------------------------------------
@@ -90,16 +97,43 @@ private:
 // EnhancedPlainText
 // --------------------------------------------------------
 
+/* With a serial store, the document only holds a window of WindowLines lines around the
+   viewport. Scrolling to one edge of the window moves it, the rest stays raw bytes. */
 class EnhancedPlainText: public QPlainTextEdit {
     Q_OBJECT
 
     bool monitor_autoscroll_ = true;
     QTextCursor monitor_cursor_;
 
+    SerialStore *store_ = nullptr;
+    QTextCodec *store_codec_ = nullptr;
+    std::unique_ptr<QTextDecoder> store_decoder_;
+    // The last decoded character is a CR, drop the LF if it comes next
+    bool store_decoder_cr_ = false;
+    // Store lines in the document, the block N is the line window_first_ + N
+    uint64_t window_first_ = 0;
+    uint64_t window_end_ = 0;
+    // The window ends with the store, new bytes are appended from window_tail_offset_
+    bool window_tail_ = false;
+    uint64_t window_tail_offset_ = 0;
+    bool window_moving_ = false;
+    // Appends are deferred while the widget is hidden
+    bool store_pending_ = false;
+
 public:
+    static const int WindowLines = 2000;
+
     EnhancedPlainText(QWidget *parent = nullptr)
         : EnhancedPlainText(QString(), parent) {}
     EnhancedPlainText(const QString &text, QWidget *parent = nullptr);
+    ~EnhancedPlainText();
+
+    void setSerialStore(SerialStore *store, QTextCodec *codec);
+    SerialStore *serialStore() const { return store_; }
+
+public slots:
+    void appendFromStore();
+    void reloadFromStore();
 
 protected:
     void showEvent(QShowEvent *e) override;
@@ -111,6 +145,10 @@ private slots:
 
 private:
     void updateScrollInfo();
+
+    void loadWindow(uint64_t first);
+    void moveWindow(bool forward);
+    QString decodeStoreBytes(const QByteArray &buf);
 };
 
 #endif
@@ -25,10 +25,15 @@ shared_ptr<Firmware> Firmware::load(const QString &filename)
             : Firmware(fw) {}
     };
 
+    ty_firmware_cache *cache;
     ty_firmware *fw;
     int r;
 
-    r = ty_firmware_load_file(filename.toLocal8Bit().constData(), nullptr, nullptr, &fw);
+    // The same firmware often gets uploaded to many boards, don't parse it every time
+    r = ty_firmware_cache_get_default(&cache);
+    if (r < 0)
+        return nullptr;
+    r = ty_firmware_cache_load(cache, filename.toLocal8Bit().constData(), nullptr, &fw);
     if (r < 0)
         return nullptr;
 
@@ -10,6 +10,7 @@
 
 #include <QDesktopServices>
 #include <QFileDialog>
+#include <QFontInfo>
 #include <QScrollBar>
 #include <QShortcut>
 #include <QTextCodec>
@@ -217,6 +218,17 @@ MainWindow::MainWindow(QWidget *parent)
             autoFocusBoardWidgets();
     });
     serialText->setWordWrapMode(QTextOption::NoWrap);
+    serialText->setUndoRedoEnabled(false);
+    {
+        QFont font("monospace", 9);
+        if (!QFontInfo(font).fixedPitch()) {
+            font.setStyleHint(QFont::Monospace);
+            if (!QFontInfo(font).fixedPitch())
+                font.setStyleHint(QFont::TypeWriter);
+        }
+        serialText->setFont(font);
+        serialEdit->setFont(font);
+    }
     connect(serialText, &QPlainTextEdit::customContextMenuRequested, this,
             &MainWindow::openSerialContextMenu);
     connect(serialEdit, &EnhancedLineInput::textCommitted, this, &MainWindow::sendToSelectedBoards);
@@ -641,7 +653,11 @@ void MainWindow::makeSendFileCommand()
 
 void MainWindow::clearSerialDocument()
 {
-    serialText->clear();
+    if (current_board_) {
+        current_board_->clearSerial();
+    } else {
+        serialText->clear();
+    }
 }
 
 void MainWindow::initCodecList()
@@ -688,12 +704,7 @@ void MainWindow::enableBoardWidgets()
     optionsTab->setEnabled(true);
     actionEnableSerial->setEnabled(true);
 
-    QTextDocument *document = &current_board_->serialDocument();
-    serialText->setDocument(document);
-    serialText->moveCursor(QTextCursor::End);
-    serialText->verticalScrollBar()->setValue(serialText->verticalScrollBar()->maximum());
-    serialText->setFont(document->defaultFont());
-    serialEdit->setFont(document->defaultFont());
+    serialText->setSerialStore(&current_board_->serialStore(), current_board_->serialCodec());
 
     actionRenameBoard->setEnabled(true);
 }
@@ -814,7 +825,8 @@ void MainWindow::updateSerialLogLink()
         serialLogFileLabel->setText(QString("<a href=\"%1\">%2</a>")
                                     .arg(QUrl::fromLocalFile(log_filename).toString(),
                                          log_info.fileName()));
-        serialLogFileLabel->setToolTip(QDir::toNativeSeparators(log_filename));
+        serialLogFileLabel->setToolTip(tr("%1\n\nCompressed log, read it with 'tycmd log'")
+                                       .arg(QDir::toNativeSeparators(log_filename)));
         link_font.setItalic(false);
     } else {
         serialLogDirLabel->setText(tr("No serial log available"));
@@ -858,7 +870,7 @@ void MainWindow::selectionChanged(const QItemSelection &newsel, const QItemSelec
 
     for (auto &board: selected_boards_)
         board->disconnect(this);
-    serialText->setDocument(nullptr);
+    serialText->setSerialStore(nullptr, nullptr);
     selected_boards_.clear();
     current_board_ = nullptr;
 
@@ -884,6 +896,13 @@ void MainWindow::selectionChanged(const QItemSelection &newsel, const QItemSelec
         connect(current_board_, &Board::interfacesChanged, this, &MainWindow::refreshInterfaces);
         connect(current_board_, &Board::statusChanged, this, &MainWindow::refreshStatus);
         connect(current_board_, &Board::progressChanged, this, &MainWindow::refreshProgress);
+        // Context is this and not serialText, so that board->disconnect(this) drops them
+        connect(current_board_, &Board::serialAppended, this, [=]() {
+            serialText->appendFromStore();
+        });
+        connect(current_board_, &Board::serialReset, this, [=]() {
+            serialText->setSerialStore(&current_board_->serialStore(), current_board_->serialCodec());
+        });
 
         enableBoardWidgets();
         refreshActions();
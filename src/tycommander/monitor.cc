@@ -15,17 +15,27 @@
 #include "database.hpp"
 #include "descriptor_notifier.hpp"
 #include "monitor.hpp"
+#include "serial_log.hpp"
 #include "../libhs/platform.h"
 #include "../libty/task.h"
 
 using namespace std;
 
+// About one flush per frame, whatever the number of boards and how much they print
+static const int SERIAL_FLUSH_INTERVAL = 16;
+
 Monitor::Monitor(QObject *parent)
     : QAbstractListModel(parent)
 {
     int r = ty_pool_new(&pool_);
     if (r < 0)
         throw bad_alloc();
+    serial_log_writer_ = make_shared<SerialLogWriter>();
+
+    serial_flush_timer_.setSingleShot(true);
+    serial_flush_timer_.setTimerType(Qt::PreciseTimer);
+    connect(&serial_flush_timer_, &QTimer::timeout, this, &Monitor::flushSerial);
+    serial_flush_clock_.start();
 
     loadSettings();
 }
@@ -60,6 +70,7 @@ void Monitor::loadSettings()
     default_serial_ = db_.get("serialByDefault", true).toBool();
     serial_log_size_ = db_.get("serialLogSize", 20000000ull).toULongLong();
     serial_log_dir_ = db_.get("serialLogDir", "").toString();
+    serial_log_writer_->setSyncInterval(db_.get("serialLogSyncInterval", 0).toInt());
 
     emit settingsChanged();
 
@@ -195,6 +206,22 @@ void Monitor::setSerialLogDir(const QString &dir)
     emit settingsChanged();
 }
 
+int Monitor::serialLogSyncInterval() const
+{
+    return serial_log_writer_->syncInterval();
+}
+
+void Monitor::setSerialLogSyncInterval(int interval)
+{
+    if (interval == serial_log_writer_->syncInterval())
+        return;
+
+    serial_log_writer_->setSyncInterval(interval);
+
+    db_.put("serialLogSyncInterval", interval);
+    emit settingsChanged();
+}
+
 bool Monitor::start()
 {
     if (started_)
@@ -338,13 +365,20 @@ QVariant Monitor::data(const QModelIndex &index, int role) const
 
     if (index.column() == 0) {
         switch (role) {
-            case Qt::ToolTipRole:
-                return tr("%1\n+ Location: %2\n+ Serial Number: %3\n+ Status: %4\n+ Capabilities: %5")
+            case Qt::ToolTipRole: {
+                auto stats = board->serialStats();
+
+                return tr("%1\n+ Location: %2\n+ Serial Number: %3\n+ Status: %4\n+ Capabilities: %5\n"
+                          "+ Serial Input: %6 kB received, %7 kB buffered at most, paused %8 time(s)")
                        .arg(board->modelName())
                        .arg(board->location())
                        .arg(board->serialNumber())
                        .arg(board->statusText())
-                       .arg(Board::makeCapabilityString(board->capabilities(), tr("(none)")));
+                       .arg(Board::makeCapabilityString(board->capabilities(), tr("(none)")))
+                       .arg(stats.received / 1000)
+                       .arg(stats.high_water / 1000)
+                       .arg(stats.stalls);
+            }
             case Qt::DecorationRole:
                 return board->statusIcon();
             case Qt::EditRole:
@@ -434,10 +468,10 @@ void Monitor::handleAddedEvent(ty_board *board)
 
     // Work around the private constructor for make_shared()
     struct BoardSharedEnabler : public Board {
-        BoardSharedEnabler(ty_board *board)
-            : Board(board) {}
+        BoardSharedEnabler(ty_board *board, shared_ptr<SerialLogWriter> log_writer)
+            : Board(board, log_writer) {}
     };
-    auto board_wrapper_ptr = make_shared<BoardSharedEnabler>(board);
+    auto board_wrapper_ptr = make_shared<BoardSharedEnabler>(board, serial_log_writer_);
     auto board_wrapper = board_wrapper_ptr.get();
 
     if (board_wrapper->hasCapability(TY_BOARD_CAPABILITY_UNIQUE))
@@ -469,6 +503,7 @@ void Monitor::handleAddedEvent(ty_board *board)
     connect(board_wrapper, &Board::dropped, this, [=]() {
         removeBoardItem(findBoardIterator(board));
     });
+    connect(board_wrapper, &Board::serialPending, this, &Monitor::scheduleSerialFlush);
 
     auto insert_it = std::find_if(boards_.begin(), boards_.end(),
         [&](const std::shared_ptr<Board> &it) { return board_wrapper->id() < it->id(); });
@@ -490,6 +525,27 @@ void Monitor::handleChangedEvent(ty_board *board)
     ptr->refreshBoard();
 }
 
+void Monitor::scheduleSerialFlush()
+{
+    if (serial_flush_timer_.isActive())
+        return;
+
+    // Don't delay output that comes after a quiet period
+    auto elapsed = serial_flush_clock_.elapsed();
+    serial_flush_timer_.start(elapsed < SERIAL_FLUSH_INTERVAL
+                              ? SERIAL_FLUSH_INTERVAL - static_cast<int>(elapsed) : 0);
+}
+
+void Monitor::flushSerial()
+{
+    serial_flush_clock_.restart();
+
+    for (auto &board: boards_) {
+        if (board->serial_notify_pending_)
+            board->appendBufferToSerialStore();
+    }
+}
+
 void Monitor::refreshBoardItem(iterator it)
 {
     auto index = createIndex(it - boards_.begin(), 0);
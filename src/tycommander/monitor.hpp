@@ -12,7 +12,9 @@
 #define MONITOR_HH
 
 #include <QAbstractListModel>
+#include <QElapsedTimer>
 #include <QThread>
+#include <QTimer>
 
 #include <memory>
 #include <vector>
@@ -22,6 +24,7 @@
 #include "../libty/monitor.h"
 
 class Board;
+class SerialLogWriter;
 struct ty_board;
 struct ty_pool;
 
@@ -37,6 +40,8 @@ class Monitor : public QAbstractListModel {
 
     ty_pool *pool_;
     QThread serial_thread_;
+    QTimer serial_flush_timer_;
+    QElapsedTimer serial_flush_clock_;
 
     bool ignore_generic_;
     bool ignore_secondary_;
@@ -44,6 +49,7 @@ class Monitor : public QAbstractListModel {
     bool default_serial_;
     size_t serial_log_size_;
     QString serial_log_dir_;
+    std::shared_ptr<SerialLogWriter> serial_log_writer_;
 
     std::vector<std::shared_ptr<Board>> boards_;
 
@@ -83,6 +89,7 @@ public:
     bool serialByDefault() const { return default_serial_; }
     size_t serialLogSize() const { return serial_log_size_; }
     QString serialLogDir() const { return serial_log_dir_; }
+    int serialLogSyncInterval() const;
 
     bool start();
     void stop();
@@ -122,6 +129,7 @@ public slots:
     void setSerialByDefault(bool default_serial);
     void setSerialLogSize(size_t default_size);
     void setSerialLogDir(const QString &dir);
+    void setSerialLogSyncInterval(int interval);
 
 signals:
     void settingsChanged();
@@ -130,6 +138,7 @@ signals:
 
 private slots:
     void refresh(ty_descriptor desc);
+    void flushSerial();
 
 private:
     iterator findBoardIterator(ty_board *board);
@@ -142,6 +151,8 @@ private:
     void removeBoardItem(iterator it);
 
     void configureBoardDatabase(Board &board);
+
+    void scheduleSerialFlush();
 };
 
 #endif
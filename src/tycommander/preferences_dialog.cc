@@ -54,6 +54,7 @@ void PreferencesDialog::apply()
     monitor->setSerialByDefault(serialByDefaultCheck->isChecked());
     monitor->setSerialLogSize(serialLogSizeDefaultSpin->value() * 1000);
     monitor->setSerialLogDir(serialLogDir->text());
+    monitor->setSerialLogSyncInterval(serialLogSyncSpin->value() * 1000);
     monitor->setMaxTasks(maxTasksSpin->value());
 }
 
@@ -79,6 +80,7 @@ void PreferencesDialog::refresh()
     serialByDefaultCheck->setChecked(monitor->serialByDefault());
     serialLogSizeDefaultSpin->setValue(static_cast<int>(monitor->serialLogSize() / 1000));
     serialLogDir->setText(monitor->serialLogDir());
+    serialLogSyncSpin->setValue(monitor->serialLogSyncInterval() / 1000);
     maxTasksSpin->setValue(monitor->maxTasks());
 }
 
@@ -0,0 +1,397 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <algorithm>
+
+#include "serial_log.hpp"
+#include "../libty/common.h"
+
+using namespace std;
+
+// How long the writer waits for more output before it writes what it has
+static const chrono::milliseconds FLUSH_DELAY(100);
+/* Full blocks are written once, but each tail write compresses and rewrites the whole
+   partial block, so readers only get recent output this often (or when they search). */
+static const chrono::milliseconds TAIL_INTERVAL(10000);
+
+// Write errors are reported by the error handler, don't log them twice
+struct LogErrorMask {
+    LogErrorMask()
+    {
+        ty_error_mask(TY_ERROR_IO);
+        ty_error_mask(TY_ERROR_SYSTEM);
+        ty_error_mask(TY_ERROR_MEMORY);
+    }
+    ~LogErrorMask()
+    {
+        for (unsigned int i = 0; i < 3; i++)
+            ty_error_unmask();
+    }
+};
+
+SerialLogWriter::SerialLogWriter()
+{
+    thread_ = thread(&SerialLogWriter::run, this);
+}
+
+SerialLogWriter::~SerialLogWriter()
+{
+    {
+        lock_guard<mutex> locker(mutex_);
+        run_ = false;
+    }
+    cv_.notify_one();
+
+    thread_.join();
+}
+
+void SerialLogWriter::setSyncInterval(int interval)
+{
+    {
+        lock_guard<mutex> locker(mutex_);
+        sync_interval_ = max(interval, 0);
+    }
+    cv_.notify_one();
+}
+
+int SerialLogWriter::syncInterval()
+{
+    lock_guard<mutex> locker(mutex_);
+    return sync_interval_;
+}
+
+void SerialLogWriter::registerLog(SerialLog *log)
+{
+    lock_guard<mutex> locker(logs_mutex_);
+    logs_.push_back(log);
+}
+
+void SerialLogWriter::unregisterLog(SerialLog *log)
+{
+    lock_guard<mutex> locker(logs_mutex_);
+    logs_.erase(remove(logs_.begin(), logs_.end(), log), logs_.end());
+}
+
+void SerialLogWriter::notify(bool urgent)
+{
+    {
+        lock_guard<mutex> locker(mutex_);
+        dirty_ = true;
+        urgent_ |= urgent;
+    }
+    cv_.notify_one();
+}
+
+void SerialLogWriter::run()
+{
+    auto last_sync = chrono::steady_clock::now();
+    auto last_tail = last_sync;
+    bool unsynced = false;
+    bool tail_pending = false;
+
+    unique_lock<mutex> locker(mutex_);
+    while (run_) {
+        if (!dirty_) {
+            auto deadline = chrono::steady_clock::time_point::max();
+            if (tail_pending)
+                deadline = last_tail + TAIL_INTERVAL;
+            if (unsynced && sync_interval_)
+                deadline = min(deadline, last_sync + chrono::milliseconds(sync_interval_));
+
+            if (deadline != chrono::steady_clock::time_point::max()) {
+                cv_.wait_until(locker, deadline);
+            } else {
+                cv_.wait(locker);
+            }
+        }
+        if (dirty_ && !urgent_) {
+            // Give the serial threads some time to fill the buffers
+            cv_.wait_for(locker, FLUSH_DELAY, [&]() { return urgent_ || !run_; });
+        }
+        if (!run_)
+            break;
+
+        bool write = dirty_;
+        dirty_ = false;
+        urgent_ = false;
+        auto now = chrono::steady_clock::now();
+        bool sync = (write || unsynced) && sync_interval_ &&
+                    now - last_sync >= chrono::milliseconds(sync_interval_);
+        // Syncing writes the tail too
+        bool tail = !sync && (write || tail_pending) && now - last_tail >= TAIL_INTERVAL;
+        locker.unlock();
+
+        {
+            lock_guard<mutex> logs_locker(logs_mutex_);
+            for (auto log: logs_) {
+                if (write)
+                    log->writePending();
+                if (sync) {
+                    log->sync();
+                } else if (tail) {
+                    log->writeTail();
+                }
+            }
+        }
+
+        locker.lock();
+        if (sync) {
+            last_sync = now;
+            unsynced = false;
+        } else if (write) {
+            unsynced = true;
+        }
+        if (sync || tail) {
+            last_tail = now;
+            tail_pending = false;
+        } else if (write) {
+            tail_pending = true;
+        }
+    }
+}
+
+SerialLog::SerialLog(shared_ptr<SerialLogWriter> writer)
+    : writer_(writer)
+{
+    writer_->registerLog(this);
+}
+
+SerialLog::~SerialLog()
+{
+    close();
+    writer_->unregisterLog(this);
+}
+
+void SerialLog::setFilename(const QString &filename)
+{
+    close();
+    filename_ = filename;
+}
+
+bool SerialLog::open(size_t size)
+{
+    lock_guard<mutex> locker(file_mutex_);
+
+    closeLocked();
+
+    {
+        lock_guard<mutex> buffer_locker(buffer_mutex_);
+        buffer_.clear();
+        marks_.clear();
+        dropped_ = 0;
+    }
+
+    int r = ty_serial_log_open(filename_.toLocal8Bit().constData(), size, &log_);
+    if (r < 0)
+        return false;
+    unsynced_ = false;
+
+    open_ = true;
+    return true;
+}
+
+bool SerialLog::resize(size_t size)
+{
+    lock_guard<mutex> locker(file_mutex_);
+
+    writePendingLocked();
+    if (!log_)
+        return false;
+
+    LogErrorMask mask;
+    int r = ty_serial_log_resize(log_, size);
+    if (r < 0) {
+        fail();
+        return false;
+    }
+    unsynced_ = true;
+
+    return true;
+}
+
+void SerialLog::close()
+{
+    lock_guard<mutex> locker(file_mutex_);
+
+    if (log_)
+        writePendingLocked();
+    closeLocked();
+}
+
+void SerialLog::closeLocked()
+{
+    open_ = false;
+    {
+        LogErrorMask mask;
+        ty_serial_log_close(log_);
+    }
+    log_ = nullptr;
+
+    lock_guard<mutex> buffer_locker(buffer_mutex_);
+    buffer_.clear();
+    marks_.clear();
+}
+
+void SerialLog::append(const char *buf, size_t len)
+{
+    if (!open_ || !len)
+        return;
+
+    int64_t now = chrono::duration_cast<chrono::milliseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+
+    bool notify, urgent, warn = false;
+    {
+        lock_guard<mutex> locker(buffer_mutex_);
+
+        size_t prev_len = buffer_.size();
+        if (marks_.empty() || marks_.back().time != now)
+            marks_.push_back({prev_len, now});
+        buffer_.append(buf, len);
+
+        // The disk does not keep up, drop half of the buffer at once to amortize the copy
+        if (buffer_.size() > MaxPending) {
+            size_t drop = buffer_.size() - MaxPending / 2;
+            buffer_.erase(0, drop);
+
+            // Keep the mark in effect at the new start of the buffer
+            auto it = upper_bound(marks_.begin(), marks_.end(), drop,
+                                  [](size_t offset, const TimeMark &mark) {
+                return offset < mark.offset;
+            });
+            marks_.erase(marks_.begin(), it - 1);
+            for (auto &mark: marks_)
+                mark.offset = mark.offset > drop ? mark.offset - drop : 0;
+
+            warn = !dropped_;
+            dropped_ += drop;
+        }
+
+        notify = !prev_len;
+        urgent = prev_len < FlushThreshold && buffer_.size() >= FlushThreshold;
+    }
+
+    if (warn)
+        ty_log(TY_LOG_WARNING, "Serial log writes cannot keep up, dropping output");
+    if (notify || urgent)
+        writer_->notify(urgent);
+}
+
+void SerialLog::flush()
+{
+    writePending();
+    sync();
+}
+
+uint64_t SerialLog::droppedBytes()
+{
+    lock_guard<mutex> locker(buffer_mutex_);
+    return dropped_;
+}
+
+static int search_line(const ty_serial_log_line *line, void *udata)
+{
+    auto f = static_cast<const function<int(const ty_serial_log_line &line)> *>(udata);
+    return (*f)(*line);
+}
+
+int SerialLog::search(const ty_serial_log_query &query,
+                      const function<int(const ty_serial_log_line &line)> &f)
+{
+    writePending();
+    writeTail();
+
+    // The writer thread can keep going, readers stop at blocks being rewritten
+    return ty_serial_log_search(filename_.toLocal8Bit().constData(), &query, search_line,
+                                const_cast<function<int(const ty_serial_log_line &line)> *>(&f));
+}
+
+void SerialLog::writePending()
+{
+    lock_guard<mutex> locker(file_mutex_);
+    writePendingLocked();
+}
+
+void SerialLog::writeTail()
+{
+    lock_guard<mutex> locker(file_mutex_);
+
+    if (!log_)
+        return;
+
+    LogErrorMask mask;
+    if (ty_serial_log_flush(log_) < 0)
+        fail();
+}
+
+// Full blocks go to the file as they fill up, the partial tail block stays in memory
+void SerialLog::writePendingLocked()
+{
+    {
+        lock_guard<mutex> buffer_locker(buffer_mutex_);
+        writing_.swap(buffer_);
+        writing_marks_.swap(marks_);
+    }
+    if (writing_.empty() || !log_) {
+        writing_.clear();
+        writing_marks_.clear();
+        return;
+    }
+
+    LogErrorMask mask;
+    int r = 0;
+    for (size_t i = 0; i < writing_marks_.size() && r >= 0; i++) {
+        size_t offset = writing_marks_[i].offset;
+        size_t end = i + 1 < writing_marks_.size() ? writing_marks_[i + 1].offset : writing_.size();
+
+        r = ty_serial_log_write(log_, writing_.data() + offset, end - offset,
+                                writing_marks_[i].time);
+    }
+    if (r >= 0) {
+        unsynced_ = true;
+    } else {
+        fail();
+    }
+
+    // Keep the allocations around for the next swap
+    writing_.clear();
+    writing_marks_.clear();
+}
+
+void SerialLog::sync()
+{
+    lock_guard<mutex> locker(file_mutex_);
+
+    if (!log_ || !unsynced_)
+        return;
+
+    LogErrorMask mask;
+    if (ty_serial_log_sync(log_) < 0) {
+        fail();
+        return;
+    }
+    unsynced_ = false;
+}
+
+// You need to lock file_mutex_ before you call this
+void SerialLog::fail()
+{
+    auto msg = QString("Closed serial log file after error: %1").arg(ty_error_last_message());
+
+    open_ = false;
+    {
+        LogErrorMask mask;
+        ty_serial_log_close(log_);
+    }
+    log_ = nullptr;
+
+    if (error_handler_)
+        error_handler_(msg);
+}
@@ -0,0 +1,147 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_LOG_HH
+#define SERIAL_LOG_HH
+
+#include <QString>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../libty/serial_log.h"
+
+class SerialLog;
+
+/* One thread writes the logs of all boards. The serial threads only append to memory
+   buffers, so a slow disk can delay the logs but never the serial reads. */
+class SerialLogWriter {
+    std::thread thread_;
+
+    // Protects the fields below, never held during I/O
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool run_ = true;
+    bool dirty_ = false;
+    bool urgent_ = false;
+    int sync_interval_ = 0;
+
+    // Held by the writer thread during each pass
+    std::mutex logs_mutex_;
+    std::vector<SerialLog *> logs_;
+
+public:
+    SerialLogWriter();
+    ~SerialLogWriter();
+
+    SerialLogWriter(const SerialLogWriter &other) = delete;
+    SerialLogWriter &operator=(const SerialLogWriter &other) = delete;
+
+    // In milliseconds, 0 leaves it to the OS
+    void setSyncInterval(int interval);
+    int syncInterval();
+
+private:
+    void registerLog(SerialLog *log);
+    void unregisterLog(SerialLog *log);
+    void notify(bool urgent);
+
+    void run();
+
+    friend class SerialLog;
+};
+
+/* Compressed ring log file, see libty/serial_log.h. Once full new output overwrites the
+   oldest one, and the file can be searched while it is being written. */
+class SerialLog {
+public:
+    // Buffers bigger than that are written without waiting for more
+    static const size_t FlushThreshold = 64 * 1024;
+    // Beyond that the oldest buffered bytes are dropped
+    static const size_t MaxPending = 8 * 1024 * 1024;
+
+private:
+    struct TimeMark {
+        size_t offset;
+        int64_t time;
+    };
+
+    std::shared_ptr<SerialLogWriter> writer_;
+    QString filename_;
+    std::function<void(const QString &msg)> error_handler_;
+
+    // Filled by append(), emptied by the writer thread
+    std::mutex buffer_mutex_;
+    std::string buffer_;
+    std::vector<TimeMark> marks_;
+    // Reset when the file is opened, we only warn about the first drop
+    uint64_t dropped_ = 0;
+    std::atomic<bool> open_{false};
+
+    // Protects the file, held by the writer thread while writing to it
+    std::mutex file_mutex_;
+    ty_serial_log *log_ = nullptr;
+    std::string writing_;
+    std::vector<TimeMark> writing_marks_;
+    bool unsynced_ = false;
+
+public:
+    SerialLog(std::shared_ptr<SerialLogWriter> writer);
+    ~SerialLog();
+
+    SerialLog(const SerialLog &other) = delete;
+    SerialLog &operator=(const SerialLog &other) = delete;
+
+    void setErrorHandler(std::function<void(const QString &msg)> f) { error_handler_ = f; }
+
+    // Closes the current file if any
+    void setFilename(const QString &filename);
+    QString filename() const { return filename_; }
+
+    // The file is truncated, size includes the headers
+    bool open(size_t size);
+    bool resize(size_t size);
+    void close();
+    bool isOpen() const { return open_; }
+
+    // Can be called from any thread, the output is timestamped now
+    void append(const char *buf, size_t len);
+    // Write out what is buffered now, without waiting for the writer thread
+    void flush();
+
+    // Bytes lost because the disk could not keep up, since the file was opened
+    uint64_t droppedBytes();
+
+    /* Writes out buffered output and calls f for each matching line, from the oldest one.
+       Returns a negative libty error code, or the first non-zero value returned by f. */
+    int search(const ty_serial_log_query &query,
+               const std::function<int(const ty_serial_log_line &line)> &f);
+
+private:
+    void writePending();
+    void writeTail();
+    void sync();
+
+    void writePendingLocked();
+    void closeLocked();
+
+    void fail();
+
+    friend class SerialLogWriter;
+};
+
+#endif
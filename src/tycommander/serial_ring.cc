@@ -0,0 +1,82 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <algorithm>
+
+#include "serial_ring.hpp"
+
+using namespace std;
+
+SerialRing::SerialRing(size_t capacity)
+{
+    capacity_ = 1;
+    while (capacity_ < capacity)
+        capacity_ *= 2;
+
+    buf_ = unique_ptr<char[]>(new char[capacity_]);
+}
+
+size_t SerialRing::size() const
+{
+    return write_pos_.load(memory_order_acquire) - read_pos_.load(memory_order_acquire);
+}
+
+// Contiguous free space, there may be more at the start of the buffer once this is filled
+size_t SerialRing::writeSpan(char **rptr) const
+{
+    size_t write_pos = write_pos_.load(memory_order_relaxed);
+    size_t read_pos = read_pos_.load(memory_order_acquire);
+
+    size_t offset = write_pos & (capacity_ - 1);
+    size_t free_len = capacity_ - (write_pos - read_pos);
+
+    *rptr = buf_.get() + offset;
+    return min(free_len, capacity_ - offset);
+}
+
+void SerialRing::commitWrite(size_t len)
+{
+    size_t write_pos = write_pos_.load(memory_order_relaxed) + len;
+    size_t used = write_pos - read_pos_.load(memory_order_relaxed);
+
+    // Publish the bytes before anything else, the consumer may be waiting for them
+    write_pos_.store(write_pos, memory_order_release);
+
+    received_.fetch_add(len, memory_order_relaxed);
+    if (used > high_water_.load(memory_order_relaxed))
+        high_water_.store(used, memory_order_relaxed);
+}
+
+size_t SerialRing::readSpan(const char **rptr) const
+{
+    size_t read_pos = read_pos_.load(memory_order_relaxed);
+    size_t write_pos = write_pos_.load(memory_order_acquire);
+
+    size_t offset = read_pos & (capacity_ - 1);
+
+    *rptr = buf_.get() + offset;
+    return min(write_pos - read_pos, capacity_ - offset);
+}
+
+void SerialRing::commitRead(size_t len)
+{
+    read_pos_.store(read_pos_.load(memory_order_relaxed) + len, memory_order_release);
+}
+
+SerialRing::Stats SerialRing::stats() const
+{
+    Stats stats;
+
+    stats.received = received_.load(memory_order_relaxed);
+    stats.stalls = stalls_.load(memory_order_relaxed);
+    stats.high_water = high_water_.load(memory_order_relaxed);
+
+    return stats;
+}
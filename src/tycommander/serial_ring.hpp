@@ -0,0 +1,65 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_RING_HH
+#define SERIAL_RING_HH
+
+#include <atomic>
+#include <memory>
+
+/* Single-producer single-consumer byte ring. The serial thread writes straight into
+   the free space, the GUI thread reads from the filled space, and neither of them
+   ever waits for the other. Positions only grow, the index in the buffer is the
+   position modulo the capacity (a power of two). */
+class SerialRing {
+public:
+    struct Stats {
+        uint64_t received;
+        // How many times the producer found the ring full and had to stop reading
+        uint64_t stalls;
+        size_t high_water;
+    };
+
+private:
+    std::unique_ptr<char[]> buf_;
+    size_t capacity_;
+
+    // Keep the two positions on separate cache lines, each thread writes to one of them
+    std::atomic<size_t> write_pos_{0};
+    char pad1_[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> read_pos_{0};
+    char pad2_[64 - sizeof(std::atomic<size_t>)];
+
+    std::atomic<uint64_t> received_{0};
+    std::atomic<uint64_t> stalls_{0};
+    std::atomic<size_t> high_water_{0};
+
+public:
+    explicit SerialRing(size_t capacity);
+
+    SerialRing(const SerialRing &other) = delete;
+    SerialRing &operator=(const SerialRing &other) = delete;
+
+    size_t capacity() const { return capacity_; }
+    size_t size() const;
+
+    // Producer side
+    size_t writeSpan(char **rptr) const;
+    void commitWrite(size_t len);
+    void recordStall() { stalls_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Consumer side
+    size_t readSpan(const char **rptr) const;
+    void commitRead(size_t len);
+
+    Stats stats() const;
+};
+
+#endif
@@ -0,0 +1,187 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <algorithm>
+#include <string.h>
+
+#include "serial_store.hpp"
+
+using namespace std;
+
+void SerialStore::append(const char *buf, size_t len)
+{
+    while (len) {
+        if (chunks_.empty() || chunks_.back().len == ChunkSize) {
+            // Indexing full chunks is enough to enforce the limit, even if nobody looks
+            indexLines();
+            dropOldLines();
+
+            Chunk chunk;
+            chunk.data = unique_ptr<char[]>(new char[ChunkSize]);
+            chunk.len = 0;
+            chunks_.push_back(move(chunk));
+        }
+
+        Chunk &chunk = chunks_.back();
+        size_t copy_len = min(len, ChunkSize - chunk.len);
+
+        memcpy(chunk.data.get() + chunk.len, buf, copy_len);
+        chunk.len += copy_len;
+        end_offset_ += copy_len;
+
+        buf += copy_len;
+        len -= copy_len;
+    }
+}
+
+void SerialStore::clear()
+{
+    chunks_.clear();
+    start_offset_ = 0;
+    end_offset_ = 0;
+
+    line_starts_.clear();
+    line_starts_.push_back(0);
+    first_line_ = 0;
+    indexed_offset_ = 0;
+    pending_cr_ = false;
+}
+
+void SerialStore::setMaximumLines(size_t max_lines)
+{
+    max_lines_ = max_lines;
+
+    indexLines();
+    dropOldLines();
+}
+
+uint64_t SerialStore::firstLine()
+{
+    indexLines();
+    dropOldLines();
+
+    return first_line_;
+}
+
+uint64_t SerialStore::endLine()
+{
+    indexLines();
+    dropOldLines();
+
+    return first_line_ + line_starts_.size();
+}
+
+uint64_t SerialStore::lineOffset(uint64_t line)
+{
+    indexLines();
+    dropOldLines();
+
+    if (line < first_line_)
+        return start_offset_;
+    if (line - first_line_ >= line_starts_.size())
+        return end_offset_;
+    return line_starts_[static_cast<size_t>(line - first_line_)];
+}
+
+QByteArray SerialStore::read(uint64_t start, uint64_t end) const
+{
+    start = max(start, start_offset_);
+    end = min(end, end_offset_);
+    if (start >= end)
+        return QByteArray();
+
+    QByteArray buf;
+    buf.reserve(static_cast<int>(end - start));
+
+    // All chunks are full except for the last one, so finding the first one is easy
+    size_t idx = static_cast<size_t>((start - start_offset_) / ChunkSize);
+    size_t offset = static_cast<size_t>((start - start_offset_) % ChunkSize);
+    uint64_t remaining = end - start;
+    while (remaining) {
+        const Chunk &chunk = chunks_[idx++];
+        size_t len = static_cast<size_t>(min(static_cast<uint64_t>(chunk.len - offset), remaining));
+
+        buf.append(chunk.data.get() + offset, static_cast<int>(len));
+        remaining -= len;
+        offset = 0;
+    }
+
+    return buf;
+}
+
+// Lines [first, end) without the final line break, so that a text document gets one block per line
+QByteArray SerialStore::readLines(uint64_t first, uint64_t end)
+{
+    if (end >= endLine())
+        return read(lineOffset(first), end_offset_);
+
+    auto buf = read(lineOffset(first), lineOffset(end));
+
+    // A CR right before the final LF is part of the line break, never a lone CR
+    if (buf.endsWith('\n'))
+        buf.chop(1);
+    if (buf.endsWith('\r'))
+        buf.chop(1);
+
+    return buf;
+}
+
+size_t SerialStore::memoryUsage() const
+{
+    return chunks_.size() * ChunkSize + line_starts_.size() * sizeof(uint64_t);
+}
+
+void SerialStore::indexLines()
+{
+    while (indexed_offset_ < end_offset_) {
+        size_t idx = static_cast<size_t>((indexed_offset_ - start_offset_) / ChunkSize);
+        size_t offset = static_cast<size_t>((indexed_offset_ - start_offset_) % ChunkSize);
+        const Chunk &chunk = chunks_[idx];
+
+        const char *start = chunk.data.get() + offset;
+        const char *end = chunk.data.get() + chunk.len;
+
+        // CRLF is a single line break, the line started after the CR starts after the LF
+        if (pending_cr_) {
+            pending_cr_ = false;
+            if (*start == '\n') {
+                indexed_offset_++;
+                line_starts_.back() = indexed_offset_;
+                continue;
+            }
+        }
+
+        const char *ptr = find_if(start, end, [](char c) { return c == '\n' || c == '\r'; });
+
+        if (ptr != end) {
+            indexed_offset_ += static_cast<uint64_t>(ptr - start) + 1;
+            line_starts_.push_back(indexed_offset_);
+            pending_cr_ = (*ptr == '\r');
+        } else {
+            indexed_offset_ += static_cast<uint64_t>(end - start);
+        }
+    }
+}
+
+void SerialStore::dropOldLines()
+{
+    if (!max_lines_ || line_starts_.size() <= max_lines_)
+        return;
+
+    size_t drop = line_starts_.size() - max_lines_;
+    line_starts_.erase(line_starts_.begin(), line_starts_.begin() + static_cast<ptrdiff_t>(drop));
+    first_line_ += drop;
+
+    // Keep the chunk where the first line starts, even if most of it is gone
+    while (chunks_.size() > 1 && start_offset_ + chunks_.front().len <= line_starts_.front()) {
+        start_offset_ += chunks_.front().len;
+        chunks_.pop_front();
+    }
+}
@@ -0,0 +1,69 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_STORE_HH
+#define SERIAL_STORE_HH
+
+#include <QByteArray>
+
+#include <deque>
+#include <memory>
+
+/* Append-only store for the raw serial output of a board. Bytes go to fixed-size chunks,
+   the start of each line is indexed when a chunk fills up or when someone asks about
+   lines, and whole chunks are freed once the scrollback limit drops all their lines.
+   Lines end with LF, CRLF or a lone CR, so that CR-only output gets trimmed too.
+   Offsets and line numbers are absolute, they keep growing when old data goes away. */
+class SerialStore {
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t len;
+    };
+
+    std::deque<Chunk> chunks_;
+    uint64_t start_offset_ = 0;
+    uint64_t end_offset_ = 0;
+
+    std::deque<uint64_t> line_starts_{0};
+    uint64_t first_line_ = 0;
+    uint64_t indexed_offset_ = 0;
+    // The last indexed byte is a CR, the line moves past the LF if one comes next
+    bool pending_cr_ = false;
+
+    size_t max_lines_ = 0;
+
+public:
+    static const size_t ChunkSize = 65536;
+
+    void append(const char *buf, size_t len);
+    void clear();
+
+    void setMaximumLines(size_t max_lines);
+    size_t maximumLines() const { return max_lines_; }
+
+    uint64_t startOffset() const { return start_offset_; }
+    uint64_t endOffset() const { return end_offset_; }
+
+    // The last line is the one being written, it is empty right after a newline
+    uint64_t firstLine();
+    uint64_t endLine();
+    uint64_t lineOffset(uint64_t line);
+
+    QByteArray read(uint64_t start, uint64_t end) const;
+    QByteArray readLines(uint64_t first, uint64_t end);
+
+    size_t memoryUsage() const;
+
+private:
+    void indexLines();
+    void dropOldLines();
+};
+
+#endif
@@ -0,0 +1,684 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libhs/array.h"
+#include "../../src/libty/firmware.h"
+
+typedef _HS_ARRAY(char) ihex_buffer;
+
+static void append_hex_byte(ihex_buffer *buf, unsigned int value, bool lowercase)
+{
+    const char *digits = lowercase ? "0123456789abcdef" : "0123456789ABCDEF";
+
+    buf->values[buf->count++] = digits[(value >> 4) & 0xF];
+    buf->values[buf->count++] = digits[value & 0xF];
+}
+
+static void append_ihex_record(ihex_buffer *buf, unsigned int type, uint16_t address,
+                               const uint8_t *data, size_t len, bool lowercase)
+{
+    uint8_t sum;
+
+    _hs_array_grow(buf, 16 + len * 2);
+
+    buf->values[buf->count++] = ':';
+    append_hex_byte(buf, (unsigned int)len, lowercase);
+    append_hex_byte(buf, address >> 8, lowercase);
+    append_hex_byte(buf, address & 0xFF, lowercase);
+    append_hex_byte(buf, type, lowercase);
+    sum = (uint8_t)(len + (address >> 8) + (address & 0xFF) + type);
+    for (size_t i = 0; i < len; i++) {
+        append_hex_byte(buf, data[i], lowercase);
+        sum = (uint8_t)(sum + data[i]);
+    }
+    append_hex_byte(buf, (uint8_t)-sum, lowercase);
+    buf->values[buf->count++] = '\r';
+    buf->values[buf->count++] = '\n';
+}
+
+static void append_ihex_address(ihex_buffer *buf, uint32_t address)
+{
+    uint8_t data[2] = {(uint8_t)(address >> 24), (uint8_t)(address >> 16)};
+    append_ihex_record(buf, 4, 0, data, sizeof(data), false);
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+static int load_ihex(const ihex_buffer *buf, bool reference, ty_firmware **rfw)
+{
+    ty_firmware *fw;
+    int r;
+
+    r = ty_firmware_new("test.hex", &fw);
+    if (r < 0)
+        return r;
+
+    ty_error_mask(TY_ERROR_PARSE);
+    if (reference) {
+        r = _ty_firmware_load_ihex_reference(fw, (const uint8_t *)buf->values, buf->count);
+    } else {
+        r = ty_firmware_load_ihex(fw, (const uint8_t *)buf->values, buf->count);
+    }
+    ty_error_unmask();
+    if (r < 0) {
+        ty_firmware_unref(fw);
+        return r;
+    }
+
+    *rfw = fw;
+    return 0;
+}
+
+static bool compare_firmwares(const ty_firmware *fw1, const ty_firmware *fw2)
+{
+    if (fw1->segments_count != fw2->segments_count || fw1->total_size != fw2->total_size ||
+            fw1->max_address != fw2->max_address)
+        return false;
+
+    for (unsigned int i = 0; i < fw1->segments_count; i++) {
+        const ty_firmware_segment *segment1 = &fw1->segments[i];
+        const ty_firmware_segment *segment2 = &fw2->segments[i];
+
+        if (segment1->address != segment2->address || segment1->size != segment2->size)
+            return false;
+        if (memcmp(segment1->data, segment2->data, segment1->size) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+// Returns true if both parsers agree (same firmware or both fail)
+static bool test_both_parsers(const ihex_buffer *buf, int *rret)
+{
+    ty_firmware *fw1 = NULL, *fw2 = NULL;
+    int r1, r2;
+    bool same;
+
+    r1 = load_ihex(buf, false, &fw1);
+    r2 = load_ihex(buf, true, &fw2);
+
+    if (r1 < 0 || r2 < 0) {
+        same = (r1 < 0 && r2 < 0);
+    } else {
+        same = compare_firmwares(fw1, fw2);
+    }
+
+    ty_firmware_unref(fw1);
+    ty_firmware_unref(fw2);
+
+    if (rret)
+        *rret = r1;
+    return same;
+}
+
+static void test_firmware_ihex_simple(void)
+{
+    {
+        static const char hex[] = ":10000000000102030405060708090A0B0C0D0E0F78\r\n"
+                                  ":00000001FF\r\n";
+        ihex_buffer buf = {0};
+        ty_firmware *fw = NULL;
+        int r;
+
+        _hs_array_grow(&buf, sizeof(hex));
+        memcpy(buf.values, hex, sizeof(hex) - 1);
+        buf.count = sizeof(hex) - 1;
+
+        r = load_ihex(&buf, false, &fw);
+        ASSERT(!r);
+        if (!r) {
+            ASSERT(fw->segments_count == 1);
+            ASSERT(fw->total_size == 16);
+            ASSERT(fw->segments[0].data[0] == 0x00 && fw->segments[0].data[15] == 0x0F);
+        }
+        ty_firmware_unref(fw);
+
+        ASSERT(test_both_parsers(&buf, &r) && !r);
+
+        _hs_array_release(&buf);
+    }
+
+    {
+        ihex_buffer buf = {0};
+        uint8_t data[255];
+        int r;
+
+        for (size_t i = 0; i < sizeof(data); i++)
+            data[i] = (uint8_t)(255 - i);
+
+        append_ihex_record(&buf, 0, 0x1000, data, sizeof(data), true);
+        append_ihex_record(&buf, 0, 0x2000, data, 17, false);
+        append_ihex_record(&buf, 1, 0, NULL, 0, false);
+
+        ASSERT(test_both_parsers(&buf, &r) && !r);
+
+        _hs_array_release(&buf);
+    }
+}
+
+static void test_firmware_ihex_random(void)
+{
+    uint32_t state = 42;
+
+    for (unsigned int i = 0; i < 64; i++) {
+        ihex_buffer buf = {0};
+        uint32_t base = 0;
+        int r;
+
+        for (unsigned int j = 0; j < 96; j++) {
+            uint8_t data[255];
+            size_t len = next_random(&state) % (sizeof(data) + 1);
+            uint16_t address = (uint16_t)(next_random(&state) & 0xFFFF);
+
+            if (next_random(&state) % 16 == 0) {
+                base = (next_random(&state) % 16) << 16;
+                append_ihex_address(&buf, base);
+            }
+
+            for (size_t k = 0; k < len; k++)
+                data[k] = (uint8_t)next_random(&state);
+            append_ihex_record(&buf, 0, address, data, len, next_random(&state) % 2);
+        }
+        append_ihex_record(&buf, 1, 0, NULL, 0, false);
+
+        ASSERT(test_both_parsers(&buf, &r) && !r);
+
+        _hs_array_release(&buf);
+    }
+}
+
+static void test_firmware_ihex_errors(void)
+{
+    uint32_t state = 1;
+    ihex_buffer ref = {0};
+    uint8_t data[64];
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)next_random(&state);
+    append_ihex_record(&ref, 0, 0x100, data, sizeof(data), false);
+    append_ihex_record(&ref, 1, 0, NULL, 0, false);
+
+    // Corrupt every character of the data record, one at a time
+    for (size_t i = 0; i < 11 + 2 * sizeof(data); i++) {
+        static const char replacements[] = {'G', 'g', '/', ':', '@', '`', '\n', (char)0xB0};
+
+        for (size_t j = 0; j < sizeof(replacements); j++) {
+            ihex_buffer buf = {0};
+            int r;
+
+            if (ref.values[i] == replacements[j])
+                continue;
+
+            _hs_array_grow(&buf, ref.count);
+            memcpy(buf.values, ref.values, ref.count);
+            buf.count = ref.count;
+            buf.values[i] = replacements[j];
+
+            ASSERT(test_both_parsers(&buf, &r) && r < 0);
+
+            _hs_array_release(&buf);
+        }
+    }
+
+    // Bad checksum, NUL character, truncated record and missing EOF record
+    {
+        ihex_buffer buf = {0};
+        ty_firmware *fw;
+        int r;
+
+        _hs_array_grow(&buf, ref.count);
+        memcpy(buf.values, ref.values, ref.count);
+        buf.count = ref.count;
+        buf.values[10] = buf.values[10] == '0' ? '1' : '0';
+        ASSERT(test_both_parsers(&buf, &r) && r < 0);
+
+        // The reference parser (strtoul) accepts "0\0" as a valid byte, so no comparison here
+        memcpy(buf.values, ref.values, ref.count);
+        buf.values[6] = 0;
+        ASSERT(load_ihex(&buf, false, &fw) < 0);
+
+        memcpy(buf.values, ref.values, ref.count);
+        buf.count = 40;
+        ASSERT(test_both_parsers(&buf, &r) && r < 0);
+
+        memcpy(buf.values, ref.values, ref.count);
+        buf.count = ref.count - 13;
+        ASSERT(test_both_parsers(&buf, &r) && r < 0);
+
+        _hs_array_release(&buf);
+    }
+
+    _hs_array_release(&ref);
+}
+
+static int feed_ihex(const ihex_buffer *buf, uint32_t *state, ty_firmware **rfw)
+{
+    ty_firmware_parser *parser;
+    size_t offset = 0;
+    int r;
+
+    r = ty_firmware_parser_new("test.hex", NULL, &parser);
+    if (r < 0)
+        return r;
+
+    ty_error_mask(TY_ERROR_PARSE);
+    while (offset < buf->count) {
+        // Mostly small chunks, to split records in all possible places
+        size_t len = next_random(state) % (next_random(state) % 4 ? 24 : 2048);
+        if (len > buf->count - offset)
+            len = buf->count - offset;
+
+        r = ty_firmware_parser_feed(parser, (const uint8_t *)buf->values + offset, len);
+        if (r < 0)
+            break;
+        offset += len;
+    }
+    if (r >= 0)
+        r = ty_firmware_parser_finish(parser, rfw);
+    ty_error_unmask();
+
+    ty_firmware_parser_free(parser);
+    return r;
+}
+
+static void test_firmware_ihex_stream(void)
+{
+    uint32_t state = 7;
+
+    for (unsigned int i = 0; i < 64; i++) {
+        ihex_buffer buf = {0};
+        ty_firmware *fw1 = NULL, *fw2 = NULL;
+        int r1, r2;
+
+        for (unsigned int j = 0; j < 32; j++) {
+            uint8_t data[255];
+            size_t len = next_random(&state) % (sizeof(data) + 1);
+            uint16_t address = (uint16_t)(next_random(&state) & 0xFFFF);
+
+            for (size_t k = 0; k < len; k++)
+                data[k] = (uint8_t)next_random(&state);
+            append_ihex_record(&buf, 0, address, data, len, false);
+
+            // Unix line endings and blank lines must not confuse the parser
+            if (next_random(&state) % 4 == 0)
+                buf.values[buf.count - 2] = '\n';
+        }
+        append_ihex_record(&buf, 1, 0, NULL, 0, false);
+
+        // Every other firmware lacks the last line ending, or the EOF record
+        if (i % 4 == 1) {
+            buf.count -= 2;
+        } else if (i % 4 == 3) {
+            buf.count -= 13;
+        }
+
+        r1 = load_ihex(&buf, false, &fw1);
+        r2 = feed_ihex(&buf, &state, &fw2);
+        ASSERT(r1 == r2);
+        ASSERT((i % 4 == 3) == (r1 < 0));
+        if (r1 >= 0 && r2 >= 0)
+            ASSERT(compare_firmwares(fw1, fw2));
+
+        ty_firmware_unref(fw1);
+        ty_firmware_unref(fw2);
+        _hs_array_release(&buf);
+    }
+}
+
+static void test_firmware_identify(void)
+{
+    static const uint8_t magic[8] = {0x0C, 0x94, 0x00, 0x3F, 0xFF, 0xCF, 0xF8, 0x94};
+    // Near misses and the magic itself, at the start, in the middle and right at the end
+    static const size_t offsets[] = {0, 1, 97, 255 - sizeof(magic), 256 - sizeof(magic)};
+
+    for (size_t i = 0; i < _HS_COUNTOF(offsets); i++) {
+        ihex_buffer buf = {0};
+        uint8_t data[256];
+        ty_firmware *fw = NULL;
+        ty_model models[4];
+        unsigned int count;
+
+        memset(data, 0x0C, sizeof(data));
+        memcpy(data + offsets[i], magic, sizeof(magic));
+        append_ihex_record(&buf, 0, 0, data, 128, false);
+        append_ihex_record(&buf, 0, 128, data + 128, 128, false);
+        append_ihex_record(&buf, 1, 0, NULL, 0, false);
+
+        ASSERT(!ty_firmware_load_mem("test.hex", (const uint8_t *)buf.values, buf.count,
+                                     NULL, &fw));
+        if (fw) {
+            count = ty_firmware_identify(fw, models, _HS_COUNTOF(models));
+            ASSERT(fw->finalized);
+            ASSERT(count == 1 && models[0] == TY_MODEL_TEENSY_20);
+
+            // Changing the segments must drop the memoized models
+            ASSERT(!ty_firmware_expand_segment(fw, &fw->segments[0], 8));
+            ASSERT(!fw->finalized);
+            count = ty_firmware_identify(fw, models, _HS_COUNTOF(models));
+            ASSERT(count == (offsets[i] ? 0 : 1));
+        }
+
+        ty_firmware_unref(fw);
+        _hs_array_release(&buf);
+    }
+}
+
+// Linear version of ty_firmware_extract(), from before the segment index
+static size_t extract_linear(const ty_firmware *fw, uint32_t address, uint8_t *buf, size_t size)
+{
+    size_t total_len = 0;
+
+    for (unsigned int i = 0; i < fw->segments_count; i++) {
+        const ty_firmware_segment *segment = &fw->segments[i];
+
+        if (address >= segment->address && address < segment->address + segment->size) {
+            size_t delta = address - segment->address;
+            size_t len = _HS_MIN(segment->size - delta, size);
+
+            memcpy(buf, segment->data + delta, len);
+            total_len += len;
+        } else if (address < segment->address && address + size > segment->address) {
+            size_t delta = segment->address - address;
+            size_t len = _HS_MIN(segment->size, size - delta);
+
+            memcpy(buf + delta, segment->data, len);
+            total_len += len;
+        }
+    }
+
+    return total_len;
+}
+
+static bool check_firmware_index(const ty_firmware *fw)
+{
+    const size_t block_size = 1024;
+    size_t end = (fw->max_address / block_size + 2) * block_size;
+    uint8_t *covered;
+    ty_firmware_block_iterator it;
+    size_t next_address, next_len;
+    bool has_next;
+    bool success = true;
+
+    covered = calloc(end, 1);
+    if (!covered)
+        return false;
+    for (unsigned int i = 0; i < fw->segments_count; i++)
+        memset(covered + fw->segments[i].address, 1, fw->segments[i].size);
+
+    ty_firmware_blocks_init(&it, fw, 0, block_size);
+    has_next = ty_firmware_blocks_next(&it, &next_address, &next_len);
+
+    for (size_t address = 0; address < end; address += block_size) {
+        uint8_t buf1[1024] = {0}, buf2[1024] = {0};
+        size_t len1, len2, covered_len = 0;
+
+        len1 = ty_firmware_extract(fw, (uint32_t)address, buf1, block_size);
+        len2 = extract_linear(fw, (uint32_t)address, buf2, block_size);
+        success &= (len1 == len2) && !memcmp(buf1, buf2, block_size);
+
+        for (size_t i = 0; i < block_size; i++)
+            covered_len += covered[address + i];
+        if (covered_len) {
+            success &= has_next && next_address == address && next_len == covered_len;
+            has_next = ty_firmware_blocks_next(&it, &next_address, &next_len);
+        }
+
+        for (size_t i = 0; i < block_size; i += 61) {
+            const ty_firmware_segment *segment = NULL;
+
+            for (unsigned int j = fw->segments_count; j-- > 0;) {
+                const ty_firmware_segment *segment_it = &fw->segments[j];
+                if (address + i >= segment_it->address &&
+                        address + i < segment_it->address + segment_it->size) {
+                    segment = segment_it;
+                    break;
+                }
+            }
+            success &= ty_firmware_find_segment(fw, (uint32_t)(address + i)) == segment;
+        }
+    }
+    success &= !has_next;
+
+    free(covered);
+    return success;
+}
+
+static void test_firmware_index(void)
+{
+    uint32_t state = 11;
+
+    // Sparse segments added by hand, some of them overlapping
+    for (unsigned int i = 0; i < 32; i++) {
+        ty_firmware *fw = NULL;
+        unsigned int segments_count = next_random(&state) % TY_FIRMWARE_MAX_SEGMENTS + 1;
+
+        ASSERT(!ty_firmware_new("test.bin", &fw));
+        if (!fw)
+            continue;
+
+        for (unsigned int j = 0; j < segments_count; j++) {
+            uint32_t address = next_random(&state) % 262144;
+            size_t size = next_random(&state) % 8192;
+            ty_firmware_segment *segment;
+
+            if (ty_firmware_add_segment(fw, address, size, &segment) < 0)
+                break;
+            for (size_t k = 0; k < size; k++)
+                segment->data[k] = (uint8_t)next_random(&state);
+            fw->max_address = _HS_MAX(fw->max_address, address + size);
+        }
+        ASSERT(!fw->finalized);
+        ASSERT(check_firmware_index(fw));
+
+        ty_firmware_unref(fw);
+    }
+
+    // Loaded firmwares use the index built after loading
+    for (unsigned int i = 0; i < 8; i++) {
+        ihex_buffer buf = {0};
+        ty_firmware *fw = NULL;
+
+        // The IHEX parser starts a new segment when the address jumps by 2 MiB
+        for (uint32_t base = 0; base < 0x600000; base += 0x200000) {
+            for (uint32_t offset = 0; offset < 4; offset++) {
+                if (next_random(&state) % 2)
+                    continue;
+
+                append_ihex_address(&buf, base + (offset << 16));
+                for (unsigned int k = next_random(&state) % 16; k; k--) {
+                    uint8_t data[255];
+                    size_t len = next_random(&state) % (sizeof(data) + 1);
+                    uint16_t address = (uint16_t)(next_random(&state) & 0xFFFF);
+
+                    for (size_t l = 0; l < len; l++)
+                        data[l] = (uint8_t)next_random(&state);
+                    append_ihex_record(&buf, 0, address, data,
+                                       _HS_MIN(len, 0x10000u - address), false);
+                }
+            }
+        }
+        append_ihex_record(&buf, 1, 0, NULL, 0, false);
+
+        ASSERT(!ty_firmware_load_mem("test.hex", (const uint8_t *)buf.values, buf.count,
+                                     NULL, &fw));
+        if (fw) {
+            ASSERT(fw->finalized);
+            ASSERT(check_firmware_index(fw));
+        }
+
+        ty_firmware_unref(fw);
+        _hs_array_release(&buf);
+    }
+}
+
+static bool write_file(const char *filename, const ihex_buffer *buf)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        return false;
+
+    bool success = fwrite(buf->values, 1, buf->count, fp) == buf->count;
+    return !fclose(fp) && success;
+}
+
+static void test_firmware_cache(void)
+{
+    static const char *filename1 = "test_firmware_cache1.hex";
+    static const char *filename2 = "test_firmware_cache2.hex";
+    ihex_buffer buf = {0};
+    uint8_t data[64] = {0};
+    ty_firmware_cache *cache;
+    ty_firmware *fw1 = NULL, *fw2 = NULL, *fw3 = NULL;
+    int r;
+
+    r = ty_firmware_cache_new(1024 * 1024, TY_FIRMWARE_CACHE_CHECK_CONTENT, &cache);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    append_ihex_record(&buf, 0, 0, data, sizeof(data), false);
+    append_ihex_record(&buf, 1, 0, NULL, 0, false);
+    ASSERT(write_file(filename1, &buf) && write_file(filename2, &buf));
+
+    // Same file, same firmware object
+    ASSERT(!ty_firmware_cache_load(cache, filename1, NULL, &fw1));
+    ASSERT(!ty_firmware_cache_load(cache, filename1, NULL, &fw2));
+    ASSERT(fw1 && fw1 == fw2);
+    ty_firmware_unref(fw2);
+    fw2 = NULL;
+
+    // Same size (and maybe same mtime), different content
+    data[0] = 0x10;
+    buf.count = 0;
+    append_ihex_record(&buf, 0, 0, data, sizeof(data), false);
+    append_ihex_record(&buf, 1, 0, NULL, 0, false);
+    ASSERT(write_file(filename1, &buf));
+    ASSERT(!ty_firmware_cache_load(cache, filename1, NULL, &fw2));
+    ASSERT(fw2 && fw2 != fw1);
+    if (fw2)
+        ASSERT(fw2->segments[0].data[0] == 0x10);
+
+    // Each firmware takes 64 kiB, so the least recently used one has to go
+    ty_firmware_cache_set_max_size(cache, 65536);
+    ASSERT(!ty_firmware_cache_load(cache, filename2, NULL, &fw3));
+    ty_firmware_unref(fw3);
+    ASSERT(!ty_firmware_cache_load(cache, filename2, NULL, &fw3));
+    ty_firmware_unref(fw3);
+    ASSERT(!ty_firmware_cache_load(cache, filename1, NULL, &fw3));
+    ASSERT(fw3 && fw3 != fw2);
+
+    ty_firmware_unref(fw3);
+    ty_firmware_unref(fw2);
+    ty_firmware_unref(fw1);
+    ty_firmware_cache_free(cache);
+
+    remove(filename1);
+    remove(filename2);
+    _hs_array_release(&buf);
+}
+
+static void put_le16(uint8_t *ptr, uint16_t value)
+{
+    ptr[0] = (uint8_t)value;
+    ptr[1] = (uint8_t)(value >> 8);
+}
+
+static void put_le32(uint8_t *ptr, uint32_t value)
+{
+    put_le16(ptr, (uint16_t)value);
+    put_le16(ptr + 2, (uint16_t)(value >> 16));
+}
+
+static void test_firmware_elf_mapped(void)
+{
+    static const char *filename = "test_firmware_mapped.elf";
+    uint8_t elf[52 + 32 + 256] = {0};
+    ty_firmware *fw = NULL;
+    int r;
+
+    // ELF header, little-endian 32-bit with a single program header
+    memcpy(elf, "\177ELF", 4);
+    elf[4] = 1;
+    elf[5] = 1;
+    elf[6] = 1;
+    put_le16(elf + 16, 2);
+    put_le16(elf + 18, 40);
+    put_le32(elf + 20, 1);
+    put_le32(elf + 28, 52);
+    put_le16(elf + 40, 52);
+    put_le16(elf + 42, 32);
+    put_le16(elf + 44, 1);
+
+    // PT_LOAD segment, loaded at 0x1000
+    put_le32(elf + 52, 1);
+    put_le32(elf + 56, 84);
+    put_le32(elf + 60, 0x1000);
+    put_le32(elf + 64, 0x1000);
+    put_le32(elf + 68, 256);
+    put_le32(elf + 72, 256);
+    for (unsigned int i = 0; i < 256; i++)
+        elf[84 + i] = (uint8_t)i;
+
+    FILE *fp = fopen(filename, "wb");
+    ASSERT(fp);
+    if (!fp)
+        return;
+    ASSERT(fwrite(elf, 1, sizeof(elf), fp) == sizeof(elf));
+    fclose(fp);
+
+    r = ty_firmware_load_file(filename, NULL, NULL, &fw);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    ASSERT(fw->segments_count == 1);
+    ASSERT(fw->segments[0].address == 0x1000 && fw->segments[0].size == 256);
+    ASSERT(!memcmp(fw->segments[0].data, elf + 84, 256));
+#ifndef _WIN32
+    // The segment points into the read-only mapping until it gets expanded
+    ASSERT(fw->map_addr && !fw->segments[0].alloc_size);
+#endif
+
+    // What ty_upload() does before handing the firmware to a task
+    r = _ty_firmware_detach_mapping(fw);
+    ASSERT(!r);
+    ASSERT(!fw->map_addr && fw->segments[0].alloc_size >= 256);
+    ASSERT(fw->segments[0].address == 0x1000 && fw->segments[0].size == 256);
+    ASSERT(!memcmp(fw->segments[0].data, elf + 84, 256));
+
+    r = ty_firmware_expand_segment(fw, &fw->segments[0], 512);
+    ASSERT(!r);
+    ASSERT(fw->segments[0].alloc_size >= 512);
+    ASSERT(!memcmp(fw->segments[0].data, elf + 84, 256));
+    fw->segments[0].data[0] = 0xFF;
+    fw->segments[0].data[511] = 0xFF;
+
+cleanup:
+    ty_firmware_unref(fw);
+    remove(filename);
+}
+
+void test_firmware(void)
+{
+    test_firmware_ihex_simple();
+    test_firmware_ihex_random();
+    test_firmware_ihex_errors();
+    test_firmware_ihex_stream();
+    test_firmware_identify();
+    test_firmware_index();
+    test_firmware_cache();
+    test_firmware_elf_mapped();
+}
@@ -0,0 +1,167 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libhs/htable.h"
+
+struct test_node {
+    _hs_htable_head hnode;
+    char key[64];
+    unsigned int value;
+};
+
+#define TEST_NODES 2048
+
+static unsigned int count_key(_hs_htable *table, uint32_t key, const char *str,
+                              unsigned int *rvalues, unsigned int max_values)
+{
+    unsigned int count = 0;
+
+    _hs_htable_foreach_hash(cur, table, key) {
+        struct test_node *node = _HS_CONTAINER_OF(cur, struct test_node, hnode);
+
+        if (strcmp(node->key, str) == 0) {
+            if (count < max_values)
+                rvalues[count] = node->value;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void test_htable_grow(void)
+{
+    _hs_htable table = {0};
+    struct test_node *nodes;
+    int r;
+
+    nodes = calloc(TEST_NODES, sizeof(*nodes));
+    r = _hs_htable_init(&table, 4);
+    ASSERT(nodes && !r);
+    if (!nodes || r)
+        goto cleanup;
+    ASSERT(table.size == 8);
+
+    // Entries with the same key, added with _hs_htable_append() before the table grows
+    for (unsigned int i = 0; i < 3; i++) {
+        strcpy(nodes[i].key, "dup");
+        nodes[i].value = i;
+        _hs_htable_append(&table, _hs_htable_hash_str("dup"), &nodes[i].hnode);
+    }
+    for (unsigned int i = 3; i < TEST_NODES; i++) {
+        sprintf(nodes[i].key, "/devices/pci0000:00/0000:00:14.0/usb1/1-%u", i);
+        nodes[i].value = i;
+        _hs_htable_add(&table, _hs_htable_hash_str(nodes[i].key), &nodes[i].hnode);
+    }
+    ASSERT(table.count == TEST_NODES);
+    ASSERT(table.size >= TEST_NODES);
+
+    unsigned int values[4];
+    ASSERT(count_key(&table, _hs_htable_hash_str("dup"), "dup", values, 4) == 3);
+    ASSERT(values[0] == 0 && values[1] == 1 && values[2] == 2);
+
+    unsigned int found = 0;
+    for (unsigned int i = 3; i < TEST_NODES; i++) {
+        unsigned int value;
+        if (count_key(&table, _hs_htable_hash_str(nodes[i].key), nodes[i].key, &value, 1) == 1 &&
+                value == i)
+            found++;
+    }
+    ASSERT(found == TEST_NODES - 3);
+
+    for (unsigned int i = 0; i < TEST_NODES; i += 2)
+        _hs_htable_remove(&table, &nodes[i].hnode);
+    ASSERT(table.count == TEST_NODES / 2);
+    ASSERT(count_key(&table, _hs_htable_hash_str("dup"), "dup", values, 4) == 1);
+    ASSERT(values[0] == 1);
+
+    unsigned int iterated = 0;
+    _hs_htable_foreach(cur, &table) {
+        struct test_node *node = _HS_CONTAINER_OF(cur, struct test_node, hnode);
+        if (node->value % 2)
+            iterated++;
+    }
+    ASSERT(iterated == TEST_NODES / 2);
+
+    _hs_htable_clear(&table);
+    ASSERT(table.count == 0);
+
+cleanup:
+    _hs_htable_release(&table);
+    free(nodes);
+}
+
+static double measure_chain_length(_hs_htable *table, const uint32_t *keys, unsigned int count)
+{
+    unsigned long walked = 0;
+
+    for (unsigned int i = 0; i < count; i++) {
+        _hs_htable_head *head = _hs_htable_get_head(table, keys[i]);
+        for (_hs_htable_head *cur = head->next; cur != head; cur = cur->next) {
+            walked++;
+            if (cur->key == keys[i])
+                break;
+        }
+    }
+
+    return (double)walked / count;
+}
+
+/* Micro-benchmark of lookups, as the number of nodes walked per lookup. This is what
+   degrades with a fixed bucket count or weak hashes, and unlike timings it does not
+   depend on the machine running the tests. */
+static void test_htable_chains(void)
+{
+    _hs_htable table = {0};
+    struct test_node *nodes;
+    uint32_t *keys;
+    int r;
+
+    nodes = calloc(TEST_NODES, sizeof(*nodes));
+    keys = calloc(TEST_NODES, sizeof(*keys));
+    r = _hs_htable_init(&table, 64);
+    ASSERT(nodes && keys && !r);
+    if (!nodes || !keys || r)
+        goto cleanup;
+
+    // Similar device paths, which only differ by a few characters
+    for (unsigned int i = 0; i < TEST_NODES; i++) {
+        sprintf(nodes[i].key, "/devices/pci0000:00/0000:00:14.0/usb%u/%u-%u.%u",
+                i / 256 + 1, i / 256 + 1, i / 16 % 16 + 1, i % 16 + 1);
+        keys[i] = _hs_htable_hash_str(nodes[i].key);
+        _hs_htable_add(&table, keys[i], &nodes[i].hnode);
+    }
+    ASSERT(measure_chain_length(&table, keys, TEST_NODES) < 2.0);
+
+    _hs_htable_clear(&table);
+
+    // Pointers to neighbouring objects, like the devices and interfaces in ty_monitor
+    for (unsigned int i = 0; i < TEST_NODES; i++) {
+        keys[i] = _hs_htable_hash_ptr(&nodes[i]);
+        _hs_htable_add(&table, keys[i], &nodes[i].hnode);
+    }
+    ASSERT(measure_chain_length(&table, keys, TEST_NODES) < 2.0);
+
+    // Same bytes, same hash
+    ASSERT(_hs_htable_hash_mem("usb-1-2", 7) == _hs_htable_hash_str("usb-1-2"));
+    ASSERT(_hs_htable_hash_mem(NULL, 0) == _hs_htable_hash_str(""));
+
+cleanup:
+    _hs_htable_release(&table);
+    free(keys);
+    free(nodes);
+}
+
+void test_htable(void)
+{
+    test_htable_grow();
+    test_htable_chains();
+}
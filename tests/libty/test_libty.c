@@ -11,7 +11,11 @@
 #include <stdarg.h>
 #include "test_libty.h"
 
+void test_firmware(void);
+void test_htable(void);
+void test_match(void);
 void test_optline(void);
+void test_serial_log(void);
 
 static char current_file[1024];
 static char current_fn[256];
@@ -68,7 +72,11 @@ void report_test(bool pred, const char *file, unsigned int line, const char *fn,
 
 int main(void)
 {
+    test_firmware();
+    test_htable();
+    test_match();
     test_optline();
+    test_serial_log();
 
     conclude_current_test();
     if (cases_failures) {
@@ -0,0 +1,165 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <time.h>
+#include "test_libty.h"
+#include "../../src/libhs/match_priv.h"
+
+#define TEST_SPECS 4096
+#define TEST_DEVICES 65536
+
+static uint32_t next_random(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+// What _hs_match_helper_match() did before specs were compiled
+static bool match_linear(const hs_match_spec *specs, unsigned int specs_count,
+                         const hs_device *dev, void **rmatch_udata)
+{
+    for (unsigned int i = 0; i < specs_count; i++) {
+        const hs_match_spec *spec = &specs[i];
+
+        if (spec->type && dev->type != (hs_device_type)spec->type)
+            continue;
+        if (spec->vid && dev->vid != spec->vid)
+            continue;
+        if (spec->pid && dev->pid != spec->pid)
+            continue;
+
+        *rmatch_udata = spec->udata;
+        return true;
+    }
+
+    return false;
+}
+
+static void make_device(uint32_t *state, hs_device *rdev)
+{
+    memset(rdev, 0, sizeof(*rdev));
+    rdev->type = next_random(state) % 2 ? HS_DEVICE_TYPE_HID : HS_DEVICE_TYPE_SERIAL;
+    rdev->vid = (uint16_t)(0x1000 + next_random(state) % 64);
+    rdev->pid = (uint16_t)(next_random(state) % 128);
+}
+
+static void test_match_order(void)
+{
+    static const hs_match_spec specs[] = {
+        HS_MATCH_VID_PID(0x16C0, 0x0483, (void *)1),
+        HS_MATCH_TYPE_VID_PID(HS_DEVICE_TYPE_HID, 0x16C0, 0, (void *)2),
+        HS_MATCH_TYPE(HS_DEVICE_TYPE_SERIAL, (void *)3),
+        HS_MATCH_VID_PID(0x16C0, 0x0478, (void *)4),
+        HS_MATCH_TYPE_VID_PID(HS_DEVICE_TYPE_HID, 0x16C0, 0x0483, (void *)5)
+    };
+    _hs_match_helper helper;
+    hs_device dev = {0};
+    void *udata;
+    int r;
+
+    r = _hs_match_helper_init(&helper, specs, _HS_COUNTOF(specs));
+    ASSERT(!r);
+    if (r)
+        return;
+
+    dev.type = HS_DEVICE_TYPE_HID;
+    dev.vid = 0x16C0;
+    dev.pid = 0x0483;
+    ASSERT(_hs_match_helper_match(&helper, &dev, &udata) && udata == (void *)1);
+    dev.pid = 0x0478;
+    ASSERT(_hs_match_helper_match(&helper, &dev, &udata) && udata == (void *)2);
+    dev.type = HS_DEVICE_TYPE_SERIAL;
+    ASSERT(_hs_match_helper_match(&helper, &dev, &udata) && udata == (void *)3);
+    dev.vid = 0x2341;
+    ASSERT(_hs_match_helper_match(&helper, &dev, &udata) && udata == (void *)3);
+    dev.type = HS_DEVICE_TYPE_HID;
+    ASSERT(!_hs_match_helper_match(&helper, &dev, &udata));
+
+    _hs_match_helper_release(&helper);
+}
+
+/* Compare the compiled matcher with a linear walk over thousands of specs, mixing exact
+   pairs, VID-only specs and specs without a VID. The timings are only compared with each
+   other, the sorted table wins by orders of magnitude at this size. */
+static void test_match_many(void)
+{
+    hs_match_spec *specs;
+    hs_device *devices;
+    _hs_match_helper helper = {0};
+    uint32_t state = 42;
+    int r;
+
+    specs = calloc(TEST_SPECS, sizeof(*specs));
+    devices = calloc(TEST_DEVICES, sizeof(*devices));
+    r = _hs_match_helper_init(&helper, NULL, 0);
+    ASSERT(specs && devices && !r);
+    if (!specs || !devices || r)
+        goto cleanup;
+
+    for (unsigned int i = 0; i < TEST_SPECS; i++) {
+        hs_match_spec *spec = &specs[i];
+        uint32_t kind = next_random(&state) % 64;
+
+        spec->type = next_random(&state) % 3;
+        if (kind) {
+            spec->vid = (uint16_t)(0x1000 + next_random(&state) % 64);
+            spec->pid = kind > 4 ? (uint16_t)(1 + next_random(&state) % 127) : 0;
+        } else {
+            // A spec without a VID would match everything, restrict these to a PID
+            spec->pid = (uint16_t)(1 + next_random(&state) % 127);
+        }
+        spec->udata = (void *)(size_t)(i + 1);
+    }
+    for (unsigned int i = 0; i < TEST_DEVICES; i++)
+        make_device(&state, &devices[i]);
+
+    r = _hs_match_helper_init(&helper, specs, TEST_SPECS);
+    ASSERT(!r);
+    if (r)
+        goto cleanup;
+
+    unsigned int matched = 0, mismatches = 0;
+    clock_t compiled_time = clock();
+    for (unsigned int i = 0; i < TEST_DEVICES; i++) {
+        void *udata = NULL;
+        if (_hs_match_helper_match(&helper, &devices[i], &udata))
+            matched++;
+        devices[i].match_udata = udata;
+    }
+    compiled_time = clock() - compiled_time;
+
+    clock_t linear_time = clock();
+    for (unsigned int i = 0; i < TEST_DEVICES; i++) {
+        void *udata = NULL;
+        match_linear(specs, TEST_SPECS, &devices[i], &udata);
+        if (udata != devices[i].match_udata)
+            mismatches++;
+    }
+    linear_time = clock() - linear_time;
+
+    ASSERT(matched > TEST_DEVICES / 4 && matched < TEST_DEVICES);
+    ASSERT(!mismatches);
+
+    // Timings depend too much on the machine and its load to be asserted
+    printf("    [compiled matcher: %.1f ms, linear matcher: %.1f ms]\n",
+           (double)compiled_time * 1000.0 / CLOCKS_PER_SEC,
+           (double)linear_time * 1000.0 / CLOCKS_PER_SEC);
+
+cleanup:
+    _hs_match_helper_release(&helper);
+    free(devices);
+    free(specs);
+}
+
+void test_match(void)
+{
+    test_match_order();
+    test_match_many();
+}
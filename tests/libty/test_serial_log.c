@@ -0,0 +1,359 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://koromix.dev/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/compress.h"
+#include "../../src/libty/serial_log.h"
+
+#define BASE_TIME 1600000000000ll
+
+struct search_context {
+    const int64_t *times;
+
+    uint64_t first;
+    uint64_t count;
+    bool valid;
+};
+
+static uint32_t next_random(uint32_t *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+static size_t format_line(char *buf, size_t size, uint64_t number)
+{
+    static const char *const states[] = {"IDLE", "RUNNING", "RUNNING", "WAIT"};
+    uint32_t state = (uint32_t)number;
+    uint32_t adc = next_random(&state) % 4096;
+    uint32_t temp = next_random(&state) % 1000;
+
+    return (size_t)snprintf(buf, size, "[%08" PRIu64 "] adc=%u temp=%u.%u state=%s\r\n",
+                            number, adc, temp / 10, temp % 10, states[number % 4]);
+}
+
+static void test_serial_log_codecs(void)
+{
+    static const size_t sizes[] = {0, 1, 12, 13, 100, 4096, 65536};
+    uint32_t state = 42;
+
+    for (unsigned int kind = 0; kind < 3; kind++) {
+        for (size_t i = 0; i < _HS_COUNTOF(sizes); i++) {
+            size_t len = sizes[i];
+            char *src = malloc(len + 1);
+            char *compressed = malloc(ty_lz4_compress_bound(len));
+            char *dest = malloc(len + 1);
+            size_t compressed_len, huffman_len;
+
+            ASSERT(src && compressed && dest);
+            if (!src || !compressed || !dest)
+                goto next;
+
+            // Text, random bytes and long runs
+            for (size_t j = 0; j < len;) {
+                if (kind == 0) {
+                    char line[128];
+                    size_t line_len = format_line(line, sizeof(line), j / 40);
+                    size_t copy_len = _HS_MIN(line_len, len - j);
+
+                    memcpy(src + j, line, copy_len);
+                    j += copy_len;
+                } else if (kind == 1) {
+                    src[j++] = (char)next_random(&state);
+                } else {
+                    src[j] = (char)(j / 1000 % 4);
+                    j++;
+                }
+            }
+
+            compressed_len = ty_lz4_compress(src, len, compressed);
+            ASSERT(compressed_len <= ty_lz4_compress_bound(len));
+            ASSERT(ty_lz4_decompress(compressed, compressed_len, dest, len));
+            ASSERT(!memcmp(src, dest, len));
+            if (kind == 0 && len >= 4096)
+                ASSERT(compressed_len < len / 2);
+            if (kind == 2 && len >= 4096)
+                ASSERT(compressed_len < len / 50);
+
+            // The exact size is required, and truncated blocks must be rejected
+            ASSERT(!ty_lz4_decompress(compressed, compressed_len, dest, len + 1));
+            if (len)
+                ASSERT(!ty_lz4_decompress(compressed, compressed_len - 1, dest, len));
+
+            // Huffman coding gives up on random data, and is only worth it on big buffers
+            huffman_len = ty_huffman_compress(src, len, compressed);
+            ASSERT(huffman_len < len || (!huffman_len && !len));
+            if (kind == 1 || len < 200) {
+                ASSERT(!huffman_len);
+            } else {
+                ASSERT(huffman_len > 0 && huffman_len < len * 3 / 4);
+                ASSERT(ty_huffman_decompressed_size(compressed, huffman_len) == len);
+                ASSERT(ty_huffman_decompress(compressed, huffman_len, dest, len));
+                ASSERT(!memcmp(src, dest, len));
+                ASSERT(!ty_huffman_decompress(compressed, huffman_len, dest, len - 1));
+                ASSERT(!ty_huffman_decompress(compressed, huffman_len - 1, dest, len));
+            }
+
+next:
+            free(dest);
+            free(compressed);
+            free(src);
+        }
+    }
+}
+
+static int check_line(const ty_serial_log_line *line, void *udata)
+{
+    struct search_context *ctx = udata;
+    char expected[128];
+    size_t expected_len = format_line(expected, sizeof(expected), line->number) - 2;
+
+    if (!ctx->count) {
+        ctx->first = line->number;
+    } else if (line->number != ctx->first + ctx->count) {
+        ctx->valid = false;
+    }
+    ctx->count++;
+
+    if (line->len != expected_len || memcmp(line->text, expected, expected_len) ||
+            line->time != ctx->times[line->number])
+        ctx->valid = false;
+
+    return 0;
+}
+
+static int search_log(const char *filename, int64_t start_time, int64_t end_time,
+                      const char *needle, const int64_t *times, struct search_context *rctx)
+{
+    ty_serial_log_query query;
+
+    query.start_time = start_time;
+    query.end_time = end_time;
+    query.needle = needle;
+
+    memset(rctx, 0, sizeof(*rctx));
+    rctx->times = times;
+    rctx->valid = true;
+
+    return ty_serial_log_search(filename, &query, check_line, rctx);
+}
+
+static int stop_search(const ty_serial_log_line *line, void *udata)
+{
+    _HS_UNUSED(line);
+
+    (*(unsigned int *)udata)++;
+    return 42;
+}
+
+// Writes groups of lines, each group with its own time like serial reads
+static int write_lines(ty_serial_log *log, uint64_t *rnext, uint64_t count,
+                       unsigned int max_group, int64_t *times, uint32_t *state)
+{
+    uint64_t end = *rnext + count;
+
+    while (*rnext < end) {
+        char buf[2048];
+        size_t len = 0;
+        uint64_t group_len = _HS_MIN(next_random(state) % max_group + 1, end - *rnext);
+        int64_t time = BASE_TIME + (int64_t)*rnext * 10;
+        int r;
+
+        for (uint64_t i = 0; i < group_len; i++) {
+            times[*rnext] = time;
+            len += format_line(buf + len, sizeof(buf) - len, (*rnext)++);
+        }
+
+        r = ty_serial_log_write(log, buf, len, time);
+        if (r < 0)
+            return r;
+        if (next_random(state) % 500 == 0) {
+            r = ty_serial_log_flush(log);
+            if (r < 0)
+                return r;
+        }
+    }
+
+    return ty_serial_log_flush(log);
+}
+
+static void test_serial_log_ring(void)
+{
+    static const char *filename = "test_serial_log_ring.log";
+    const uint64_t total = 300000;
+    const uint64_t size = 1024 * 1024;
+    ty_serial_log *log = NULL;
+    int64_t *times;
+    uint64_t next = 0;
+    uint32_t state = 7;
+    struct search_context ctx;
+    int r;
+
+    times = calloc(total, sizeof(*times));
+    ASSERT(times);
+    if (!times)
+        return;
+
+    r = ty_serial_log_open(filename, size, &log);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    // Readers only see what has been flushed, and partial lines are fine
+    r = write_lines(log, &next, 100, 20, times, &state);
+    ASSERT(!r);
+    r = ty_serial_log_write(log, "[00000100] adc", 14, BASE_TIME + 1000);
+    ASSERT(!r);
+    r = search_log(filename, INT64_MIN, INT64_MAX, NULL, times, &ctx);
+    ASSERT(!r && ctx.valid && !ctx.first && ctx.count == 100);
+    r = ty_serial_log_flush(log);
+    ASSERT(!r);
+    r = search_log(filename, INT64_MIN, INT64_MAX, "[00000100]", times, &ctx);
+    ASSERT(!r && ctx.count == 1 && ctx.first == 100);
+    ty_serial_log_close(log);
+    log = NULL;
+
+    // Write about 8 MB of text, the oldest lines get overwritten
+    next = 0;
+    r = ty_serial_log_open(filename, size, &log);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    r = write_lines(log, &next, total / 3, 20, times, &state);
+    ASSERT(!r);
+    r = search_log(filename, INT64_MIN, INT64_MAX, NULL, times, &ctx);
+    ASSERT(!r && ctx.valid && ctx.first > 0 && ctx.first + ctx.count == next);
+    r = write_lines(log, &next, total / 3, 20, times, &state);
+    ASSERT(!r);
+    r = search_log(filename, INT64_MIN, INT64_MAX, NULL, times, &ctx);
+    ASSERT(!r && ctx.valid && ctx.first > 0 && ctx.first + ctx.count == next);
+
+    // The text must take several times less space than its raw size
+    {
+        FILE *fp = fopen(filename, "rb");
+        long file_size = -1;
+
+        ASSERT(fp);
+        if (fp) {
+            fseek(fp, 0, SEEK_END);
+            file_size = ftell(fp);
+            fclose(fp);
+        }
+        ASSERT(file_size > 0 && (uint64_t)file_size <= size);
+        ASSERT(ctx.count * 40 > 2 * size);
+    }
+
+    // Time ranges are inclusive
+    {
+        uint64_t start = ctx.first + ctx.count / 3;
+        uint64_t end = start + 5000;
+
+        r = search_log(filename, times[start], times[end], NULL, times, &ctx);
+        ASSERT(!r && ctx.valid);
+        ASSERT(ctx.count && times[ctx.first] == times[start] && ctx.first <= start &&
+               times[ctx.first + ctx.count - 1] == times[end] &&
+               ctx.first + ctx.count - 1 >= end);
+        r = search_log(filename, BASE_TIME - 1000, BASE_TIME - 1, NULL, times, &ctx);
+        ASSERT(!r && !ctx.count);
+    }
+
+    // Substring search, with and without a time range
+    {
+        char needle[32];
+
+        snprintf(needle, sizeof(needle), "[%08" PRIu64 "]", next - 1000);
+        r = search_log(filename, INT64_MIN, INT64_MAX, needle, times, &ctx);
+        ASSERT(!r && ctx.valid && ctx.count == 1 && ctx.first == next - 1000);
+        r = search_log(filename, times[next - 999], INT64_MAX, needle, times, &ctx);
+        ASSERT(!r && !ctx.count);
+        // Half of the lines match, the check for consecutive numbers fails on purpose
+        r = search_log(filename, INT64_MIN, INT64_MAX, "state=RUNNING", times, &ctx);
+        ASSERT(!r && !ctx.valid && ctx.count > 1000);
+        r = search_log(filename, INT64_MIN, INT64_MAX, "not in the log", times, &ctx);
+        ASSERT(!r && !ctx.count);
+    }
+
+    // Callbacks can stop the search
+    {
+        ty_serial_log_query query = {INT64_MIN, INT64_MAX, NULL};
+        unsigned int calls = 0;
+
+        r = ty_serial_log_search(filename, &query, stop_search, &calls);
+        ASSERT(r == 42 && calls == 1);
+    }
+
+    /* Shrink the log, then grow it back, and keep writing each time. Write one line at a
+       time in between, so that blocks run out of time marks. */
+    {
+        uint64_t prev_count;
+
+        r = search_log(filename, INT64_MIN, INT64_MAX, NULL, times, &ctx);
+        prev_count = ctx.count;
+
+        r = ty_serial_log_resize(log, size / 2);
+        ASSERT(!r);
+        r = search_log(filename, INT64_MIN, INT64_MAX, NULL, times, &ctx);
+        ASSERT(!r && ctx.valid && ctx.count < prev_count && ctx.first + ctx.count == next);
+        r = write_lines(log, &next, 10000, 1, times, &state);
+        ASSERT(!r);
+        r = search_log(filename, INT64_MIN, INT64_MAX, NULL, times, &ctx);
+        ASSERT(!r && ctx.valid && ctx.first + ctx.count == next);
+
+        r = ty_serial_log_resize(log, size * 2);
+        ASSERT(!r);
+        r = search_log(filename, INT64_MIN, INT64_MAX, NULL, times, &ctx);
+        ASSERT(!r && ctx.valid && ctx.first + ctx.count == next);
+        prev_count = ctx.count;
+        r = write_lines(log, &next, total - next, 20, times, &state);
+        ASSERT(!r);
+        r = search_log(filename, INT64_MIN, INT64_MAX, NULL, times, &ctx);
+        ASSERT(!r && ctx.valid && ctx.count > prev_count && ctx.first + ctx.count == next);
+    }
+
+cleanup:
+    ty_serial_log_close(log);
+    remove(filename);
+    free(times);
+}
+
+static void test_serial_log_errors(void)
+{
+    static const char *filename = "test_serial_log_errors.log";
+    ty_serial_log_query query = {INT64_MIN, INT64_MAX, NULL};
+    unsigned int calls = 0;
+    FILE *fp;
+    int r;
+
+    ty_error_mask(TY_ERROR_NOT_FOUND);
+    r = ty_serial_log_search(filename, &query, stop_search, &calls);
+    ty_error_unmask();
+    ASSERT(r == TY_ERROR_NOT_FOUND);
+
+    // Raw logs from older versions are not supported
+    fp = fopen(filename, "wb");
+    ASSERT(fp);
+    if (fp) {
+        fputs("TYLOG1 0000000000001000 0000000000000010 -\n", fp);
+        fclose(fp);
+    }
+    ty_error_mask(TY_ERROR_PARSE);
+    r = ty_serial_log_search(filename, &query, stop_search, &calls);
+    ty_error_unmask();
+    ASSERT(r == TY_ERROR_PARSE && !calls);
+
+    remove(filename);
+}
+
+void test_serial_log(void)
+{
+    test_serial_log_codecs();
+    test_serial_log_ring();
+    test_serial_log_errors();
+}